@@ -0,0 +1,689 @@
+#include "assembler.h"
+#include "decoder.h"
+#include "printer.h"
+
+#include <charconv>
+#include <string_view>
+
+namespace
+{
+	const std::string_view s_wide_registers[8] =
+	{
+		"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"
+	};
+
+	const std::string_view s_byte_registers[8] =
+	{
+		"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"
+	};
+
+	const std::string_view s_segment_registers[4] =
+	{
+		"es", "cs", "ss", "ds"
+	};
+
+	enum Kind : std::uint8_t
+	{
+		Kind_none,
+		Kind_register,
+		Kind_segment,
+		Kind_memory,
+		Kind_immediate,
+		Kind_relative, // $+offset
+		Kind_far, // segment:offset
+	};
+
+	struct Operand
+	{
+		Kind kind = Kind_none;
+		bool w = false; // registers
+		std::uint8_t reg = 0; // register number, or the r/m effective address formula of a memory operand
+		bool direct = false; // memory addressed by the displacement alone
+		bool has_displacement = false;
+		std::uint16_t value = 0; // displacement, immediate, offset from the start of the instruction or segment
+		std::uint16_t offset = 0; // of a far pointer
+		std::uint8_t size = 0; // 1 or 2 when given as byte or word, a byte immediate is the sign extended form
+	};
+
+	struct Line
+	{
+		sim86::Operation operation = sim86::Operation_none;
+		bool w = false; // string instructions
+		std::uint8_t flags = 0; // lock, rep and repne
+		std::int8_t segment = -1; // of a segment prefix
+		bool far = false;
+		bool near = false;
+		Operand operands[2];
+	};
+
+	struct Parser
+	{
+		std::string_view text;
+
+		bool eat(const std::string_view word)
+		{
+			if (!text.starts_with(word)) return false;
+			text.remove_prefix(word.size());
+			return true;
+		}
+
+		bool eat(const char c)
+		{
+			if (text.empty() || text.front() != c) return false;
+			text.remove_prefix(1);
+			return true;
+		}
+
+		// A word ends at a space, a comma, a colon or a bracket
+		std::string_view word()
+		{
+			std::size_t size = 0;
+			while (size < text.size() && text[size] != ' ' && text[size] != ',' && text[size] != ':' && text[size] != '[' && text[size] != ']') ++size;
+			const std::string_view result = text.substr(0, size);
+			text.remove_prefix(size);
+			return result;
+		}
+
+		// nasm hex as print writes it, or a decimal number
+		bool number(std::uint32_t& value)
+		{
+			const int base = eat("0x") ? 16 : 10;
+			const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+			if (ec != std::errc()) return false;
+			text.remove_prefix(ptr - text.data());
+			return true;
+		}
+
+		bool signed_number(std::int32_t& value)
+		{
+			const bool negative = eat('-');
+			if (!negative && !eat('+')) return false;
+			std::uint32_t magnitude;
+			if (!number(magnitude)) return false;
+			value = negative ? -static_cast<std::int32_t>(magnitude) : static_cast<std::int32_t>(magnitude);
+			return true;
+		}
+	};
+
+	template <std::size_t N>
+	int find(const std::string_view (&names)[N], const std::string_view name)
+	{
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			if (names[i] == name) return static_cast<int>(i);
+		}
+		return -1;
+	}
+
+	bool parse_memory(Parser& parser, Line& line, Operand& operand)
+	{
+		operand.kind = Kind_memory;
+		const std::string_view save = parser.text;
+		const int segment = find(s_segment_registers, parser.word());
+		if (segment >= 0 && parser.eat(':')) line.segment = static_cast<std::int8_t>(segment);
+		else parser.text = save;
+
+		std::uint32_t value;
+		if (parser.text.starts_with("0x"))
+		{
+			if (!parser.number(value) || value > 0xffff) return false;
+			operand.direct = true;
+			operand.value = static_cast<std::uint16_t>(value);
+			return parser.eat(']');
+		}
+		// The formulas of two registers first, bx+si would otherwise be taken for bx
+		bool found = false;
+		for (std::uint8_t r_m = 0; r_m < 8 && !found; ++r_m)
+		{
+			const std::string_view name = sim86::get_ea_name(r_m);
+			if (name.size() == 5 && parser.eat(name)) operand.reg = r_m, found = true;
+		}
+		for (std::uint8_t r_m = 0; r_m < 8 && !found; ++r_m)
+		{
+			const std::string_view name = sim86::get_ea_name(r_m);
+			if (name.size() == 2 && parser.eat(name)) operand.reg = r_m, found = true;
+		}
+		if (!found) return false;
+		std::int32_t displacement;
+		if (parser.signed_number(displacement))
+		{
+			if (displacement < -0x8000 || displacement > 0xffff) return false;
+			operand.has_displacement = true;
+			operand.value = static_cast<std::uint16_t>(displacement);
+		}
+		return parser.eat(']');
+	}
+
+	bool parse_operand(Parser& parser, Line& line, Operand& operand)
+	{
+		if (parser.eat("far ")) line.far = true;
+		if (parser.eat("near ")) line.near = true;
+		if (parser.eat("byte ")) operand.size = 1;
+		else if (parser.eat("word ")) operand.size = 2;
+
+		if (parser.eat('[')) return parse_memory(parser, line, operand);
+		std::int32_t signed_value;
+		if (parser.eat('$'))
+		{
+			if (!parser.signed_number(signed_value)) return false;
+			operand.kind = Kind_relative;
+			operand.value = static_cast<std::uint16_t>(signed_value);
+			return true;
+		}
+		if (operand.size == 1 && (parser.text.starts_with('+') || parser.text.starts_with('-')))
+		{
+			// The sign extended byte of an immediate word
+			if (!parser.signed_number(signed_value) || signed_value < -0x80 || signed_value > 0xff) return false;
+			operand.kind = Kind_immediate;
+			operand.value = static_cast<std::uint16_t>(static_cast<std::int8_t>(signed_value));
+			return true;
+		}
+		std::uint32_t value;
+		if (!parser.text.empty() && parser.text.front() >= '0' && parser.text.front() <= '9')
+		{
+			if (!parser.number(value) || value > 0xffff) return false;
+			operand.kind = Kind_immediate;
+			operand.value = static_cast<std::uint16_t>(value);
+			if (!parser.eat(':')) return true;
+			// segment:offset
+			operand.kind = Kind_far;
+			operand.offset = 0;
+			if (!parser.number(value) || value > 0xffff) return false;
+			operand.offset = static_cast<std::uint16_t>(value);
+			return true;
+		}
+
+		const std::string_view name = parser.word();
+		if (const int reg = find(s_wide_registers, name); reg >= 0)
+		{
+			operand = { Kind_register, true, static_cast<std::uint8_t>(reg) };
+			return true;
+		}
+		if (const int reg = find(s_byte_registers, name); reg >= 0)
+		{
+			operand = { Kind_register, false, static_cast<std::uint8_t>(reg) };
+			return true;
+		}
+		if (const int reg = find(s_segment_registers, name); reg >= 0)
+		{
+			operand = { Kind_segment, true, static_cast<std::uint8_t>(reg) };
+			return true;
+		}
+		return false;
+	}
+
+	bool is_string(const sim86::Operation op)
+	{
+		return op >= sim86::Operation_movs && op <= sim86::Operation_stos;
+	}
+
+	bool parse_mnemonic(const std::string_view name, Line& line)
+	{
+		if (name == "xlatb")
+		{
+			line.operation = sim86::Operation_xlat;
+			return true;
+		}
+		// The prefixes are never mnemonics of their own
+		for (std::size_t op = sim86::Operation_none + 1; op < sim86::Operation_lock; ++op)
+		{
+			const sim86::Operation operation = static_cast<sim86::Operation>(op);
+			const std::string_view op_name = sim86::get_operation_name(operation);
+			if (is_string(operation))
+			{
+				if (name.size() != op_name.size() + 1 || !name.starts_with(op_name)) continue;
+				if (name.back() != 'b' && name.back() != 'w') return false;
+				line.w = name.back() == 'w';
+			}
+			else if (name != op_name)
+			{
+				continue;
+			}
+			line.operation = operation;
+			return true;
+		}
+		return false;
+	}
+
+	bool parse_line(const std::string_view text, Line& line)
+	{
+		Parser parser{ text };
+		for (;;)
+		{
+			if (parser.eat("lock ")) line.flags |= sim86::Instruction_lock;
+			else if (parser.eat("repne ")) line.flags |= sim86::Instruction_repne;
+			else if (parser.eat("rep ")) line.flags |= sim86::Instruction_rep;
+			else break;
+		}
+		if (!parse_mnemonic(parser.word(), line)) return false;
+		if (parser.text.empty()) return true;
+		if (!parser.eat(' ') || !parse_operand(parser, line, line.operands[0])) return false;
+		if (parser.eat(',') && !parse_operand(parser, line, line.operands[1])) return false;
+		return parser.text.empty();
+	}
+
+	bool is_register(const Operand& operand)
+	{
+		return operand.kind == Kind_register;
+	}
+
+	bool is_accumulator(const Operand& operand)
+	{
+		return operand.kind == Kind_register && operand.reg == 0;
+	}
+
+	bool is_r_m(const Operand& operand)
+	{
+		return operand.kind == Kind_register || operand.kind == Kind_memory;
+	}
+
+	bool fits_byte(const std::int32_t value)
+	{
+		return value >= -0x80 && value <= 0x7f;
+	}
+
+	// The width of the operation, from a register operand if it has one or else the size of its memory operand
+	bool get_w(const Line& line)
+	{
+		// The count of a shift and the port of in and out say nothing of the width
+		const sim86::Operation op = line.operation;
+		if (op >= sim86::Operation_rol && op <= sim86::Operation_sar) return line.operands[0].kind == Kind_register ? line.operands[0].w : line.operands[0].size == 2;
+		if (op == sim86::Operation_in) return line.operands[0].w;
+		if (op == sim86::Operation_out) return line.operands[1].w;
+		for (const Operand& operand : line.operands)
+		{
+			if (operand.kind == Kind_register || operand.kind == Kind_segment) return operand.w;
+		}
+		for (const Operand& operand : line.operands)
+		{
+			if (operand.kind == Kind_memory && operand.size != 0) return operand.size == 2;
+		}
+		return line.w;
+	}
+
+	std::uint8_t* emit_u16(std::uint8_t* out, const std::uint16_t value)
+	{
+		*out++ = value & 0xff;
+		*out++ = value >> 8;
+		return out;
+	}
+
+	std::uint8_t* emit_immediate(std::uint8_t* out, const std::uint16_t value, const bool w)
+	{
+		if (w) return emit_u16(out, value);
+		*out++ = value & 0xff;
+		return out;
+	}
+
+	// The mod reg r/m byte and any displacement, reg is a register or the fixed bits of the encoding
+	std::uint8_t* emit_r_m(std::uint8_t* out, const std::uint8_t reg, const Operand& operand)
+	{
+		if (operand.kind == Kind_register)
+		{
+			*out++ = static_cast<std::uint8_t>(0xc0 | (reg << 3) | operand.reg);
+			return out;
+		}
+		if (operand.direct)
+		{
+			*out++ = static_cast<std::uint8_t>((reg << 3) | 0b110);
+			return emit_u16(out, operand.value);
+		}
+		const std::int16_t displacement = static_cast<std::int16_t>(operand.value);
+		// bp without a displacement would be a direct address
+		if (displacement == 0 && operand.reg != 0b110)
+		{
+			*out++ = static_cast<std::uint8_t>((reg << 3) | operand.reg);
+			return out;
+		}
+		if (fits_byte(displacement))
+		{
+			*out++ = static_cast<std::uint8_t>(0x40 | (reg << 3) | operand.reg);
+			*out++ = static_cast<std::uint8_t>(displacement);
+			return out;
+		}
+		*out++ = static_cast<std::uint8_t>(0x80 | (reg << 3) | operand.reg);
+		return emit_u16(out, operand.value);
+	}
+
+	// Offsets are from the start of the instruction, its prefixes included, to the end of it
+	std::uint8_t* emit_relative_8(const std::uint8_t* start, std::uint8_t* out, const std::uint8_t opcode, const Operand& target)
+	{
+		const std::int32_t offset = static_cast<std::int16_t>(target.value) - static_cast<std::int32_t>(out - start + 2);
+		if (!fits_byte(offset)) return nullptr;
+		*out++ = opcode;
+		*out++ = static_cast<std::uint8_t>(offset);
+		return out;
+	}
+
+	std::uint8_t* emit_relative_16(const std::uint8_t* start, std::uint8_t* out, const std::uint8_t opcode, const Operand& target)
+	{
+		const std::uint16_t offset = static_cast<std::uint16_t>(target.value - (out - start + 3));
+		*out++ = opcode;
+		return emit_u16(out, offset);
+	}
+
+	// Writes the instruction after the prefixes from start
+	std::uint8_t* encode(const Line& line, const std::uint8_t* start, std::uint8_t* out)
+	{
+		using namespace sim86;
+		const Operation op = line.operation;
+		const Operand& dst = line.operands[0];
+		const Operand& src = line.operands[1];
+		const bool w = get_w(line);
+		const std::uint8_t wide = w ? 1 : 0;
+
+		if (op >= Operation_add && op <= Operation_cmp)
+		{
+			const std::uint8_t group = static_cast<std::uint8_t>(op - Operation_add);
+			if (is_r_m(dst) && is_register(src))
+			{
+				*out++ = static_cast<std::uint8_t>((group << 3) | wide);
+				return emit_r_m(out, src.reg, dst);
+			}
+			if (is_register(dst) && src.kind == Kind_memory)
+			{
+				*out++ = static_cast<std::uint8_t>((group << 3) | 2 | wide);
+				return emit_r_m(out, dst.reg, src);
+			}
+			if (!is_r_m(dst) || src.kind != Kind_immediate) return nullptr;
+			const bool sign_extended = w && (src.size == 1 || fits_byte(static_cast<std::int16_t>(src.value)));
+			if (sign_extended)
+			{
+				*out++ = 0x83;
+				out = emit_r_m(out, group, dst);
+				*out++ = src.value & 0xff;
+				return out;
+			}
+			if (is_accumulator(dst))
+			{
+				*out++ = static_cast<std::uint8_t>((group << 3) | 4 | wide);
+				return emit_immediate(out, src.value, w);
+			}
+			*out++ = static_cast<std::uint8_t>(0x80 | wide);
+			out = emit_r_m(out, group, dst);
+			return emit_immediate(out, src.value, w);
+		}
+
+		if (op >= Operation_jo && op <= Operation_jg) return emit_relative_8(start, out, static_cast<std::uint8_t>(0x70 + op - Operation_jo), dst);
+		if (op >= Operation_loopne && op <= Operation_jcxz) return emit_relative_8(start, out, static_cast<std::uint8_t>(0xe0 + op - Operation_loopne), dst);
+		if (op >= Operation_rol && op <= Operation_sar)
+		{
+			// There is no shift with the reg field 110
+			const std::uint8_t group = static_cast<std::uint8_t>(op == Operation_sar ? 7 : op - Operation_rol);
+			if (src.kind == Kind_immediate && src.value == 1) *out++ = static_cast<std::uint8_t>(0xd0 | wide);
+			else if (is_register(src) && !src.w && src.reg == 1) *out++ = static_cast<std::uint8_t>(0xd2 | wide);
+			else return nullptr;
+			return emit_r_m(out, group, dst);
+		}
+		// not, neg, mul, imul, div and idiv are 0xf6 and 0xf7 with 2 to 7 in the reg field
+		static const Operation s_unary[] = { Operation_not, Operation_neg, Operation_mul, Operation_imul, Operation_div, Operation_idiv };
+		for (std::uint8_t group = 2; group < 8; ++group)
+		{
+			if (s_unary[group - 2] != op) continue;
+			*out++ = static_cast<std::uint8_t>(0xf6 | wide);
+			return emit_r_m(out, group, dst);
+		}
+		if (is_string(op))
+		{
+			static const std::uint8_t s_opcodes[] = { 0xa4, 0xa6, 0xae, 0xac, 0xaa }; // movs, cmps, scas, lods, stos
+			*out++ = static_cast<std::uint8_t>(s_opcodes[op - Operation_movs] | (line.w ? 1 : 0));
+			return out;
+		}
+
+		switch (op)
+		{
+		case Operation_mov:
+			if (dst.kind == Kind_segment)
+			{
+				*out++ = 0x8e;
+				return emit_r_m(out, dst.reg, src);
+			}
+			if (src.kind == Kind_segment)
+			{
+				*out++ = 0x8c;
+				return emit_r_m(out, src.reg, dst);
+			}
+			if (is_accumulator(dst) && src.kind == Kind_memory && src.direct)
+			{
+				*out++ = static_cast<std::uint8_t>(0xa0 | wide);
+				return emit_u16(out, src.value);
+			}
+			if (dst.kind == Kind_memory && dst.direct && is_accumulator(src))
+			{
+				*out++ = static_cast<std::uint8_t>(0xa2 | wide);
+				return emit_u16(out, dst.value);
+			}
+			if (is_r_m(dst) && is_register(src))
+			{
+				*out++ = static_cast<std::uint8_t>(0x88 | wide);
+				return emit_r_m(out, src.reg, dst);
+			}
+			if (is_register(dst) && src.kind == Kind_memory)
+			{
+				*out++ = static_cast<std::uint8_t>(0x8a | wide);
+				return emit_r_m(out, dst.reg, src);
+			}
+			if (is_register(dst) && src.kind == Kind_immediate)
+			{
+				*out++ = static_cast<std::uint8_t>(0xb0 | (wide << 3) | dst.reg);
+				return emit_immediate(out, src.value, w);
+			}
+			if (dst.kind == Kind_memory && src.kind == Kind_immediate)
+			{
+				*out++ = static_cast<std::uint8_t>(0xc6 | wide);
+				out = emit_r_m(out, 0, dst);
+				return emit_immediate(out, src.value, w);
+			}
+			return nullptr;
+
+		case Operation_push:
+		case Operation_pop:
+			{
+				const bool push = op == Operation_push;
+				if (is_register(dst) && dst.w)
+				{
+					*out++ = static_cast<std::uint8_t>((push ? 0x50 : 0x58) | dst.reg);
+					return out;
+				}
+				if (dst.kind == Kind_segment)
+				{
+					*out++ = static_cast<std::uint8_t>((push ? 0x06 : 0x07) | (dst.reg << 3));
+					return out;
+				}
+				if (dst.kind != Kind_memory) return nullptr;
+				*out++ = push ? 0xff : 0x8f;
+				return emit_r_m(out, push ? 6 : 0, dst);
+			}
+
+		case Operation_inc:
+		case Operation_dec:
+			{
+				const std::uint8_t group = op == Operation_inc ? 0 : 1;
+				if (is_register(dst) && dst.w)
+				{
+					*out++ = static_cast<std::uint8_t>(0x40 | (group << 3) | dst.reg);
+					return out;
+				}
+				*out++ = static_cast<std::uint8_t>(0xfe | wide);
+				return emit_r_m(out, group, dst);
+			}
+
+		case Operation_xchg:
+			// xchg ax,ax would be nop
+			if (w && is_accumulator(dst) && is_register(src) && src.reg != 0)
+			{
+				*out++ = static_cast<std::uint8_t>(0x90 | src.reg);
+				return out;
+			}
+			if (w && is_register(dst) && dst.reg != 0 && is_accumulator(src))
+			{
+				*out++ = static_cast<std::uint8_t>(0x90 | dst.reg);
+				return out;
+			}
+			*out++ = static_cast<std::uint8_t>(0x86 | wide);
+			if (is_register(dst)) return emit_r_m(out, dst.reg, src);
+			if (is_register(src)) return emit_r_m(out, src.reg, dst);
+			return nullptr;
+
+		case Operation_test:
+			if (is_r_m(dst) && is_register(src))
+			{
+				*out++ = static_cast<std::uint8_t>(0x84 | wide);
+				return emit_r_m(out, src.reg, dst);
+			}
+			if (is_register(dst) && src.kind == Kind_memory)
+			{
+				*out++ = static_cast<std::uint8_t>(0x84 | wide);
+				return emit_r_m(out, dst.reg, src);
+			}
+			if (src.kind != Kind_immediate) return nullptr;
+			if (is_accumulator(dst))
+			{
+				*out++ = static_cast<std::uint8_t>(0xa8 | wide);
+				return emit_immediate(out, src.value, w);
+			}
+			*out++ = static_cast<std::uint8_t>(0xf6 | wide);
+			out = emit_r_m(out, 0, dst);
+			return emit_immediate(out, src.value, w);
+
+		case Operation_in:
+			if (!is_accumulator(dst)) return nullptr;
+			if (src.kind == Kind_immediate)
+			{
+				*out++ = static_cast<std::uint8_t>(0xe4 | wide);
+				*out++ = src.value & 0xff;
+				return out;
+			}
+			*out++ = static_cast<std::uint8_t>(0xec | wide);
+			return out;
+
+		case Operation_out:
+			if (!is_accumulator(src)) return nullptr;
+			if (dst.kind == Kind_immediate)
+			{
+				*out++ = static_cast<std::uint8_t>(0xe6 | wide);
+				*out++ = dst.value & 0xff;
+				return out;
+			}
+			*out++ = static_cast<std::uint8_t>(0xee | wide);
+			return out;
+
+		case Operation_lea:
+		case Operation_lds:
+		case Operation_les:
+			*out++ = op == Operation_lea ? 0x8d : op == Operation_lds ? 0xc5 : 0xc4;
+			return emit_r_m(out, dst.reg, src);
+
+		case Operation_call:
+		case Operation_jmp:
+			{
+				const bool call = op == Operation_call;
+				if (dst.kind == Kind_relative)
+				{
+					if (!call && !line.near)
+					{
+						if (std::uint8_t* const last = emit_relative_8(start, out, 0xeb, dst)) return last;
+					}
+					return emit_relative_16(start, out, call ? 0xe8 : 0xe9, dst);
+				}
+				if (dst.kind == Kind_far)
+				{
+					*out++ = call ? 0x9a : 0xea;
+					out = emit_u16(out, dst.offset);
+					return emit_u16(out, dst.value);
+				}
+				*out++ = 0xff;
+				return emit_r_m(out, static_cast<std::uint8_t>((call ? 2 : 4) + (line.far ? 1 : 0)), dst);
+			}
+
+		case Operation_ret:
+		case Operation_retf:
+			{
+				const std::uint8_t opcode = op == Operation_ret ? 0xc2 : 0xca;
+				if (dst.kind == Kind_none)
+				{
+					*out++ = opcode | 1;
+					return out;
+				}
+				*out++ = opcode;
+				return emit_u16(out, dst.value);
+			}
+
+		case Operation_int:
+			*out++ = 0xcd;
+			*out++ = dst.value & 0xff;
+			return out;
+
+		case Operation_aam:
+		case Operation_aad:
+			*out++ = op == Operation_aam ? 0xd4 : 0xd5;
+			*out++ = 0x0a;
+			return out;
+
+		default:
+			break;
+		}
+
+		static const struct
+		{
+			Operation operation;
+			std::uint8_t opcode;
+		} s_single_bytes[] =
+		{
+			{ Operation_nop, 0x90 }, { Operation_xlat, 0xd7 }, { Operation_lahf, 0x9f }, { Operation_sahf, 0x9e },
+			{ Operation_pushf, 0x9c }, { Operation_popf, 0x9d }, { Operation_aaa, 0x37 }, { Operation_daa, 0x27 },
+			{ Operation_aas, 0x3f }, { Operation_das, 0x2f }, { Operation_cbw, 0x98 }, { Operation_cwd, 0x99 },
+			{ Operation_int3, 0xcc }, { Operation_into, 0xce }, { Operation_iret, 0xcf }, { Operation_clc, 0xf8 },
+			{ Operation_cmc, 0xf5 }, { Operation_stc, 0xf9 }, { Operation_cld, 0xfc }, { Operation_std, 0xfd },
+			{ Operation_cli, 0xfa }, { Operation_sti, 0xfb }, { Operation_hlt, 0xf4 }, { Operation_wait, 0x9b },
+		};
+		for (const auto& single : s_single_bytes)
+		{
+			if (single.operation != op) continue;
+			*out++ = single.opcode;
+			return out;
+		}
+		return nullptr;
+	}
+}
+
+namespace sim86
+{
+	std::uint8_t* assemble(const std::string_view line, std::uint8_t* out)
+	{
+		if (line.starts_with("db "))
+		{
+			Parser parser{ line.substr(3) };
+			std::uint32_t value;
+			if (!parser.number(value) || value > 0xff || !parser.text.empty()) return nullptr;
+			*out++ = static_cast<std::uint8_t>(value);
+			return out;
+		}
+
+		Line parsed;
+		if (!parse_line(line, parsed)) return nullptr;
+		const std::uint8_t* const start = out;
+		// NOTE(rksouthee): nasm writes a rep prefix before lock and both before a segment prefix
+		if (parsed.flags & Instruction_rep) *out++ = 0xf3;
+		if (parsed.flags & Instruction_repne) *out++ = 0xf2;
+		if (parsed.flags & Instruction_lock) *out++ = 0xf0;
+		if (parsed.segment >= 0) *out++ = static_cast<std::uint8_t>(0x26 | (parsed.segment << 3));
+		return encode(parsed, start, out);
+	}
+
+	std::size_t assemble(std::string_view listing, std::vector<std::uint8_t>& code)
+	{
+		std::uint8_t bytes[max_instruction_size];
+		for (std::size_t number = 1; !listing.empty(); ++number)
+		{
+			const std::size_t end = listing.find('\n');
+			const std::string_view line = listing.substr(0, end);
+			listing.remove_prefix(end == std::string_view::npos ? listing.size() : end + 1);
+			if (line.empty() || line == "bits 16") continue;
+			std::uint8_t* const last = assemble(line, bytes);
+			if (!last) return number;
+			code.insert(code.end(), bytes, last);
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace sim86
+{
+	// NOTE(rksouthee): Assembles the text print writes, and nothing else, into the bytes nasm assembles it to. Where
+	// nasm has a choice of encodings it takes the shortest: the accumulator forms, a sign extended byte for an
+	// immediate word that fits one, a short jump when the target is in reach and no displacement for a zero one
+	// unless it is from bp. Jumps are written relative to the start of the instruction as $+offset.
+
+	// Writes the bytes of a line to out, which must have room for max_instruction_size of them, and returns where
+	// they end, null when the line isn't one print writes
+	std::uint8_t* assemble(std::string_view line, std::uint8_t* out);
+
+	// Appends a listing as disassemble writes it to code, a line of bits 16 is skipped. Returns the number of the
+	// first line that isn't one print writes, counting from one, or zero when every line assembled.
+	std::size_t assemble(std::string_view listing, std::vector<std::uint8_t>& code);
+}
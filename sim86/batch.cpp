@@ -0,0 +1,123 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	// NOTE(rksouthee): Each worker takes jobs from the back of its own queue and, once that is empty, steals from the
+	// front of the others'. Nothing is queued once the batch has started, so a worker that finds every queue empty
+	// is done.
+	class Job_queue
+	{
+	private:
+		std::mutex m_mutex;
+		std::deque<std::size_t> m_jobs;
+
+	public:
+		void push(const std::size_t job)
+		{
+			const std::lock_guard lock(m_mutex);
+			m_jobs.push_back(job);
+		}
+
+		bool pop(std::size_t& job)
+		{
+			const std::lock_guard lock(m_mutex);
+			if (m_jobs.empty()) return false;
+			job = m_jobs.back();
+			m_jobs.pop_back();
+			return true;
+		}
+
+		bool steal(std::size_t& job)
+		{
+			const std::lock_guard lock(m_mutex);
+			if (m_jobs.empty()) return false;
+			job = m_jobs.front();
+			m_jobs.pop_front();
+			return true;
+		}
+	};
+
+	void run_job(const sim86::Batch_job& job, sim86::Context& ctx, sim86::Batch_result& result)
+	{
+		// NOTE(rksouthee): The context is reused by the worker, nothing of the previous job may survive in it,
+		// least of all its decoded instructions.
+		ctx.memory.clear();
+		for (sim86::Decoded_instruction& decoded : ctx.decoded) decoded.instruction.size = 0;
+		const std::size_t size = std::min(job.program.size(), ctx.memory.size());
+		std::copy_n(job.program.begin(), size, ctx.memory.begin());
+		std::copy(std::begin(job.registers), std::end(job.registers), ctx.registers);
+		std::fill(std::begin(ctx.segments), std::end(ctx.segments), 0);
+		ctx.ip = 0;
+		ctx.clocks = 0;
+		ctx.total_clocks = 0;
+		sim86::set_flags(ctx, 0);
+		ctx.code_map = nullptr;
+		ctx.code_modified = false;
+		ctx.dirty_pages.clear();
+		ctx.snapshot_base.reset();
+		ctx.cpu = job.cpu;
+
+		sim86::Limits limits = job.limits;
+		if (limits.end == 0) limits.end = static_cast<std::ptrdiff_t>(std::min(size, sim86::segment_size));
+		result.run = sim86::run(ctx, limits);
+		result.ip = ctx.ip;
+		std::copy(std::begin(ctx.registers), std::end(ctx.registers), result.registers);
+		result.flags = sim86::get_flags(ctx);
+		result.total_clocks = ctx.total_clocks;
+	}
+}
+
+namespace sim86
+{
+	std::vector<Batch_result> run_batch(const std::span<const Batch_job> jobs, unsigned thread_count)
+	{
+		std::vector<Batch_result> results(jobs.size());
+		if (jobs.empty()) return results;
+		if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+		thread_count = static_cast<unsigned>(std::min<std::size_t>(thread_count, jobs.size()));
+
+		// Each worker starts with a contiguous share of the jobs, thieves take from the end its owner reaches last
+		std::vector<Job_queue> queues(thread_count);
+		for (std::size_t i = 0; i < jobs.size(); ++i)
+		{
+			queues[i * thread_count / jobs.size()].push(i);
+		}
+
+		const auto worker = [&](const unsigned index)
+		{
+			// NOTE(rksouthee): The context carries the decoded instruction cache and is too large for the stack
+			const std::unique_ptr<Context> ctx = std::make_unique<Context>();
+			std::size_t job;
+			for (;;)
+			{
+				bool found = queues[index].pop(job);
+				for (unsigned i = 1; !found && i < thread_count; ++i)
+				{
+					found = queues[(index + i) % thread_count].steal(job);
+				}
+				if (!found) return;
+				run_job(jobs[job], *ctx, results[job]);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+		for (unsigned i = 1; i < thread_count; ++i)
+		{
+			threads.emplace_back(worker, i);
+		}
+		worker(0);
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+		return results;
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace sim86
+{
+	struct Batch_job
+	{
+		std::span<const std::uint8_t> program; // loaded at address 0 with every segment register zero, must outlive the batch
+		std::uint16_t registers[8]; // the initial register file
+		Limits limits; // end is taken from the size of the program, up to a segment, when zero
+		Cpu cpu;
+	};
+
+	struct Batch_result
+	{
+		Run_result run;
+		std::ptrdiff_t ip;
+		std::uint16_t registers[8];
+		std::uint16_t flags;
+		std::uint64_t total_clocks;
+	};
+
+	// Runs every job in its own context across a work-stealing pool of threads, zero threads uses one per core.
+	// The results are in the order of the jobs.
+	std::vector<Batch_result> run_batch(std::span<const Batch_job> jobs, unsigned thread_count = 0);
+}
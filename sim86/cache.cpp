@@ -0,0 +1,114 @@
+#include "cache.h"
+#include "printer.h"
+#include "writer.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+
+namespace
+{
+	constexpr std::uint32_t s_no_line = UINT32_MAX;
+
+	// The instruction as executed, or as the memory now decodes if it was invalidated since
+	sim86::Instruction get_instruction(const sim86::Context& ctx, const std::ptrdiff_t ip)
+	{
+		const sim86::Instruction& inst = ctx.decoded[ip].instruction;
+		if (inst.size != 0) return inst;
+		const std::uint32_t addr = sim86::get_physical_address(ctx.segments[sim86::Segment_cs], static_cast<std::uint16_t>(ip));
+		return sim86::decode(ctx.memory.data() + addr, ctx.memory.end());
+	}
+
+	double get_miss_rate(const sim86::Cache_counters& counters)
+	{
+		const std::uint64_t accesses = counters.hits + counters.misses;
+		return accesses ? 100.0 * static_cast<double>(counters.misses) / static_cast<double>(accesses) : 0.0;
+	}
+}
+
+namespace sim86
+{
+	Cache::Cache(const std::uint32_t size, const std::uint32_t line_size, const std::uint32_t ways) :
+		m_line_shift(static_cast<std::uint32_t>(std::countr_zero(line_size))),
+		m_set_mask(size / line_size / ways - 1),
+		m_ways(ways),
+		m_lines(size / line_size, s_no_line),
+		m_counters(segment_size)
+	{
+	}
+
+	bool Cache::is_valid(const std::uint32_t size, const std::uint32_t line_size, const std::uint32_t ways)
+	{
+		if (!std::has_single_bit(size) || !std::has_single_bit(line_size) || !std::has_single_bit(ways)) return false;
+		return static_cast<std::uint64_t>(line_size) * ways <= size;
+	}
+
+	// Moves the line to the front of its set, dropping the least recently used line on a miss
+	bool Cache::touch(const std::uint32_t line)
+	{
+		std::uint32_t* const set = m_lines.data() + static_cast<std::size_t>(line & m_set_mask) * m_ways;
+		if (set[0] == line) return true;
+		std::uint32_t* const last = set + m_ways;
+		std::uint32_t* const way = std::find(set + 1, last, line);
+		const bool hit = way != last;
+		if (hit) std::rotate(set, way, way + 1);
+		else
+		{
+			std::copy_backward(set, last - 1, last);
+			set[0] = line;
+		}
+		return hit;
+	}
+
+	void Cache::access(const std::uint32_t addr, const std::uint32_t size)
+	{
+		const std::uint32_t first = addr >> m_line_shift;
+		const std::uint32_t last = (addr + size - 1) >> m_line_shift;
+		bool hit = touch(first);
+		if (last != first) hit = touch(last) && hit;
+		++(hit ? m_pending.hits : m_pending.misses);
+	}
+
+	void Cache::step(const Context&, const std::ptrdiff_t ip, const Instruction&)
+	{
+		Cache_counters& counters = m_counters[ip];
+		counters.hits += m_pending.hits;
+		counters.misses += m_pending.misses;
+		m_total.hits += m_pending.hits;
+		m_total.misses += m_pending.misses;
+		m_pending = {};
+	}
+
+	void print_cache(std::ostream& os, const Context& ctx, const Cache& cache)
+	{
+		std::vector<std::ptrdiff_t> ips;
+		for (std::ptrdiff_t ip = 0; ip < static_cast<std::ptrdiff_t>(segment_size); ++ip)
+		{
+			const Cache_counters& counters = cache.counters(ip);
+			if (counters.hits || counters.misses) ips.push_back(ip);
+		}
+		std::stable_sort(ips.begin(), ips.end(), [&cache](const std::ptrdiff_t a, const std::ptrdiff_t b)
+		{
+			return cache.counters(a).misses > cache.counters(b).misses;
+		});
+
+		const Cache_counters& total = cache.total();
+		Writer writer(os);
+		char* out = writer.reserve(256);
+		out = std::format_to(out, "; cache: {} bytes, {} sets of {} ways of {} byte lines\n",
+			cache.sets() * cache.ways() * cache.line_size(), cache.sets(), cache.ways(), cache.line_size());
+		out = std::format_to(out, "; {} accesses, {} hits, {} misses ({:.1f}%)\n", total.hits + total.misses, total.hits,
+			total.misses, get_miss_rate(total));
+		out = std::format_to(out, "{:<4} {:>12} {:>12} {:>7}\n", "; ip", "hits", "misses", "miss %");
+		writer.commit(out);
+		for (const std::ptrdiff_t ip : ips)
+		{
+			const Cache_counters& counters = cache.counters(ip);
+			out = writer.reserve(max_print_size + 64);
+			out = std::format_to(out, "{:04x} {:>12} {:>12} {:>7.1f}  ", ip, counters.hits, counters.misses, get_miss_rate(counters));
+			out = print(get_instruction(ctx, ip), out);
+			*out++ = '\n';
+			writer.commit(out);
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace sim86
+{
+	struct Cache_counters
+	{
+		std::uint64_t hits;
+		std::uint64_t misses;
+	};
+
+	// NOTE(rksouthee): A set associative cache with least recently used replacement, fed the physical address of
+	// every read and write of an operand through Context::cache. Instruction fetches go through the prefetch queue
+	// rather than memory operands and aren't fed to it. An access is one hit or one miss, a word that straddles two
+	// lines misses if either of them does. The accesses are charged to the instruction that made them when the run
+	// reports it, so the run has to be traced.
+	class Cache
+	{
+	private:
+		std::uint32_t m_line_shift;
+		std::uint32_t m_set_mask;
+		std::uint32_t m_ways;
+		std::vector<std::uint32_t> m_lines; // of each set, the lines it holds most recently used first
+		Cache_counters m_pending{}; // of the instruction executing
+		Cache_counters m_total{};
+		std::vector<Cache_counters> m_counters; // by the offset of the instruction in the code segment
+
+		bool touch(std::uint32_t line);
+
+	public:
+		// Sizes are in bytes, see is_valid for the geometries it can have. The cache starts empty.
+		Cache(std::uint32_t size, std::uint32_t line_size, std::uint32_t ways);
+
+		// Whether the sizes are powers of two with size a multiple of line_size * ways
+		[[nodiscard]] static bool is_valid(std::uint32_t size, std::uint32_t line_size, std::uint32_t ways);
+
+		// Called by the simulator for each access to memory, through Context::cache
+		void access(std::uint32_t addr, std::uint32_t size);
+		// Call after each instruction, as a Trace_fn
+		void step(const Context& ctx, std::ptrdiff_t ip, const Instruction& inst);
+
+		[[nodiscard]] std::uint32_t line_size() const { return 1u << m_line_shift; }
+		[[nodiscard]] std::uint32_t sets() const { return m_set_mask + 1; }
+		[[nodiscard]] std::uint32_t ways() const { return m_ways; }
+		[[nodiscard]] const Cache_counters& total() const { return m_total; }
+		[[nodiscard]] const Cache_counters& counters(std::ptrdiff_t ip) const { return m_counters[ip]; }
+	};
+
+	// Prints the hits and misses of the run, then those of each instruction that accessed memory, most misses first
+	void print_cache(std::ostream& os, const Context& ctx, const Cache& cache);
+}
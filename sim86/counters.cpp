@@ -0,0 +1,52 @@
+#include "counters.h"
+#include "printer.h"
+#include "writer.h"
+
+#include <format>
+
+namespace
+{
+	// The effective address of a mod and r/m, as nasm would write it with d8 and d16 for the displacements
+	char* write_ea_mode(char* out, const std::uint8_t mod, const std::uint8_t r_m)
+	{
+		if (mod == 0 && r_m == 6) return std::format_to(out, "[d16]");
+		if (mod == 0) return std::format_to(out, "[{}]", sim86::get_ea_name(r_m));
+		return std::format_to(out, "[{}+{}]", sim86::get_ea_name(r_m), mod == 1 ? "d8" : "d16");
+	}
+}
+
+namespace sim86
+{
+	void write_counters_csv(std::ostream& os, const Counters& counters)
+	{
+		Writer writer(os);
+		writer.write("counter,key,count\n");
+		for (std::size_t opcode = 0; opcode < std::size(counters.opcodes); ++opcode)
+		{
+			if (!counters.opcodes[opcode]) continue;
+			writer.commit(std::format_to(writer.reserve(64), "opcode,{:#04x},{}\n", opcode, counters.opcodes[opcode]));
+		}
+		for (std::size_t op = 0; op < Operation_count; ++op)
+		{
+			if (!counters.operations[op]) continue;
+			const char* const name = get_operation_name(static_cast<Operation>(op));
+			writer.commit(std::format_to(writer.reserve(64), "operation,{},{}\n", name, counters.operations[op]));
+		}
+		for (std::uint8_t mod = 0; mod < 3; ++mod)
+		{
+			for (std::uint8_t r_m = 0; r_m < 8; ++r_m)
+			{
+				if (!counters.ea_modes[mod][r_m]) continue;
+				char* out = write_ea_mode(std::format_to(writer.reserve(64), "ea,"), mod, r_m);
+				writer.commit(std::format_to(out, ",{}\n", counters.ea_modes[mod][r_m]));
+			}
+		}
+		for (std::size_t op = 0; op < Operation_count; ++op)
+		{
+			if (!counters.taken[op] && !counters.not_taken[op]) continue;
+			const char* const name = get_operation_name(static_cast<Operation>(op));
+			writer.commit(std::format_to(writer.reserve(96), "taken,{},{}\nnot taken,{},{}\n", name, counters.taken[op], name, counters.not_taken[op]));
+		}
+		writer.commit(std::format_to(writer.reserve(96), "memory,read bytes,{}\nmemory,written bytes,{}\n", counters.read_bytes, counters.written_bytes));
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <cstdint>
+#include <ostream>
+
+// NOTE(rksouthee): Built with SIM86_COUNTERS set, run counts what each instruction it executes does into the
+// counters of the context when it has some. Built without it, SIM86_COUNT expands to nothing and the simulator has
+// none of the counting in it.
+#ifndef SIM86_COUNTERS
+#define SIM86_COUNTERS 0
+#endif
+
+namespace sim86
+{
+	struct Counters
+	{
+		std::uint64_t opcodes[256]; // by the first byte after any prefixes
+		std::uint64_t operations[Operation_count];
+		std::uint64_t ea_modes[3][8]; // by mod and r/m, a direct address as mod 0 and r/m 6 as it's encoded
+		std::uint64_t taken[Operation_count]; // of the conditional jumps, the loops and jcxz
+		std::uint64_t not_taken[Operation_count];
+		std::uint64_t read_bytes;
+		std::uint64_t written_bytes;
+	};
+
+	// A line of counter,key,count for each count that isn't zero
+	void write_counters_csv(std::ostream& os, const Counters& counters);
+}
+
+#if SIM86_COUNTERS
+#define SIM86_COUNT(ctx, ...)\
+	do\
+	{\
+		if ((ctx).counters)\
+		{\
+			sim86::Counters& counters = *(ctx).counters;\
+			__VA_ARGS__;\
+		}\
+	}\
+	while (0)
+#else
+#define SIM86_COUNT(ctx, ...)
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sim86
+{
+	// Memory that stops a run once an instruction writes to it, or reads it as well
+	struct Watchpoint
+	{
+		std::uint32_t first; // physical address
+		std::uint32_t last; // one past the last byte watched
+		bool reads;
+	};
+
+	// NOTE(rksouthee): Set Context::debug to one to have run stop at its breakpoints and watchpoints. A breakpoint
+	// stops the run before the instruction at it executes, unless it is the first of the run so that a run can be
+	// resumed from where the last one stopped. The instruction that touches a watchpoint is left to finish, all of
+	// the repetitions of a string instruction included.
+	struct Debug
+	{
+		std::uint8_t breakpoints[segment_size]; // non-zero at the offsets in the code segment to stop at
+		std::vector<Watchpoint> watchpoints;
+		// Where the last run stopped for a watchpoint
+		bool hit;
+		std::uint32_t hit_address; // the first watched byte the instruction touched
+		std::ptrdiff_t hit_ip; // the address the instruction was fetched from
+	};
+}
@@ -0,0 +1,491 @@
+#include "decoder.h"
+
+namespace
+{
+	// Where an operand of an encoding comes from
+	enum Field : std::uint8_t
+	{
+		Field_none,
+		Field_r_m, // the r/m of the mod reg r/m byte
+		Field_reg, // the reg field of the mod reg r/m byte, or the reg bits of the opcode
+		Field_segment, // the sr bits of the mod reg r/m byte or of the opcode
+		Field_acc, // al or ax
+		Field_dx,
+		Field_count, // shifts and rotates, 1 or cl when v is set
+		Field_data, // an immediate of the size given by w, or a sign extended byte when s is set
+		Field_data_8,
+		Field_data_16,
+		Field_addr, // a direct memory address
+		Field_ip_inc_8,
+		Field_ip_inc_16,
+		Field_far, // an offset followed by a segment
+	};
+
+	struct Encoding
+	{
+		sim86::Operation operation;
+		// NOTE(rksouthee): The bit patterns are written as in the 8086 manual, the first byte is a mix of fixed
+		// bits and the d, w, s, v, z, reg and sr fields, it may be followed by "mod xxx r/m" where xxx is reg, sr,
+		// 0sr or fixed bits, or by a fixed second byte. Any displacement, data or address follows the listed fields.
+		const char* bits;
+		// NOTE(rksouthee): The operands are listed as they are when d is clear, setting d swaps them
+		Field dest;
+		Field source;
+		bool far = false;
+	};
+
+	constexpr Encoding s_encodings[] =
+	{
+		{ sim86::Operation_mov, "100010dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_mov, "1100011w mod 000 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_mov, "1011wreg", Field_reg, Field_data },
+		{ sim86::Operation_mov, "1010000w", Field_acc, Field_addr },
+		{ sim86::Operation_mov, "1010001w", Field_addr, Field_acc },
+		{ sim86::Operation_mov, "100011d0 mod 0sr r/m", Field_r_m, Field_segment },
+
+		{ sim86::Operation_push, "11111111 mod 110 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_push, "01010reg", Field_reg, Field_none },
+		{ sim86::Operation_push, "000sr110", Field_segment, Field_none },
+		{ sim86::Operation_pop, "10001111 mod 000 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_pop, "01011reg", Field_reg, Field_none },
+		{ sim86::Operation_pop, "000sr111", Field_segment, Field_none },
+
+		{ sim86::Operation_xchg, "1000011w mod reg r/m", Field_reg, Field_r_m },
+		{ sim86::Operation_nop, "10010000", Field_none, Field_none },
+		{ sim86::Operation_xchg, "10010reg", Field_acc, Field_reg },
+
+		{ sim86::Operation_in, "1110010w", Field_acc, Field_data_8 },
+		{ sim86::Operation_in, "1110110w", Field_acc, Field_dx },
+		{ sim86::Operation_out, "1110011w", Field_data_8, Field_acc },
+		{ sim86::Operation_out, "1110111w", Field_dx, Field_acc },
+
+		{ sim86::Operation_xlat, "11010111", Field_none, Field_none },
+		{ sim86::Operation_lea, "10001101 mod reg r/m", Field_reg, Field_r_m },
+		{ sim86::Operation_lds, "11000101 mod reg r/m", Field_reg, Field_r_m },
+		{ sim86::Operation_les, "11000100 mod reg r/m", Field_reg, Field_r_m },
+		{ sim86::Operation_lahf, "10011111", Field_none, Field_none },
+		{ sim86::Operation_sahf, "10011110", Field_none, Field_none },
+		{ sim86::Operation_pushf, "10011100", Field_none, Field_none },
+		{ sim86::Operation_popf, "10011101", Field_none, Field_none },
+
+		{ sim86::Operation_add, "000000dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_add, "100000sw mod 000 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_add, "0000010w", Field_acc, Field_data },
+		{ sim86::Operation_or, "000010dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_or, "100000sw mod 001 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_or, "0000110w", Field_acc, Field_data },
+		{ sim86::Operation_adc, "000100dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_adc, "100000sw mod 010 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_adc, "0001010w", Field_acc, Field_data },
+		{ sim86::Operation_sbb, "000110dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_sbb, "100000sw mod 011 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_sbb, "0001110w", Field_acc, Field_data },
+		{ sim86::Operation_and, "001000dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_and, "100000sw mod 100 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_and, "0010010w", Field_acc, Field_data },
+		{ sim86::Operation_sub, "001010dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_sub, "100000sw mod 101 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_sub, "0010110w", Field_acc, Field_data },
+		{ sim86::Operation_xor, "001100dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_xor, "100000sw mod 110 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_xor, "0011010w", Field_acc, Field_data },
+		{ sim86::Operation_cmp, "001110dw mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_cmp, "100000sw mod 111 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_cmp, "0011110w", Field_acc, Field_data },
+
+		{ sim86::Operation_inc, "1111111w mod 000 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_inc, "01000reg", Field_reg, Field_none },
+		{ sim86::Operation_dec, "1111111w mod 001 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_dec, "01001reg", Field_reg, Field_none },
+		{ sim86::Operation_aaa, "00110111", Field_none, Field_none },
+		{ sim86::Operation_daa, "00100111", Field_none, Field_none },
+		{ sim86::Operation_aas, "00111111", Field_none, Field_none },
+		{ sim86::Operation_das, "00101111", Field_none, Field_none },
+		{ sim86::Operation_test, "1111011w mod 000 r/m", Field_r_m, Field_data },
+		{ sim86::Operation_not, "1111011w mod 010 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_neg, "1111011w mod 011 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_mul, "1111011w mod 100 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_imul, "1111011w mod 101 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_div, "1111011w mod 110 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_idiv, "1111011w mod 111 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_aam, "11010100 00001010", Field_none, Field_none },
+		{ sim86::Operation_aad, "11010101 00001010", Field_none, Field_none },
+		{ sim86::Operation_cbw, "10011000", Field_none, Field_none },
+		{ sim86::Operation_cwd, "10011001", Field_none, Field_none },
+
+		{ sim86::Operation_rol, "110100vw mod 000 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_ror, "110100vw mod 001 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_rcl, "110100vw mod 010 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_rcr, "110100vw mod 011 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_shl, "110100vw mod 100 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_shr, "110100vw mod 101 r/m", Field_r_m, Field_count },
+		{ sim86::Operation_sar, "110100vw mod 111 r/m", Field_r_m, Field_count },
+
+		{ sim86::Operation_test, "1000010w mod reg r/m", Field_r_m, Field_reg },
+		{ sim86::Operation_test, "1010100w", Field_acc, Field_data },
+
+		{ sim86::Operation_rep, "1111001z", Field_none, Field_none },
+		{ sim86::Operation_movs, "1010010w", Field_none, Field_none },
+		{ sim86::Operation_cmps, "1010011w", Field_none, Field_none },
+		{ sim86::Operation_scas, "1010111w", Field_none, Field_none },
+		{ sim86::Operation_lods, "1010110w", Field_none, Field_none },
+		{ sim86::Operation_stos, "1010101w", Field_none, Field_none },
+
+		{ sim86::Operation_call, "11101000", Field_ip_inc_16, Field_none },
+		{ sim86::Operation_call, "11111111 mod 010 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_call, "10011010", Field_far, Field_none, true },
+		{ sim86::Operation_call, "11111111 mod 011 r/m", Field_r_m, Field_none, true },
+		{ sim86::Operation_jmp, "11101001", Field_ip_inc_16, Field_none },
+		{ sim86::Operation_jmp, "11101011", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jmp, "11111111 mod 100 r/m", Field_r_m, Field_none },
+		{ sim86::Operation_jmp, "11101010", Field_far, Field_none, true },
+		{ sim86::Operation_jmp, "11111111 mod 101 r/m", Field_r_m, Field_none, true },
+		{ sim86::Operation_ret, "11000011", Field_none, Field_none },
+		{ sim86::Operation_ret, "11000010", Field_data_16, Field_none },
+		{ sim86::Operation_retf, "11001011", Field_none, Field_none },
+		{ sim86::Operation_retf, "11001010", Field_data_16, Field_none },
+
+		{ sim86::Operation_jo, "01110000", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jno, "01110001", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jc, "01110010", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jnc, "01110011", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jz, "01110100", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jnz, "01110101", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jna, "01110110", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_ja, "01110111", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_js, "01111000", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jns, "01111001", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jpe, "01111010", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jpo, "01111011", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jl, "01111100", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jnl, "01111101", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jng, "01111110", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jg, "01111111", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_loopne, "11100000", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_loope, "11100001", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_loop, "11100010", Field_ip_inc_8, Field_none },
+		{ sim86::Operation_jcxz, "11100011", Field_ip_inc_8, Field_none },
+
+		{ sim86::Operation_int, "11001101", Field_data_8, Field_none },
+		{ sim86::Operation_int3, "11001100", Field_none, Field_none },
+		{ sim86::Operation_into, "11001110", Field_none, Field_none },
+		{ sim86::Operation_iret, "11001111", Field_none, Field_none },
+
+		{ sim86::Operation_clc, "11111000", Field_none, Field_none },
+		{ sim86::Operation_cmc, "11110101", Field_none, Field_none },
+		{ sim86::Operation_stc, "11111001", Field_none, Field_none },
+		{ sim86::Operation_cld, "11111100", Field_none, Field_none },
+		{ sim86::Operation_std, "11111101", Field_none, Field_none },
+		{ sim86::Operation_cli, "11111010", Field_none, Field_none },
+		{ sim86::Operation_sti, "11111011", Field_none, Field_none },
+		{ sim86::Operation_hlt, "11110100", Field_none, Field_none },
+		{ sim86::Operation_wait, "10011011", Field_none, Field_none },
+		{ sim86::Operation_lock, "11110000", Field_none, Field_none },
+		{ sim86::Operation_segment, "001sr110", Field_none, Field_none },
+	};
+
+	constexpr std::size_t s_encoding_count = sizeof(s_encodings) / sizeof(s_encodings[0]);
+
+	// The bit pattern of an encoding, the positions of the single bit fields are -1 when the field is absent
+	struct Pattern
+	{
+		std::uint8_t mask = 0; // fixed bits of the first byte
+		std::uint8_t value = 0;
+		std::int8_t d = -1;
+		std::int8_t w = -1;
+		std::int8_t s = -1;
+		std::int8_t v = -1;
+		std::int8_t z = -1;
+		std::int8_t reg = -1; // lowest bit of a reg field within the first byte
+		std::int8_t sr = -1; // lowest bit of an sr field within the first byte
+		bool mod_rm = false;
+		std::uint8_t reg_mask = 0; // fixed bits of the reg field of the mod reg r/m byte
+		std::uint8_t reg_value = 0;
+		bool fixed_second = false;
+		std::uint8_t second = 0;
+	};
+
+	constexpr bool is_binary(const char* bits, const std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if (bits[i] != '0' && bits[i] != '1') return false;
+		}
+		return true;
+	}
+
+	constexpr Pattern parse_pattern(const char* bits)
+	{
+		Pattern pattern;
+		for (std::int8_t bit = 7; bit >= 0; --bit)
+		{
+			const char c = *bits++;
+			switch (c)
+			{
+			case '0':
+			case '1':
+				pattern.mask |= 1 << bit;
+				pattern.value |= (c - '0') << bit;
+				break;
+			case 'd': pattern.d = bit; break;
+			case 'w': pattern.w = bit; break;
+			case 'v': pattern.v = bit; break;
+			case 'z': pattern.z = bit; break;
+			case 's':
+				if (*bits == 'r')
+				{
+					++bits;
+					pattern.sr = --bit;
+				}
+				else
+				{
+					pattern.s = bit;
+				}
+				break;
+			case 'r': // reg
+				bits += 2;
+				bit -= 2;
+				pattern.reg = bit;
+				break;
+			}
+		}
+
+		if (*bits == '\0') return pattern;
+		++bits;
+		if (is_binary(bits, 8))
+		{
+			pattern.fixed_second = true;
+			for (int i = 0; i < 8; ++i) pattern.second = static_cast<std::uint8_t>((pattern.second << 1) | (bits[i] - '0'));
+			return pattern;
+		}
+
+		// mod xxx r/m
+		pattern.mod_rm = true;
+		bits += 4;
+		if (is_binary(bits, 3))
+		{
+			pattern.reg_mask = 0x7;
+			pattern.reg_value = static_cast<std::uint8_t>(((bits[0] - '0') << 2) | ((bits[1] - '0') << 1) | (bits[2] - '0'));
+		}
+		else if (bits[0] == '0')
+		{
+			// 0sr
+			pattern.reg_mask = 0x4;
+		}
+		return pattern;
+	}
+
+	struct Opcode_table
+	{
+		Pattern patterns[s_encoding_count];
+		bool mod_rm[256] = {};
+		// NOTE(rksouthee): One more than the index of the encoding, zero for an unknown instruction. Opcodes with
+		// a mod reg r/m byte are looked up by its reg field, the rest use column zero.
+		std::uint8_t encodings[256][8] = {};
+	};
+
+	constexpr Opcode_table build_opcode_table()
+	{
+		Opcode_table table;
+		for (std::size_t i = 0; i < s_encoding_count; ++i)
+		{
+			const Pattern pattern = parse_pattern(s_encodings[i].bits);
+			table.patterns[i] = pattern;
+			for (int opcode = 0; opcode < 256; ++opcode)
+			{
+				if ((opcode & pattern.mask) != pattern.value) continue;
+				for (int reg = 0; reg < 8; ++reg)
+				{
+					if ((reg & pattern.reg_mask) != pattern.reg_value) continue;
+					if (table.encodings[opcode][reg] == 0) table.encodings[opcode][reg] = static_cast<std::uint8_t>(i + 1);
+					if (pattern.mod_rm) table.mod_rm[opcode] = true;
+				}
+			}
+		}
+		return table;
+	}
+
+	constexpr Opcode_table s_opcode_table = build_opcode_table();
+
+	struct Reader
+	{
+		const std::uint8_t* first;
+		const std::uint8_t* last;
+		bool ok = true;
+
+		std::uint8_t u8()
+		{
+			if (first == last)
+			{
+				ok = false;
+				return 0;
+			}
+			return *first++;
+		}
+
+		std::uint16_t u16()
+		{
+			const std::uint8_t lo = u8();
+			const std::uint8_t hi = u8();
+			return lo | (hi << 8);
+		}
+
+		std::uint16_t s8()
+		{
+			return static_cast<std::uint16_t>(static_cast<std::int8_t>(u8()));
+		}
+	};
+
+	sim86::Operand make_register(const std::uint8_t reg, const bool w)
+	{
+		return { sim86::Operand_register, reg, 0, w, 0 };
+	}
+
+	sim86::Operand make_immediate(const std::uint16_t value)
+	{
+		return { sim86::Operand_immediate, 0, 0, false, value };
+	}
+
+	sim86::Operand read_r_m(Reader& reader, const std::uint8_t mod, const std::uint8_t r_m, const bool w)
+	{
+		switch (mod)
+		{
+		case 0b00:
+			if (r_m == 0b110) return { sim86::Operand_direct, 0, 0, false, reader.u16() };
+			return { sim86::Operand_memory, r_m, 0, false, 0 };
+		case 0b01:
+			return { sim86::Operand_memory, r_m, 1, false, reader.s8() };
+		case 0b10:
+			return { sim86::Operand_memory, r_m, 2, false, reader.u16() };
+		default:
+			return make_register(r_m, w);
+		}
+	}
+
+	struct Fields
+	{
+		bool w;
+		bool s;
+		bool v;
+		std::uint8_t reg;
+		std::uint8_t sr;
+		sim86::Operand r_m;
+	};
+
+	sim86::Operand read_operand(Reader& reader, const Field field, const Fields& fields, sim86::Instruction& inst)
+	{
+		switch (field)
+		{
+		case Field_r_m: return fields.r_m;
+		case Field_reg: return make_register(fields.reg, fields.w);
+		case Field_segment: return { sim86::Operand_segment, fields.sr, 0, true, 0 };
+		case Field_acc: return make_register(0, fields.w);
+		case Field_dx: return make_register(2, true);
+		case Field_count: return fields.v ? make_register(1, false) : make_immediate(1);
+		case Field_data:
+			if (fields.s && fields.w) return make_immediate(reader.s8());
+			return make_immediate(fields.w ? reader.u16() : reader.u8());
+		case Field_data_8: return make_immediate(reader.u8());
+		case Field_data_16: return make_immediate(reader.u16());
+		case Field_addr: return { sim86::Operand_direct, 0, 0, false, reader.u16() };
+		case Field_ip_inc_8: return { sim86::Operand_relative, 0, 0, false, reader.s8() };
+		case Field_ip_inc_16: return { sim86::Operand_relative, 0, 0, false, reader.u16() };
+		case Field_far:
+			{
+				const std::uint16_t offset = reader.u16();
+				inst.operands[1] = make_immediate(offset);
+				return make_immediate(reader.u16());
+			}
+		default: return {};
+		}
+	}
+
+	bool get_bit(const std::uint8_t byte, const std::int8_t bit)
+	{
+		return bit >= 0 && ((byte >> bit) & 1);
+	}
+
+	bool decode_instruction(Reader& reader, sim86::Instruction& inst)
+	{
+		const std::uint8_t* const start = reader.first;
+		for (;;)
+		{
+			if (reader.first - start >= sim86::max_instruction_size) return false;
+			const std::uint8_t opcode = reader.u8();
+			if (!reader.ok) return false;
+
+			const std::uint8_t reg = s_opcode_table.mod_rm[opcode] && reader.first != reader.last ? (*reader.first >> 3) & 0x7 : 0;
+			const std::uint8_t index = s_opcode_table.encodings[opcode][reg];
+			if (index == 0) return false;
+			const Encoding& encoding = s_encodings[index - 1];
+			const Pattern& pattern = s_opcode_table.patterns[index - 1];
+
+			Fields fields{};
+			fields.w = pattern.w < 0 || get_bit(opcode, pattern.w);
+			fields.s = get_bit(opcode, pattern.s);
+			fields.v = get_bit(opcode, pattern.v);
+			if (pattern.reg >= 0) fields.reg = (opcode >> pattern.reg) & 0x7;
+			if (pattern.sr >= 0) fields.sr = (opcode >> pattern.sr) & 0x3;
+
+			switch (encoding.operation)
+			{
+			case sim86::Operation_lock:
+				inst.flags |= sim86::Instruction_lock;
+				continue;
+			case sim86::Operation_rep:
+				inst.flags |= get_bit(opcode, pattern.z) ? sim86::Instruction_rep : sim86::Instruction_repne;
+				continue;
+			case sim86::Operation_segment:
+				inst.flags |= sim86::Instruction_segment;
+				inst.segment = fields.sr;
+				continue;
+			default:
+				break;
+			}
+
+			inst.operation = encoding.operation;
+			inst.opcode = opcode;
+			inst.w = fields.w;
+			if (encoding.far) inst.flags |= sim86::Instruction_far;
+
+			if (pattern.fixed_second && reader.u8() != pattern.second) return false;
+			if (pattern.mod_rm)
+			{
+				const std::uint8_t value = reader.u8();
+				fields.reg = (value >> 3) & 0x7;
+				fields.sr = fields.reg & 0x3;
+				fields.r_m = read_r_m(reader, (value >> 6) & 0x3, value & 0x7, fields.w);
+			}
+
+			inst.operands[0] = read_operand(reader, encoding.dest, fields, inst);
+			if (encoding.source != Field_none) inst.operands[1] = read_operand(reader, encoding.source, fields, inst);
+			if (get_bit(opcode, pattern.d))
+			{
+				const sim86::Operand dest = inst.operands[0];
+				inst.operands[0] = inst.operands[1];
+				inst.operands[1] = dest;
+			}
+			return reader.ok && reader.first - start <= sim86::max_instruction_size;
+		}
+	}
+}
+
+namespace sim86
+{
+	Instruction decode(const std::uint8_t* first, const std::uint8_t* last)
+	{
+		Instruction inst{};
+		if (first == last) return inst;
+
+		Reader reader{ first, last };
+		if (!decode_instruction(reader, inst))
+		{
+			inst = {};
+			inst.opcode = *first;
+			inst.size = 1;
+			return inst;
+		}
+		inst.size = static_cast<std::uint8_t>(reader.first - first);
+		return inst;
+	}
+}
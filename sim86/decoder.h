@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+
+// NOTE(rksouthee): The arithmetic operations are in the order they are encoded in the reg field of 0x80-0x83 and
+// the conditional jumps in the order of their opcodes 0x70-0x7f, the decoder and the JIT rely on both.
+#define SIM86_OPERATIONS(X)\
+	X(none)\
+	X(add)\
+	X(or)\
+	X(adc)\
+	X(sbb)\
+	X(and)\
+	X(sub)\
+	X(xor)\
+	X(cmp)\
+	X(mov)\
+	X(jo)\
+	X(jno)\
+	X(jc)\
+	X(jnc)\
+	X(jz)\
+	X(jnz)\
+	X(jna)\
+	X(ja)\
+	X(js)\
+	X(jns)\
+	X(jpe)\
+	X(jpo)\
+	X(jl)\
+	X(jnl)\
+	X(jng)\
+	X(jg)\
+	X(loopne)\
+	X(loope)\
+	X(loop)\
+	X(jcxz)\
+	X(hlt)\
+	X(push)\
+	X(pop)\
+	X(xchg)\
+	X(nop)\
+	X(in)\
+	X(out)\
+	X(xlat)\
+	X(lea)\
+	X(lds)\
+	X(les)\
+	X(lahf)\
+	X(sahf)\
+	X(pushf)\
+	X(popf)\
+	X(inc)\
+	X(dec)\
+	X(aaa)\
+	X(daa)\
+	X(aas)\
+	X(das)\
+	X(neg)\
+	X(mul)\
+	X(imul)\
+	X(div)\
+	X(idiv)\
+	X(aam)\
+	X(aad)\
+	X(cbw)\
+	X(cwd)\
+	X(not)\
+	X(rol)\
+	X(ror)\
+	X(rcl)\
+	X(rcr)\
+	X(shl)\
+	X(shr)\
+	X(sar)\
+	X(test)\
+	X(movs)\
+	X(cmps)\
+	X(scas)\
+	X(lods)\
+	X(stos)\
+	X(call)\
+	X(jmp)\
+	X(ret)\
+	X(retf)\
+	X(int)\
+	X(int3)\
+	X(into)\
+	X(iret)\
+	X(clc)\
+	X(cmc)\
+	X(stc)\
+	X(cld)\
+	X(std)\
+	X(cli)\
+	X(sti)\
+	X(wait)\
+	X(lock)\
+	X(rep)\
+	X(segment)
+
+namespace sim86
+{
+#define SIM86_OPERATION_ENUM(name) Operation_##name,
+	enum Operation : std::uint8_t
+	{
+		SIM86_OPERATIONS(SIM86_OPERATION_ENUM)
+		Operation_count,
+	};
+#undef SIM86_OPERATION_ENUM
+
+	enum Operand_type : std::uint8_t
+	{
+		Operand_none,
+		Operand_register,
+		Operand_segment, // es, cs, ss, ds
+		Operand_memory, // an effective address formula plus an optional displacement
+		Operand_direct, // memory addressed by the displacement alone
+		Operand_immediate,
+		Operand_relative, // a jump offset from the end of the instruction
+	};
+
+	struct Operand
+	{
+		Operand_type type;
+		std::uint8_t reg; // register number, or the r/m effective address formula of a memory operand
+		std::uint8_t mod; // memory operands: 0 without a displacement, 1 or 2 with an 8 or 16-bit displacement
+		bool w; // registers: a word rather than a byte register, in and out address the port with dx whatever w is
+		std::uint16_t value; // displacement, immediate or jump offset, sign extended where the encoding says so
+	};
+
+	enum Instruction_flags : std::uint8_t
+	{
+		Instruction_lock = 1,
+		Instruction_rep = 2, // rep, repe and repz
+		Instruction_repne = 4,
+		Instruction_segment = 8, // memory operands use the segment register in Instruction::segment
+		Instruction_far = 16, // intersegment call or jump, a direct one has segment and offset immediates
+	};
+
+	struct Instruction
+	{
+		Operation operation;
+		std::uint8_t opcode; // the first byte after any prefixes
+		std::uint8_t size; // length in bytes, including any prefixes
+		bool w; // operates on words rather than bytes
+		std::uint8_t flags;
+		std::uint8_t segment;
+		Operand operands[2]; // destination, source
+	};
+
+	// NOTE(rksouthee): Prefixes are decoded as instructions of their own and folded into the next one, the 8086 puts
+	// no limit on their number but an instruction longer than this, prefixes and operands together, is treated as
+	// garbage. The simulator relies on it to find the cached instructions a write overlaps.
+	constexpr std::uint8_t max_instruction_size = 15;
+
+	// Unknown and truncated instructions decode as a single byte with Operation_none
+	Instruction decode(const std::uint8_t* first, const std::uint8_t* last);
+}
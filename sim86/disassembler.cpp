@@ -0,0 +1,127 @@
+#include "disassembler.h"
+#include "decoder.h"
+#include "printer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Below this a chunk isn't worth a thread of its own, above it the text of the chunks decoded ahead of the
+	// writer takes more memory than it saves time
+	constexpr std::size_t s_min_chunk_size = 1 << 16;
+	constexpr std::size_t s_max_chunk_size = 1 << 20;
+
+	// NOTE(rksouthee): A chunk is decoded from a guess at where an instruction starts, which is wrong as often as
+	// not. Decoding depends on nothing but the bytes from where it starts, so once the true boundaries meet one of
+	// those the chunk found every instruction it decoded from there on is right.
+	struct Chunk
+	{
+		std::size_t first;
+		std::size_t last; // decoding stops at the first instruction reaching it
+		std::size_t exit; // where the last instruction decoded ends
+		std::vector<std::size_t> starts; // of each instruction decoded, in order
+		std::vector<std::size_t> lines; // where the text of each instruction starts
+		std::string text; // kept for the next chunk decoded in its place
+		std::size_t used; // of text
+	};
+
+	char* print_line(const sim86::Instruction& inst, char* out)
+	{
+		out = sim86::print(inst, out);
+		*out++ = '\n';
+		return out;
+	}
+
+	// Writes the instruction at offset and returns where the next one starts
+	std::size_t write_instruction(const std::span<const std::uint8_t> code, const std::size_t offset, sim86::Writer& writer)
+	{
+		const sim86::Instruction inst = sim86::decode(code.data() + offset, code.data() + code.size());
+		writer.commit(print_line(inst, writer.reserve(sim86::max_print_size + 1)));
+		return offset + inst.size;
+	}
+
+	void decode_chunk(const std::span<const std::uint8_t> code, Chunk& chunk)
+	{
+		const std::uint8_t* const last = code.data() + code.size();
+		chunk.starts.clear();
+		chunk.lines.clear();
+		std::size_t used = 0;
+		std::size_t offset = chunk.first;
+		while (offset < chunk.last)
+		{
+			if (chunk.text.size() - used < sim86::max_print_size + 1) chunk.text.resize(std::max<std::size_t>(chunk.text.size() * 2, 1 << 12));
+			const sim86::Instruction inst = sim86::decode(code.data() + offset, last);
+			chunk.starts.push_back(offset);
+			chunk.lines.push_back(used);
+			used = print_line(inst, chunk.text.data() + used) - chunk.text.data();
+			offset += inst.size;
+		}
+		chunk.used = used;
+		chunk.exit = offset;
+	}
+}
+
+namespace sim86
+{
+	// NOTE(rksouthee): The chunks are decoded a round at a time, one per thread, and written before the next round
+	// so that only their text is held rather than that of the whole listing.
+	void disassemble(const std::span<const std::uint8_t> code, Writer& writer, unsigned thread_count)
+	{
+		if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+		const std::size_t chunk_size = std::clamp(code.size() / thread_count, s_min_chunk_size, s_max_chunk_size);
+		if (thread_count < 2 || code.size() < 2 * chunk_size)
+		{
+			for (std::size_t offset = 0; offset < code.size();)
+			{
+				offset = write_instruction(code, offset, writer);
+			}
+			return;
+		}
+
+		std::vector<Chunk> chunks(thread_count);
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+		std::size_t offset = 0;
+		for (std::size_t first = 0; first < code.size();)
+		{
+			std::size_t count = 0;
+			for (; count < chunks.size() && first < code.size(); ++count)
+			{
+				chunks[count].first = first;
+				chunks[count].last = first = std::min(first + chunk_size, code.size());
+			}
+			for (std::size_t i = 1; i < count; ++i)
+			{
+				threads.emplace_back(decode_chunk, code, std::ref(chunks[i]));
+			}
+			decode_chunk(code, chunks[0]);
+			for (std::thread& thread : threads)
+			{
+				thread.join();
+			}
+			threads.clear();
+
+			// Each chunk takes over from the true boundary the one before it ended on, decoding again until they meet
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				const Chunk& chunk = chunks[i];
+				auto start = std::lower_bound(chunk.starts.begin(), chunk.starts.end(), offset);
+				while (offset < chunk.last && (start == chunk.starts.end() || *start != offset))
+				{
+					offset = write_instruction(code, offset, writer);
+					start = std::lower_bound(start, chunk.starts.end(), offset);
+				}
+				if (offset >= chunk.last) continue;
+				const std::size_t line = chunk.lines[start - chunk.starts.begin()];
+				writer.write(std::string_view(chunk.text.data() + line, chunk.used - line));
+				offset = chunk.exit;
+			}
+		}
+	}
+}
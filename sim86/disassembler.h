@@ -0,0 +1,13 @@
+#pragma once
+
+#include "writer.h"
+
+#include <cstdint>
+#include <span>
+
+namespace sim86
+{
+	// Writes a line for each instruction of code, exactly as decoding it from the start would. A large listing is
+	// split into chunks decoded on thread_count threads, zero uses one per core.
+	void disassemble(std::span<const std::uint8_t> code, Writer& writer, unsigned thread_count = 0);
+}
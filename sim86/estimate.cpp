@@ -0,0 +1,363 @@
+#include "estimate.h"
+#include "printer.h"
+#include "writer.h"
+
+#include <algorithm>
+#include <format>
+#include <utility>
+
+namespace
+{
+	constexpr std::size_t s_no_block = static_cast<std::size_t>(-1);
+
+	// A rep prefix repeats as many times as cx says
+	constexpr std::uint64_t s_max_repeats = 0xffff;
+
+	enum Mark : std::uint8_t
+	{
+		Mark_instruction = 1, // an instruction reached from the entry starts here
+		Mark_leader = 2, // a block starts here, if it is an instruction
+	};
+
+	// The conditional jumps, the loops and jcxz
+	bool is_jump(const sim86::Operation op)
+	{
+		return op >= sim86::Operation_jo && op <= sim86::Operation_jcxz;
+	}
+
+	bool is_string(const sim86::Operation op)
+	{
+		return op >= sim86::Operation_movs && op <= sim86::Operation_stos;
+	}
+
+	const sim86::Operand* get_memory_operand(const sim86::Instruction& inst)
+	{
+		for (const sim86::Operand& operand : inst.operands)
+		{
+			if (operand.type == sim86::Operand_memory || operand.type == sim86::Operand_direct) return &operand;
+		}
+		return nullptr;
+	}
+
+	sim86::Clock_range operator+(const sim86::Clock_range& a, const sim86::Clock_range& b)
+	{
+		return { a.best + b.best, a.worst + b.worst };
+	}
+
+	// The penalty for each transfer of a word, the parity of an address is only known when it is direct since
+	// segments start at even addresses
+	sim86::Clock_range get_transfer_penalty(const sim86::Cpu cpu, const sim86::Operand* operand)
+	{
+		if (operand && operand->type == sim86::Operand_direct)
+		{
+			const std::uint32_t penalty = sim86::get_word_transfer_penalty(cpu, operand->value);
+			return { penalty, penalty };
+		}
+		return { sim86::get_word_transfer_penalty(cpu, 0), sim86::get_word_transfer_penalty(cpu, 1) };
+	}
+
+	// The target of a jump, which may be outside the program
+	std::ptrdiff_t get_target(const std::ptrdiff_t ip, const sim86::Instruction& inst)
+	{
+		return ip + inst.size + static_cast<std::int16_t>(inst.operands[0].value);
+	}
+
+	// Finds every instruction reachable from the entry and marks where the blocks start. A run of instructions
+	// stops at a jump, at hlt, at one that doesn't decode or runs past the end, or where it meets one reached before.
+	std::vector<std::uint8_t> mark_instructions(const std::span<const std::uint8_t> code, const std::ptrdiff_t end)
+	{
+		std::vector<std::uint8_t> marks(end);
+		std::vector<std::ptrdiff_t> pending;
+		const auto reach = [&](const std::ptrdiff_t ip)
+		{
+			if (ip < 0 || ip >= end || (marks[ip] & Mark_leader)) return;
+			marks[ip] |= Mark_leader;
+			pending.push_back(ip);
+		};
+
+		reach(0);
+		while (!pending.empty())
+		{
+			std::ptrdiff_t ip = pending.back();
+			pending.pop_back();
+			while (!(marks[ip] & Mark_instruction))
+			{
+				const sim86::Instruction inst = sim86::decode(code.data() + ip, code.data() + end);
+				if (inst.operation == sim86::Operation_none) break;
+				marks[ip] |= Mark_instruction;
+				const std::ptrdiff_t next = ip + inst.size;
+				if (is_jump(inst.operation))
+				{
+					reach(next);
+					reach(get_target(ip, inst));
+					break;
+				}
+				if (inst.operation == sim86::Operation_hlt || next >= end) break;
+				if (marks[next] & Mark_instruction)
+				{
+					marks[next] |= Mark_leader;
+					break;
+				}
+				ip = next;
+			}
+		}
+		return marks;
+	}
+
+	// Each block with the clocks of each way out of it
+	std::vector<sim86::Estimate_block> build_blocks(const std::span<const std::uint8_t> code, const std::ptrdiff_t end, const sim86::Cpu cpu)
+	{
+		const std::vector<std::uint8_t> marks = mark_instructions(code, end);
+		std::vector<sim86::Estimate_block> blocks;
+		std::vector<std::size_t> block_at(end, s_no_block);
+		for (std::ptrdiff_t ip = 0; ip < end; ++ip)
+		{
+			if (marks[ip] != (Mark_instruction | Mark_leader)) continue;
+			block_at[ip] = blocks.size();
+			blocks.push_back({ ip, ip, {}, {} });
+		}
+
+		for (sim86::Estimate_block& block : blocks)
+		{
+			sim86::Clock_range body{};
+			const auto add_edge = [&](const std::ptrdiff_t target, const std::uint32_t clocks)
+			{
+				if (target < 0 || target >= end || block_at[target] == s_no_block) return;
+				block.successors.push_back({ block_at[target], body + sim86::Clock_range{ clocks, clocks } });
+			};
+
+			std::ptrdiff_t ip = block.first;
+			for (;;)
+			{
+				const sim86::Instruction inst = sim86::decode(code.data() + ip, code.data() + end);
+				const std::ptrdiff_t next = ip + inst.size;
+				block.last = next;
+				if (is_jump(inst.operation))
+				{
+					const sim86::Timing timing = sim86::get_timing(inst);
+					add_edge(next, timing.not_taken_clocks);
+					add_edge(get_target(ip, inst), timing.clocks);
+					body = body + sim86::get_clock_range(inst, cpu);
+					break;
+				}
+				body = body + sim86::get_clock_range(inst, cpu);
+				if (inst.operation == sim86::Operation_hlt || next >= end || !(marks[next] & Mark_instruction)) break;
+				if (marks[next] & Mark_leader)
+				{
+					add_edge(next, 0);
+					break;
+				}
+				ip = next;
+			}
+			block.clocks = body;
+		}
+		return blocks;
+	}
+
+	// NOTE(rksouthee): An edge is a back edge when a depth first search from the entry finds it going to a block
+	// still on its path, which is when it goes to a block finished no earlier than the one it leaves. The loops are
+	// those of the back edges, with a body of every block reaching one of them without passing through the header.
+	std::vector<sim86::Estimate_loop> find_loops(const std::vector<sim86::Estimate_block>& blocks)
+	{
+		std::vector<sim86::Estimate_loop> loops;
+		if (blocks.empty()) return loops;
+
+		std::vector<std::size_t> finished(blocks.size(), s_no_block);
+		std::vector<std::size_t> order; // of finishing
+		std::vector<bool> seen(blocks.size());
+		std::vector<std::pair<std::size_t, std::size_t>> path{ { 0, 0 } }; // blocks and the edge to search next
+		seen[0] = true;
+		while (!path.empty())
+		{
+			const std::size_t block = path.back().first;
+			const std::size_t edge = path.back().second++;
+			if (edge < blocks[block].successors.size())
+			{
+				const std::size_t successor = blocks[block].successors[edge].block;
+				if (!seen[successor])
+				{
+					seen[successor] = true;
+					path.push_back({ successor, 0 });
+				}
+				continue;
+			}
+			finished[block] = order.size();
+			order.push_back(block);
+			path.pop_back();
+		}
+		const auto is_back_edge = [&](const std::size_t from, const std::size_t to) { return finished[to] >= finished[from]; };
+
+		std::vector<std::vector<std::size_t>> predecessors(blocks.size());
+		std::vector<bool> is_header(blocks.size());
+		for (std::size_t block : order)
+		{
+			for (const sim86::Estimate_edge& edge : blocks[block].successors)
+			{
+				predecessors[edge.block].push_back(block);
+				if (is_back_edge(block, edge.block)) is_header[edge.block] = true;
+			}
+		}
+
+		std::vector<bool> in_body(blocks.size());
+		std::vector<bool> reached(blocks.size());
+		std::vector<sim86::Clock_range> clocks(blocks.size());
+		for (std::size_t header = 0; header < blocks.size(); ++header)
+		{
+			if (!is_header[header] || finished[header] == s_no_block) continue;
+			sim86::Estimate_loop loop{ header, {}, {} };
+			std::fill(in_body.begin(), in_body.end(), false);
+			in_body[header] = true;
+			std::vector<std::size_t> pending;
+			for (const std::size_t block : predecessors[header])
+			{
+				if (is_back_edge(block, header)) pending.push_back(block);
+			}
+			while (!pending.empty())
+			{
+				const std::size_t block = pending.back();
+				pending.pop_back();
+				if (in_body[block]) continue;
+				in_body[block] = true;
+				pending.insert(pending.end(), predecessors[block].begin(), predecessors[block].end());
+			}
+			loop.blocks.push_back(header);
+			for (std::size_t block = 0; block < blocks.size(); ++block)
+			{
+				if (in_body[block] && block != header) loop.blocks.push_back(block);
+			}
+
+			// Without the back edges the body is acyclic and the reverse of the finishing order is a topological one
+			std::fill(reached.begin(), reached.end(), false);
+			reached[header] = true;
+			clocks[header] = {};
+			bool closed = false;
+			for (auto it = order.rbegin(); it != order.rend(); ++it)
+			{
+				const std::size_t block = *it;
+				if (!in_body[block] || !reached[block]) continue;
+				for (const sim86::Estimate_edge& edge : blocks[block].successors)
+				{
+					if (!in_body[edge.block]) continue;
+					const sim86::Clock_range through = clocks[block] + edge.clocks;
+					if (!is_back_edge(block, edge.block))
+					{
+						sim86::Clock_range& to = clocks[edge.block];
+						to = reached[edge.block] ? sim86::Clock_range{ std::min(to.best, through.best), std::max(to.worst, through.worst) } : through;
+						reached[edge.block] = true;
+					}
+					else if (edge.block == header)
+					{
+						loop.iteration = closed ? sim86::Clock_range{ std::min(loop.iteration.best, through.best), std::max(loop.iteration.worst, through.worst) } : through;
+						closed = true;
+					}
+				}
+			}
+			if (closed) loops.push_back(std::move(loop));
+		}
+		return loops;
+	}
+
+	const char* get_cpu_name(const sim86::Cpu cpu)
+	{
+		return cpu == sim86::Cpu_8088 ? "8088" : "8086";
+	}
+}
+
+namespace sim86
+{
+	// NOTE(rksouthee): The clocks are charged as the executors charge them. Nothing is known of the registers, so a
+	// word transferred through them may be at an odd address and a repeated string instruction may repeat anything
+	// from none to 0xffff times.
+	Clock_range get_clock_range(const Instruction& inst, const Cpu cpu)
+	{
+		const Timing timing = get_timing(inst);
+		if (is_jump(inst.operation))
+		{
+			return { std::min(timing.clocks, timing.not_taken_clocks), std::max(timing.clocks, timing.not_taken_clocks) };
+		}
+		if (is_string(inst.operation))
+		{
+			const Clock_range penalty = inst.w ? get_transfer_penalty(cpu, nullptr) : Clock_range{};
+			const Clock_range element{ timing.transfers * penalty.best, timing.transfers * penalty.worst };
+			if (timing.repeat_clocks == 0) return Clock_range{ timing.clocks, timing.clocks } + element;
+			return { timing.clocks, timing.clocks + s_max_repeats * (timing.repeat_clocks + element.worst) };
+		}
+
+		Clock_range clocks{ timing.clocks, timing.clocks };
+		const Operand* const memory = get_memory_operand(inst);
+		if (!memory || timing.clocks == 0) return clocks;
+		// The accumulator forms of mov address memory directly without calculating it
+		if (inst.opcode < 0xa0 || inst.opcode > 0xa3)
+		{
+			const std::uint32_t ea = memory->type == Operand_direct ? get_clocks_for_ea_components(0b00, 0b110)
+				: get_clocks_for_ea_components(memory->mod, memory->reg);
+			clocks = clocks + Clock_range{ ea, ea };
+		}
+		// Moves of the segment registers are all words
+		const bool word = inst.w || inst.operands[0].type == Operand_segment || inst.operands[1].type == Operand_segment;
+		if (word)
+		{
+			const Clock_range penalty = get_transfer_penalty(cpu, memory);
+			clocks = clocks + Clock_range{ timing.transfers * penalty.best, timing.transfers * penalty.worst };
+		}
+		return clocks;
+	}
+
+	Estimate estimate_clocks(const std::span<const std::uint8_t> code, const Cpu cpu)
+	{
+		const std::ptrdiff_t end = static_cast<std::ptrdiff_t>(std::min(code.size(), segment_size));
+		Estimate estimate;
+		estimate.blocks = build_blocks(code, end, cpu);
+		estimate.loops = find_loops(estimate.blocks);
+		return estimate;
+	}
+
+	void print_estimate(std::ostream& os, const std::span<const std::uint8_t> code, const Estimate& estimate, const Cpu cpu)
+	{
+		const std::uint8_t* const last = code.data() + std::min(code.size(), segment_size);
+		Writer writer(os);
+		char* out = writer.reserve(128);
+		out = std::format_to(out, "; {} blocks and {} loops, timed for the {}\n", estimate.blocks.size(), estimate.loops.size(), get_cpu_name(cpu));
+		out = std::format_to(out, "{:<4} {:>12} {:>12}\n", "; ip", "best", "worst");
+		writer.commit(out);
+		for (const Estimate_block& block : estimate.blocks)
+		{
+			out = writer.reserve(128);
+			out = std::format_to(out, "\n; {:04x}-{:04x}: {} to {} clocks", block.first, block.last, block.clocks.best, block.clocks.worst);
+			writer.commit(out);
+			for (const Estimate_edge& edge : block.successors)
+			{
+				out = writer.reserve(32);
+				out = std::format_to(out, "{} {:04x}", &edge == &block.successors.front() ? ", then" : " or", estimate.blocks[edge.block].first);
+				writer.commit(out);
+			}
+			writer.write("\n");
+			for (std::ptrdiff_t ip = block.first; ip < block.last;)
+			{
+				const Instruction inst = decode(code.data() + ip, last);
+				const Clock_range clocks = get_clock_range(inst, cpu);
+				out = writer.reserve(max_print_size + 64);
+				out = std::format_to(out, "{:04x} {:>12} {:>12}  ", ip, clocks.best, clocks.worst);
+				out = print(inst, out);
+				*out++ = '\n';
+				writer.commit(out);
+				ip += inst.size;
+			}
+		}
+
+		for (const Estimate_loop& loop : estimate.loops)
+		{
+			out = writer.reserve(128);
+			out = std::format_to(out, "\n; loop at {:04x}: {} to {} clocks once around, through", estimate.blocks[loop.header].first,
+				loop.iteration.best, loop.iteration.worst);
+			writer.commit(out);
+			for (const std::size_t block : loop.blocks)
+			{
+				out = writer.reserve(32);
+				out = std::format_to(out, " {:04x}", estimate.blocks[block].first);
+				writer.commit(out);
+			}
+			writer.write("\n");
+		}
+	}
+}
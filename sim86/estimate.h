@@ -0,0 +1,57 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <vector>
+
+namespace sim86
+{
+	struct Clock_range
+	{
+		std::uint64_t best;
+		std::uint64_t worst;
+	};
+
+	struct Estimate_edge
+	{
+		std::size_t block; // index of the block it goes to
+		Clock_range clocks; // of the block it leaves, when it leaves this way
+	};
+
+	struct Estimate_block
+	{
+		std::ptrdiff_t first;
+		std::ptrdiff_t last; // one past the last instruction
+		Clock_range clocks; // of executing it once, however it leaves
+		std::vector<Estimate_edge> successors; // those leaving the program or stopping it have none
+	};
+
+	struct Estimate_loop
+	{
+		std::size_t header; // the block its back edges go to
+		std::vector<std::size_t> blocks; // of the body, the header first and the rest in address order
+		Clock_range iteration; // of going once around from the header, through any loops inside it once
+	};
+
+	// NOTE(rksouthee): The control flow and the clocks are those of the simulator executing the program from its
+	// first byte, with the code segment it starts in. Instructions it skips cost nothing and fall through, a run of
+	// it takes no fewer clocks than the best path through the blocks and, loops aside, no more than the worst.
+	struct Estimate
+	{
+		std::vector<Estimate_block> blocks; // in address order, the entry first
+		std::vector<Estimate_loop> loops; // in the address order of their headers
+	};
+
+	// The clocks an instruction can take as the simulator times them for cpu, a jump taken or not
+	Clock_range get_clock_range(const Instruction& inst, Cpu cpu);
+
+	// Recovers the blocks reachable from the start of code and the loops among them, without executing anything
+	Estimate estimate_clocks(std::span<const std::uint8_t> code, Cpu cpu);
+
+	// Prints the disassembly of each block with the clocks of every instruction, then the clocks of each loop
+	void print_estimate(std::ostream& os, std::span<const std::uint8_t> code, const Estimate& estimate, Cpu cpu);
+}
@@ -0,0 +1,483 @@
+#include "jit.h"
+#include "printer.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !SIM86_LIBFUZZER
+#include <cxxopts.hpp>
+#include <filesystem>
+#endif
+
+// NOTE(rksouthee): The target disassembles its input and then executes it three ways, traced, untraced and through
+// the JIT, failing when they disagree with each other or with the disassembly. The first eight bytes of an input
+// are the segment registers es, cs, ss and ds, the rest is the program loaded at cs:0. Built with SIM86_LIBFUZZER it
+// is handed to libFuzzer, otherwise the driver below mutates a corpus shared by a thread on each core and keeps the
+// inputs that execute an opcode after one it hadn't followed before.
+namespace
+{
+	constexpr std::size_t s_header_size = 8;
+	constexpr std::size_t s_max_input_size = 4096;
+	constexpr std::uint64_t s_max_instructions = 10000;
+	// An opcode after each opcode, then an operation with the types of its operands, then the reasons for stopping
+	constexpr std::uint32_t s_operation_features = 0x10000;
+	constexpr std::uint32_t s_stop_features = s_operation_features + sim86::Operation_count * 64;
+	constexpr std::uint32_t s_feature_count = s_stop_features + 16;
+
+	[[noreturn]] void fail(const std::string& what, const std::span<const std::uint8_t> input)
+	{
+		std::cerr.clear();
+		std::cerr << "fuzz_sim86: " << what << std::endl;
+#if !SIM86_LIBFUZZER
+		// libFuzzer saves the input itself
+		std::uint32_t hash = 2166136261;
+		for (const std::uint8_t b : input) hash = (hash ^ b) * 16777619;
+		const std::string path = std::format("crash-{:08x}", hash);
+		{
+			std::ofstream file(path, std::ios::out | std::ios::binary);
+			file.write(reinterpret_cast<const char*>(input.data()), static_cast<std::streamsize>(input.size()));
+		}
+		std::cerr << "fuzz_sim86: the input is in " << path << std::endl;
+#else
+		(void)input;
+#endif
+		std::abort();
+	}
+
+	// The disassembly takes each instruction to be as long as print says it is
+	void check_print(const std::span<const std::uint8_t> program, const std::span<const std::uint8_t> input)
+	{
+		const std::uint8_t* first = program.data();
+		const std::uint8_t* const last = program.data() + program.size();
+		char buffer[sim86::max_print_size];
+		while (first != last)
+		{
+			const sim86::Instruction inst = sim86::decode(first, last);
+			if (inst.size == 0 || inst.size > last - first) fail(std::format("decoding at {:#x} went past the end of the program", first - program.data()), input);
+			if (sim86::print(inst, buffer) - buffer > static_cast<std::ptrdiff_t>(sim86::max_print_size)) fail("print wrote more than max_print_size", input);
+			const sim86::PrintResult result = sim86::print(first, last);
+			if (result.end != first + inst.size) fail(std::format("print and decode disagree on the length at {:#x}", first - program.data()), input);
+			first = result.end;
+		}
+	}
+
+	// NOTE(rksouthee): The contexts are too large to make for each input, a run leaves nothing behind but the pages
+	// it dirtied and the instructions it decoded before end.
+	void load(sim86::Context& ctx, const std::uint16_t (&segments)[4], const std::span<const std::uint8_t> program)
+	{
+		std::copy(std::begin(segments), std::end(segments), ctx.segments);
+		std::fill(std::begin(ctx.registers), std::end(ctx.registers), 0);
+		ctx.ip = 0;
+		ctx.clocks = 0;
+		ctx.total_clocks = 0;
+		sim86::set_flags(ctx, 0);
+		const std::uint32_t base = sim86::get_physical_address(segments[sim86::Segment_cs], 0);
+		for (std::size_t i = 0; i < program.size(); ++i)
+		{
+			const std::uint32_t addr = (base + i) & (sim86::memory_size - 1);
+			ctx.memory[addr] = program[i];
+			ctx.dirty_pages.insert(addr / sim86::snapshot_page_size);
+		}
+	}
+
+	void reset(sim86::Context& ctx, const std::ptrdiff_t end)
+	{
+		ctx.dirty_pages.for_each([&ctx](const std::size_t page)
+		{
+			std::memset(ctx.memory.data() + page * sim86::snapshot_page_size, 0, sim86::snapshot_page_size);
+		});
+		ctx.dirty_pages.clear();
+		for (std::ptrdiff_t ip = 0; ip < end; ++ip) ctx.decoded[ip].instruction.size = 0;
+	}
+
+	void compare(const sim86::Context& expected, const sim86::Run_result& expected_run, const sim86::Context& actual,
+		const sim86::Run_result& actual_run, const char* what, const std::span<const std::uint8_t> input)
+	{
+		if (actual_run.reason != expected_run.reason || actual_run.instructions != expected_run.instructions)
+		{
+			fail(std::format("{} stopped after {} instructions rather than {}", what, actual_run.instructions, expected_run.instructions), input);
+		}
+		if (actual.ip != expected.ip) fail(std::format("{} stopped at {:#x} rather than {:#x}", what, actual.ip, expected.ip), input);
+		if (!std::equal(std::begin(actual.registers), std::end(actual.registers), expected.registers)) fail(std::format("{} left different registers", what), input);
+		if (!std::equal(std::begin(actual.segments), std::end(actual.segments), expected.segments)) fail(std::format("{} left different segments", what), input);
+		if (sim86::get_flags(actual) != sim86::get_flags(expected)) fail(std::format("{} left different flags", what), input);
+		if (actual.total_clocks != expected.total_clocks) fail(std::format("{} took {} clocks rather than {}", what, actual.total_clocks, expected.total_clocks), input);
+		sim86::Page_set written = expected.dirty_pages;
+		for (std::size_t word = 0; word < std::size(written.words); ++word) written.words[word] |= actual.dirty_pages.words[word];
+		written.for_each([&](const std::size_t page)
+		{
+			const std::size_t offset = page * sim86::snapshot_page_size;
+			if (std::memcmp(actual.memory.data() + offset, expected.memory.data() + offset, sim86::snapshot_page_size) != 0)
+			{
+				fail(std::format("{} left different memory at {:#x}", what, offset), input);
+			}
+		});
+	}
+
+	struct Target
+	{
+		std::unique_ptr<sim86::Context> traced = std::make_unique<sim86::Context>();
+		std::unique_ptr<sim86::Context> untraced = std::make_unique<sim86::Context>();
+		std::unique_ptr<sim86::Context> compiled = std::make_unique<sim86::Context>();
+		std::unique_ptr<sim86::Jit> jit = std::make_unique<sim86::Jit>();
+		std::vector<std::uint32_t> features;
+	};
+
+	void run_target(Target& target, const std::span<const std::uint8_t> input)
+	{
+		target.features.clear();
+		std::uint16_t segments[4]{};
+		std::span<const std::uint8_t> program = input;
+		if (input.size() >= s_header_size)
+		{
+			for (std::size_t i = 0; i < 4; ++i) segments[i] = static_cast<std::uint16_t>(input[i * 2] | (input[i * 2 + 1] << 8));
+			program = input.subspan(s_header_size);
+		}
+		program = program.first(std::min(program.size(), sim86::segment_size));
+		check_print(program, input);
+		if (program.empty()) return;
+
+		// NOTE(rksouthee): An instruction executed from bytes that still hold the program must be the one decoding
+		// the program there gives, however the cache of decoded instructions came by it
+		const std::uint16_t code_segment = segments[sim86::Segment_cs];
+		std::uint16_t previous = 0;
+		const sim86::Trace_fn trace = [&](const sim86::Context& ctx, const std::ptrdiff_t ip, const sim86::Instruction& inst)
+		{
+			target.features.push_back(static_cast<std::uint32_t>((previous << 8) | inst.opcode));
+			target.features.push_back(s_operation_features + inst.operation * 64 + inst.operands[0].type * 8 + inst.operands[1].type);
+			previous = inst.opcode;
+			// A write near the instruction drops it from the cache, leaving it without a size
+			if (inst.size == 0 || ctx.segments[sim86::Segment_cs] != code_segment) return;
+
+			const sim86::Instruction expected = sim86::decode(program.data() + ip, program.data() + program.size());
+			const std::size_t size = std::max(expected.size, inst.size);
+			for (std::size_t i = 0; i < size; ++i)
+			{
+				const std::uint32_t addr = sim86::get_physical_address(code_segment, static_cast<std::uint16_t>(ip + i));
+				if (ip + i >= program.size() || ctx.memory[addr] != program[ip + i]) return;
+			}
+			if (inst.size != expected.size) fail(std::format("executed {} bytes at {:#x} that decode to {}", inst.size, ip, expected.size), input);
+			if (sim86::print(inst) != sim86::print(expected)) fail(std::format("executed {} at {:#x} that decodes to {}", sim86::print(inst), ip, sim86::print(expected)), input);
+		};
+
+		const sim86::Limits limits{ static_cast<std::ptrdiff_t>(program.size()), s_max_instructions, 0 };
+		load(*target.traced, segments, program);
+		const sim86::Run_result traced = sim86::run(*target.traced, limits, trace);
+		target.features.push_back(s_stop_features + static_cast<std::uint32_t>(traced.reason));
+
+		load(*target.untraced, segments, program);
+		const sim86::Run_result untraced = sim86::run(*target.untraced, limits);
+		compare(*target.traced, traced, *target.untraced, untraced, "the untraced run", input);
+
+		load(*target.compiled, segments, program);
+		const sim86::Run_result compiled = target.jit->run(*target.compiled, limits);
+		compare(*target.traced, traced, *target.compiled, compiled, "the compiled run", input);
+
+		reset(*target.traced, limits.end);
+		reset(*target.untraced, limits.end);
+		reset(*target.compiled, limits.end);
+	}
+}
+
+#if SIM86_LIBFUZZER
+
+extern "C" int LLVMFuzzerInitialize(int*, char***)
+{
+	// NOTE(rksouthee): The simulator notes each instruction it skips on stderr, far too often to be of use here
+	std::cerr.setstate(std::ios::badbit);
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, const std::size_t size)
+{
+	thread_local Target target;
+	run_target(target, { data, size });
+	return 0;
+}
+
+#else
+
+namespace
+{
+	class Corpus
+	{
+	private:
+		std::mutex m_mutex;
+		std::vector<std::vector<std::uint8_t>> m_inputs;
+		std::filesystem::path m_directory; // where new inputs are written, if anywhere
+
+	public:
+		explicit Corpus(std::filesystem::path directory) :
+			m_directory(std::move(directory))
+		{
+		}
+
+		void add(const std::span<const std::uint8_t> input, const bool save)
+		{
+			const std::lock_guard lock(m_mutex);
+			m_inputs.emplace_back(input.begin(), input.end());
+			if (!save || m_directory.empty()) return;
+			std::uint32_t hash = 2166136261;
+			for (const std::uint8_t b : input) hash = (hash ^ b) * 16777619;
+			std::ofstream file(m_directory / std::format("{:08x}", hash), std::ios::out | std::ios::binary);
+			file.write(reinterpret_cast<const char*>(input.data()), static_cast<std::streamsize>(input.size()));
+		}
+
+		// Copies a random input to out, false when there are none yet
+		bool pick(std::mt19937& random, std::vector<std::uint8_t>& out)
+		{
+			const std::lock_guard lock(m_mutex);
+			if (m_inputs.empty()) return false;
+			out = m_inputs[random() % m_inputs.size()];
+			return true;
+		}
+
+		std::size_t size()
+		{
+			const std::lock_guard lock(m_mutex);
+			return m_inputs.size();
+		}
+	};
+
+	// NOTE(rksouthee): Set once and never cleared, so a feature is new to exactly one input whichever thread runs it
+	class Coverage
+	{
+	private:
+		std::vector<std::atomic<std::uint8_t>> m_seen;
+		std::atomic<std::uint32_t> m_count{ 0 };
+
+	public:
+		Coverage() :
+			m_seen(s_feature_count)
+		{
+		}
+
+		bool add(const std::span<const std::uint32_t> features)
+		{
+			bool added = false;
+			for (const std::uint32_t feature : features)
+			{
+				if (m_seen[feature].load(std::memory_order_relaxed) || m_seen[feature].exchange(1, std::memory_order_relaxed)) continue;
+				m_count.fetch_add(1, std::memory_order_relaxed);
+				added = true;
+			}
+			return added;
+		}
+
+		std::uint32_t count() const { return m_count.load(std::memory_order_relaxed); }
+	};
+
+	std::vector<std::uint8_t> make_random_input(std::mt19937& random, const std::size_t size)
+	{
+		std::vector<std::uint8_t> input(size);
+		for (std::uint8_t& b : input) b = static_cast<std::uint8_t>(random());
+		// Mostly with the segments all zero, as programs are loaded
+		if (size >= s_header_size && random() % 4 != 0) std::fill_n(input.begin(), s_header_size, 0);
+		return input;
+	}
+
+	void mutate(std::vector<std::uint8_t>& input, std::mt19937& random, Corpus& corpus)
+	{
+		// Prefixes, the edges of signed bytes and the opcodes that move the segments and stop the run
+		static const std::uint8_t s_bytes[] = { 0x00, 0x01, 0x7f, 0x80, 0xff, 0x26, 0x2e, 0x36, 0x3e, 0xf0, 0xf2, 0xf3, 0x8e, 0xf4 };
+		static const std::uint16_t s_segments[] = { 0x0000, 0x0001, 0x0fff, 0x1000, 0xf000, 0xfff0, 0xffff };
+		std::vector<std::uint8_t> other;
+		for (std::uint32_t count = 1 + random() % 4; count != 0; --count)
+		{
+			if (input.empty()) input.push_back(static_cast<std::uint8_t>(random()));
+			const std::size_t at = random() % input.size();
+			switch (random() % 7)
+			{
+			case 0:
+				input[at] ^= static_cast<std::uint8_t>(1 << (random() % 8));
+				break;
+			case 1:
+				input[at] = static_cast<std::uint8_t>(random());
+				break;
+			case 2:
+				input.insert(input.begin() + at, 1 + random() % 8, static_cast<std::uint8_t>(random()));
+				break;
+			case 3:
+				input.erase(input.begin() + at, input.begin() + std::min(input.size(), at + 1 + random() % 8));
+				break;
+			case 4:
+				input[at] = s_bytes[random() % std::size(s_bytes)];
+				break;
+			case 5:
+				if (input.size() >= s_header_size)
+				{
+					const std::uint16_t segment = s_segments[random() % std::size(s_segments)];
+					const std::size_t index = (random() % 4) * 2;
+					input[index] = segment & 0xff;
+					input[index + 1] = segment >> 8;
+				}
+				break;
+			default:
+				// Splice in part of another input
+				if (corpus.pick(random, other) && !other.empty())
+				{
+					const std::size_t from = random() % other.size();
+					const std::size_t size = std::min<std::size_t>(other.size() - from, 1 + random() % 64);
+					input.insert(input.begin() + at, other.begin() + from, other.begin() + from + size);
+				}
+				break;
+			}
+		}
+		if (input.size() > s_max_input_size) input.resize(s_max_input_size);
+	}
+
+	// Times running the same random inputs on one thread and then on thread_count of them
+	void benchmark(const unsigned thread_count)
+	{
+		constexpr std::size_t input_count = 2000;
+		std::mt19937 random(1);
+		std::vector<std::vector<std::uint8_t>> inputs;
+		std::size_t bytes = 0;
+		for (std::size_t i = 0; i < input_count; ++i)
+		{
+			inputs.push_back(make_random_input(random, s_header_size + 1 + random() % 1024));
+			bytes += inputs.back().size();
+		}
+
+		for (const unsigned threads : { 1u, thread_count })
+		{
+			std::atomic<std::size_t> next{ 0 };
+			const auto start = std::chrono::steady_clock::now();
+			const auto worker = [&]()
+			{
+				Target target;
+				for (std::size_t i = next++; i < inputs.size(); i = next++) run_target(target, inputs[i]);
+			};
+			std::vector<std::thread> workers;
+			for (unsigned i = 1; i < threads; ++i) workers.emplace_back(worker);
+			worker();
+			for (std::thread& thread : workers) thread.join();
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cout << std::format("{} thread{}: {:.0f} inputs/s, {:.2f} MB/s\n", threads, threads == 1 ? "" : "s",
+				input_count / seconds, bytes / seconds / 1e6);
+			if (thread_count == 1) break;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	cxxopts::Options options("fuzz_sim86", "Fuzz the 8086 decoder and simulator");
+	options.add_options()
+		("corpus", "A directory of inputs to start from, the new inputs found are written to it, or a single input to run", cxxopts::value<std::string>())
+		("runs", "Stop after this many inputs, zero for no limit", cxxopts::value<std::uint64_t>()->default_value("0"))
+		("seconds", "Stop after this many seconds, zero for no limit", cxxopts::value<std::uint64_t>()->default_value("0"))
+		("threads", "The number of threads, one per core by default", cxxopts::value<unsigned>())
+		("seed", "Seed for the random inputs and mutations", cxxopts::value<std::uint32_t>()->default_value("1"))
+		("benchmark", "Time a fixed set of random inputs rather than fuzzing")
+		("h,help", "Show this help")
+		;
+	options.parse_positional({ "corpus" });
+	const cxxopts::ParseResult result = options.parse(argc, argv);
+	if (result.count("help"))
+	{
+		std::cout << options.help() << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	// NOTE(rksouthee): The simulator notes each instruction it skips on stderr, far too often to be of use here
+	std::cerr.setstate(std::ios::badbit);
+	const unsigned thread_count = result.count("threads") ? std::max(1u, result["threads"].as<unsigned>()) : std::max(1u, std::thread::hardware_concurrency());
+	if (result.count("benchmark"))
+	{
+		benchmark(thread_count);
+		return EXIT_SUCCESS;
+	}
+
+	std::filesystem::path directory;
+	if (result.count("corpus"))
+	{
+		directory = result["corpus"].as<std::string>();
+		if (std::filesystem::is_regular_file(directory))
+		{
+			// Reproduces what a single input does, failing as it did
+			std::ifstream file(directory, std::ios::in | std::ios::binary);
+			const std::vector<std::uint8_t> input{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+			Target target;
+			run_target(target, input);
+			std::cout << "no failures" << std::endl;
+			return EXIT_SUCCESS;
+		}
+		std::filesystem::create_directories(directory);
+	}
+	Corpus corpus(directory);
+	Coverage coverage;
+	{
+		Target target;
+		for (const std::filesystem::directory_entry& entry : directory.empty() ? std::filesystem::directory_iterator() : std::filesystem::directory_iterator(directory))
+		{
+			std::ifstream file(entry.path(), std::ios::in | std::ios::binary);
+			const std::vector<std::uint8_t> input{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+			run_target(target, input);
+			if (coverage.add(target.features)) corpus.add(input, false);
+		}
+	}
+
+	const std::uint64_t max_runs = result["runs"].as<std::uint64_t>();
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(result["seconds"].as<std::uint64_t>());
+	const bool timed = result["seconds"].as<std::uint64_t>() != 0;
+	const std::uint32_t seed = result["seed"].as<std::uint32_t>();
+	std::atomic<std::uint64_t> runs{ 0 };
+	std::atomic<bool> done{ false };
+
+	const auto worker = [&](const unsigned index)
+	{
+		Target target;
+		std::mt19937 random(seed + index);
+		std::vector<std::uint8_t> input;
+		while (!done.load(std::memory_order_relaxed))
+		{
+			if (runs.fetch_add(1, std::memory_order_relaxed) >= max_runs && max_runs != 0) break;
+			// Now and then a fresh input, so the corpus doesn't narrow to what it started with
+			if (random() % 16 == 0 || !corpus.pick(random, input)) input = make_random_input(random, s_header_size + 1 + random() % 256);
+			else mutate(input, random, corpus);
+			run_target(target, input);
+			if (coverage.add(target.features)) corpus.add(input, true);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < thread_count; ++i) threads.emplace_back(worker, i);
+	const auto start = std::chrono::steady_clock::now();
+	auto last_report = start;
+	for (;;)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		const auto now = std::chrono::steady_clock::now();
+		if (timed && now >= deadline) done = true;
+		const bool finished = done || (max_runs != 0 && runs.load() >= max_runs);
+		if (finished || now - last_report >= std::chrono::seconds(1))
+		{
+			last_report = now;
+			const double seconds = std::chrono::duration<double>(now - start).count();
+			const std::uint64_t count = std::min(runs.load(), max_runs == 0 ? UINT64_MAX : max_runs);
+			std::cout << std::format("runs: {}, {:.0f}/s, corpus: {}, features: {}\n", count, count / seconds, corpus.size(), coverage.count()) << std::flush;
+		}
+		if (finished) break;
+	}
+	done = true;
+	for (std::thread& thread : threads) thread.join();
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "history.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+namespace
+{
+	// The state before an instruction, as its record holds it. A record is the length of the whole record, this
+	// state, what each write overwrote as the bytes followed by their address and count, and the length again.
+	struct State
+	{
+		std::uint16_t registers[8];
+		std::uint16_t segments[4];
+		std::uint32_t ip;
+		std::uint16_t flags;
+		std::uint32_t total_clocks;
+	};
+
+	State get_state(const sim86::Context& ctx)
+	{
+		State state;
+		std::copy(std::begin(ctx.registers), std::end(ctx.registers), state.registers);
+		std::copy(std::begin(ctx.segments), std::end(ctx.segments), state.segments);
+		state.ip = static_cast<std::uint32_t>(ctx.ip);
+		state.flags = sim86::get_flags(ctx);
+		state.total_clocks = ctx.total_clocks;
+		return state;
+	}
+
+	void set_state(sim86::Context& ctx, const State& state)
+	{
+		std::copy(std::begin(state.registers), std::end(state.registers), ctx.registers);
+		if (ctx.segments[sim86::Segment_cs] != state.segments[sim86::Segment_cs])
+		{
+			for (sim86::Decoded_instruction& decoded : ctx.decoded) decoded.instruction.size = 0;
+		}
+		std::copy(std::begin(state.segments), std::end(state.segments), ctx.segments);
+		ctx.ip = state.ip;
+		ctx.clocks = 0;
+		ctx.total_clocks = state.total_clocks;
+		sim86::set_flags(ctx, state.flags);
+	}
+
+	// Puts back the bytes a write overwrote, dropping any cached instruction they overlap
+	void write_back(sim86::Context& ctx, const std::uint32_t addr, const std::uint8_t* const bytes, const std::uint32_t size)
+	{
+		for (std::uint32_t i = 0; i < size; ++i)
+		{
+			const std::uint32_t a = (addr + i) & (sim86::memory_size - 1);
+			ctx.memory[a] = bytes[i];
+			ctx.dirty_pages.insert(a / sim86::snapshot_page_size);
+		}
+		const std::uint32_t code_base = sim86::get_physical_address(ctx.segments[sim86::Segment_cs], 0);
+		for (std::uint32_t i = addr - (sim86::max_instruction_size - 1); i != addr + size; ++i)
+		{
+			const std::uint32_t offset = (i - code_base) & (sim86::memory_size - 1);
+			if (offset < sim86::segment_size) ctx.decoded[offset].instruction.size = 0;
+		}
+	}
+}
+
+namespace sim86
+{
+	History::History(Context& ctx, const std::ptrdiff_t end, const std::size_t log_size, const std::uint64_t checkpoint_interval, const std::size_t max_checkpoints) :
+		m_ctx(ctx),
+		m_end(end),
+		m_log(log_size),
+		m_checkpoint_interval(checkpoint_interval),
+		m_max_checkpoints(max_checkpoints)
+	{
+		add_checkpoint();
+		open_record();
+	}
+
+	void History::put(const std::uint64_t pos, const void* const data, const std::size_t size)
+	{
+		const std::size_t offset = pos % m_log.size();
+		const std::size_t first = std::min(size, m_log.size() - offset);
+		std::memcpy(m_log.data() + offset, data, first);
+		std::memcpy(m_log.data(), static_cast<const std::uint8_t*>(data) + first, size - first);
+	}
+
+	void History::get(const std::uint64_t pos, void* const data, const std::size_t size) const
+	{
+		const std::size_t offset = pos % m_log.size();
+		const std::size_t first = std::min(size, m_log.size() - offset);
+		std::memcpy(data, m_log.data() + offset, first);
+		std::memcpy(static_cast<std::uint8_t*>(data) + first, m_log.data(), size - first);
+	}
+
+	// Drops the oldest records to make room, or gives up on the record of the instruction executing when it alone
+	// doesn't fit
+	bool History::append(const void* const data, const std::size_t size)
+	{
+		if (m_record_lost) return false;
+		if (m_head + size - m_record > m_log.size())
+		{
+			m_record_lost = true;
+			return false;
+		}
+		while (m_head + size - m_tail > m_log.size())
+		{
+			std::uint32_t length;
+			get(m_tail, &length, sizeof(length));
+			m_tail += length;
+			++m_oldest;
+		}
+		put(m_head, data, size);
+		m_head += size;
+		return true;
+	}
+
+	void History::open_record()
+	{
+		m_record = m_head;
+		m_record_lost = false;
+		const std::uint32_t length = 0; // filled in once the instruction is done
+		const State state = get_state(m_ctx);
+		if (append(&length, sizeof(length))) append(&state, sizeof(state));
+	}
+
+	void History::undo_record()
+	{
+		std::uint32_t length;
+		get(m_head - sizeof(length), &length, sizeof(length));
+		const std::uint64_t start = m_head - length;
+		const std::uint64_t writes = start + sizeof(length) + sizeof(State);
+		// The writes are undone last first, the earliest of any to the same byte holds what was there before
+		for (std::uint64_t pos = m_head - sizeof(length); pos > writes;)
+		{
+			std::uint32_t addr;
+			std::uint32_t size;
+			get(pos - sizeof(size), &size, sizeof(size));
+			get(pos - sizeof(size) - sizeof(addr), &addr, sizeof(addr));
+			pos -= sizeof(size) + sizeof(addr) + size;
+			m_scratch.resize(size);
+			get(pos, m_scratch.data(), size);
+			write_back(m_ctx, addr, m_scratch.data(), size);
+		}
+		State state;
+		get(start + sizeof(length), &state, sizeof(state));
+		set_state(m_ctx, state);
+		m_head = start;
+		--m_steps;
+	}
+
+	void History::add_checkpoint()
+	{
+		m_checkpoints.push_back({ m_steps, snapshot(m_ctx) });
+		if (m_checkpoints.size() > m_max_checkpoints) m_checkpoints.pop_front();
+	}
+
+	void History::record()
+	{
+		if (!m_record_lost)
+		{
+			const std::uint32_t length = static_cast<std::uint32_t>(m_head + sizeof(length) - m_record);
+			if (append(&length, sizeof(length))) put(m_record, &length, sizeof(length));
+		}
+		++m_steps;
+		if (m_record_lost)
+		{
+			// Nothing before this instruction can be undone any more
+			m_head = m_record;
+			m_tail = m_record;
+			m_oldest = m_steps;
+		}
+		if (m_steps % m_checkpoint_interval == 0) add_checkpoint();
+		open_record();
+	}
+
+	void History::note_write(const std::uint32_t addr, const std::uint32_t size)
+	{
+		if (m_record_lost) return;
+		m_scratch.resize(size);
+		for (std::uint32_t i = 0; i < size; ++i)
+		{
+			m_scratch[i] = m_ctx.memory[(addr + i) & (memory_size - 1)];
+		}
+		if (append(m_scratch.data(), size) && append(&addr, sizeof(addr))) append(&size, sizeof(size));
+	}
+
+	std::uint64_t History::first_step() const
+	{
+		if (m_checkpoints.empty()) return m_oldest;
+		return std::min(m_oldest, m_checkpoints.front().step);
+	}
+
+	bool History::go_to(const std::uint64_t step)
+	{
+		if (step > m_steps || step < first_step()) return false;
+		m_head = m_record;
+		if (step >= m_oldest)
+		{
+			while (m_steps > step) undo_record();
+		}
+		else
+		{
+			const auto checkpoint = std::prev(std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), step,
+				[](const std::uint64_t value, const Checkpoint& checkpoint) { return value < checkpoint.step; }));
+			restore(m_ctx, checkpoint->snapshot);
+			// NOTE(rksouthee): The instructions up to the step are executed again as a plain run, nothing about them
+			// is logged, profiled, counted, cached or stopped at
+			Debug* const debug = std::exchange(m_ctx.debug, nullptr);
+			Profile* const profile = std::exchange(m_ctx.profile, nullptr);
+			History* const history = std::exchange(m_ctx.history, nullptr);
+			Counters* const counters = std::exchange(m_ctx.counters, nullptr);
+			Cache* const cache = std::exchange(m_ctx.cache, nullptr);
+			if (step > checkpoint->step) run(m_ctx, { m_end, step - checkpoint->step, 0 });
+			m_ctx.debug = debug;
+			m_ctx.profile = profile;
+			m_ctx.history = history;
+			m_ctx.counters = counters;
+			m_ctx.cache = cache;
+			m_tail = m_head;
+			m_oldest = step;
+			m_steps = step;
+		}
+		while (!m_checkpoints.empty() && m_checkpoints.back().step > step) m_checkpoints.pop_back();
+		open_record();
+		return true;
+	}
+
+	std::uint64_t History::step_back(const std::uint64_t count)
+	{
+		const std::uint64_t steps = m_steps;
+		go_to(m_steps - std::min(count, m_steps - first_step()));
+		return steps - m_steps;
+	}
+
+	bool History::run_back_to(const std::ptrdiff_t ip)
+	{
+		std::uint64_t step = m_steps;
+		for (std::uint64_t pos = m_record; pos > m_tail; --step)
+		{
+			std::uint32_t length;
+			get(pos - sizeof(length), &length, sizeof(length));
+			pos -= length;
+			State state;
+			get(pos + sizeof(length), &state, sizeof(state));
+			if (state.ip == ip) return go_to(step - 1);
+		}
+		return false;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "simulator.h"
+#include "snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace sim86
+{
+	// NOTE(rksouthee): Takes a context back through the instructions it executed. Each instruction logs the state
+	// from before it and the bytes of memory it overwrote to a ring of bounded size, so stepping back N instructions
+	// undoes N records and executes nothing. Instructions whose records the ring has since dropped are reached from
+	// the last checkpoint before them, a snapshot taken every so many instructions, by executing forward from it.
+	// Going back forgets the instructions after the step it reaches, the run carries on from there.
+	class History
+	{
+	private:
+		struct Checkpoint
+		{
+			std::uint64_t step;
+			std::shared_ptr<const Snapshot> snapshot;
+		};
+
+		Context& m_ctx;
+		std::ptrdiff_t m_end; // of the program, for executing forward from a checkpoint
+		std::vector<std::uint8_t> m_log;
+		std::uint64_t m_head = 0; // bytes ever written to the log
+		std::uint64_t m_tail = 0; // where the oldest record in the log starts
+		std::uint64_t m_record = 0; // where the record of the instruction executing starts
+		bool m_record_lost = false; // the instruction executing wrote more than the log holds
+		std::uint64_t m_steps = 0; // instructions executed since the history started
+		std::uint64_t m_oldest = 0; // the earliest step the log reaches back to
+		std::uint64_t m_checkpoint_interval;
+		std::size_t m_max_checkpoints;
+		std::deque<Checkpoint> m_checkpoints;
+		std::vector<std::uint8_t> m_scratch;
+
+		void put(std::uint64_t pos, const void* data, std::size_t size);
+		void get(std::uint64_t pos, void* data, std::size_t size) const;
+		bool append(const void* data, std::size_t size);
+		void open_record();
+		void undo_record();
+		void add_checkpoint();
+
+	public:
+		// Starts at the current state of ctx, which runs the program ending at end
+		History(Context& ctx, std::ptrdiff_t end, std::size_t log_size = 1 << 26, std::uint64_t checkpoint_interval = 1 << 20, std::size_t max_checkpoints = 64);
+		History(const History&) = delete;
+		History& operator=(const History&) = delete;
+
+		// Call after each instruction, as a Trace_fn
+		void record();
+		// Called by the simulator before it writes to memory, through Context::history
+		void note_write(std::uint32_t addr, std::uint32_t size);
+
+		// Instructions executed since the history started
+		[[nodiscard]] std::uint64_t steps() const { return m_steps; }
+		// The earliest step that can be gone back to
+		[[nodiscard]] std::uint64_t first_step() const;
+
+		// Takes the context back to the state after the given step, false if it's not in the history
+		bool go_to(std::uint64_t step);
+		// Goes back count instructions, or as far as the history reaches, and returns how many
+		std::uint64_t step_back(std::uint64_t count = 1);
+		// Goes back to the last time the instruction at ip was about to execute, false if the log doesn't reach it
+		bool run_back_to(std::ptrdiff_t ip);
+	};
+}
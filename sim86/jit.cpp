@@ -0,0 +1,814 @@
+#include "jit.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIM86_JIT 1
+#else
+#define SIM86_JIT 0
+#endif
+
+#if SIM86_JIT
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace
+{
+	constexpr std::size_t s_buffer_size = 1 << 20;
+	constexpr std::size_t s_max_block_bytes = 16 * 1024;
+	constexpr std::uint32_t s_max_block_instructions = 64;
+	// NOTE(rksouthee): A block returns the index of the chain exit it left through, or one of these
+	constexpr std::uint32_t s_exit_interpret = 0xffffffff; // the interpreter executes the next instruction
+	constexpr std::uint32_t s_exit_budget = 0xfffffffe; // the budget doesn't cover the block
+	constexpr std::int32_t s_not_compiled = -1;
+	constexpr std::int32_t s_not_compilable = -2;
+
+	static_assert(sim86::Context::Flags_arithmetic == 0x8d5);
+	static_assert(sim86::Context::Flags_zero == 0x40);
+
+	const std::uint32_t s_registers_offset = offsetof(sim86::Context, registers);
+	const std::uint32_t s_ip_offset = offsetof(sim86::Context, ip);
+	const std::uint32_t s_clocks_offset = offsetof(sim86::Context, clocks);
+	const std::uint32_t s_total_clocks_offset = offsetof(sim86::Context, total_clocks);
+	const std::uint32_t s_flags_offset = offsetof(sim86::Context, flags);
+	const std::uint32_t s_segments_offset = offsetof(sim86::Context, segments);
+	const std::uint32_t s_dirty_pages_offset = offsetof(sim86::Context, dirty_pages);
+	static_assert(sim86::snapshot_page_size == 256);
+	static_assert(sim86::memory_size == 0x100000);
+
+	// NOTE(rksouthee): Register allocation within a block
+	//   rbx      the context
+	//   rbp      the code map, a non-zero byte marks guest memory backing a compiled block
+	//   rcx      the guest memory
+	//   r8-r15   guest registers ax, cx, dx, bx, sp, bp, si, di zero extended to 64 bits
+	//   rsi      the instructions left in the budget
+	//   rdi      the clocks in the budget, the total_clocks not to go past
+	//   [rsp]    the budget, written back on the way out
+	//   rax, rdx scratch, eax holds the physical address of a memory operand
+	// All of them stay as they are when one block jumps into another.
+	struct Emitter
+	{
+		std::uint8_t* p;
+
+		void byte(const std::uint8_t b) { *p++ = b; }
+
+		void bytes(std::initializer_list<std::uint8_t> list)
+		{
+			for (const std::uint8_t b : list) *p++ = b;
+		}
+
+		void u16(const std::uint16_t v)
+		{
+			byte(v & 0xff);
+			byte(v >> 8);
+		}
+
+		void u32(const std::uint32_t v)
+		{
+			for (int i = 0; i < 4; ++i) byte((v >> (8 * i)) & 0xff);
+		}
+
+		std::uint8_t* jcc(const std::uint8_t cc)
+		{
+			bytes({ 0x0f, cc });
+			std::uint8_t* patch = p;
+			u32(0);
+			return patch;
+		}
+	};
+
+	void patch_u32(std::uint8_t* patch, const std::uint32_t v)
+	{
+		for (int i = 0; i < 4; ++i) patch[i] = (v >> (8 * i)) & 0xff;
+	}
+
+	void patch_rel32(std::uint8_t* patch, const std::uint8_t* target)
+	{
+		patch_u32(patch, static_cast<std::uint32_t>(target - (patch + 4)));
+	}
+
+	void emit_prologue(Emitter& e)
+	{
+		e.byte(0x53); // push rbx
+		e.byte(0x55); // push rbp
+		e.bytes({ 0x41, 0x54 }); // push r12
+		e.bytes({ 0x41, 0x55 }); // push r13
+		e.bytes({ 0x41, 0x56 }); // push r14
+		e.bytes({ 0x41, 0x57 }); // push r15
+#ifdef _WIN32
+		e.byte(0x56); // push rsi
+		e.byte(0x57); // push rdi
+		e.bytes({ 0x41, 0x51 }); // push r9
+		e.bytes({ 0x48, 0x89, 0xcb }); // mov rbx, rcx
+		e.bytes({ 0x48, 0x89, 0xd5 }); // mov rbp, rdx
+		e.bytes({ 0x4c, 0x89, 0xc1 }); // mov rcx, r8
+#else
+		e.byte(0x51); // push rcx
+		e.bytes({ 0x48, 0x89, 0xfb }); // mov rbx, rdi
+		e.bytes({ 0x48, 0x89, 0xf5 }); // mov rbp, rsi
+		e.bytes({ 0x48, 0x89, 0xd1 }); // mov rcx, rdx
+#endif
+		e.bytes({ 0x48, 0x8b, 0x04, 0x24 }); // mov rax, [rsp]
+		e.bytes({ 0x48, 0x8b, 0x30 }); // mov rsi, [rax + instructions]
+		e.bytes({ 0x48, 0x8b, 0x78, 0x08 }); // mov rdi, [rax + clocks]
+		for (std::uint8_t reg = 0; reg < 8; ++reg)
+		{
+			// movzx r8d+reg, word [rbx + registers + reg * 2]
+			e.bytes({ 0x44, 0x0f, 0xb7, static_cast<std::uint8_t>(0x83 | (reg << 3)) });
+			e.u32(s_registers_offset + reg * 2);
+		}
+	}
+
+	void emit_epilogue(Emitter& e)
+	{
+		for (std::uint8_t reg = 0; reg < 8; ++reg)
+		{
+			// mov word [rbx + registers + reg * 2], r8w+reg
+			e.bytes({ 0x66, 0x44, 0x89, static_cast<std::uint8_t>(0x83 | (reg << 3)) });
+			e.u32(s_registers_offset + reg * 2);
+		}
+		e.byte(0x5a); // pop rdx
+		e.bytes({ 0x48, 0x89, 0x32 }); // mov [rdx + instructions], rsi
+#ifdef _WIN32
+		e.byte(0x5f); // pop rdi
+		e.byte(0x5e); // pop rsi
+#endif
+		e.bytes({ 0x41, 0x5f }); // pop r15
+		e.bytes({ 0x41, 0x5e }); // pop r14
+		e.bytes({ 0x41, 0x5d }); // pop r13
+		e.bytes({ 0x41, 0x5c }); // pop r12
+		e.byte(0x5d); // pop rbp
+		e.byte(0x5b); // pop rbx
+		e.byte(0xc3); // ret
+	}
+
+	// Charges the clocks and instructions of the block up to here
+	void emit_charge(Emitter& e, const std::uint32_t clocks, const std::uint32_t count)
+	{
+		e.bytes({ 0xc7, 0x83 }); // mov dword [rbx + clocks], imm32
+		e.u32(s_clocks_offset);
+		e.u32(clocks);
+		e.bytes({ 0x81, 0x83 }); // add dword [rbx + total_clocks], imm32
+		e.u32(s_total_clocks_offset);
+		e.u32(clocks);
+		e.bytes({ 0x48, 0x81, 0xee }); // sub rsi, imm32
+		e.u32(count);
+	}
+
+	// Returns to the caller at guest address ip
+	void emit_return(Emitter& e, const std::ptrdiff_t ip, const std::uint32_t result)
+	{
+		e.bytes({ 0x48, 0xc7, 0x83 }); // mov qword [rbx + ip], imm32
+		e.u32(s_ip_offset);
+		e.u32(static_cast<std::uint32_t>(ip));
+		e.byte(0xb8); // mov eax, imm32
+		e.u32(result);
+		emit_epilogue(e);
+	}
+
+	// Leaves the block at guest address ip
+	void emit_exit(Emitter& e, const std::ptrdiff_t ip, const std::uint32_t clocks, const std::uint32_t count, const std::uint32_t result)
+	{
+		emit_charge(e, clocks, count);
+		emit_return(e, ip, result);
+	}
+
+	// Leaves the block at guest address ip through a jump that chain patches to go into the block compiled there,
+	// until then it jumps to the return that follows it. Returns where to patch.
+	std::uint8_t* emit_chain_exit(Emitter& e, const std::ptrdiff_t ip, const std::uint32_t clocks, const std::uint32_t count, const std::uint32_t index)
+	{
+		emit_charge(e, clocks, count);
+		e.byte(0xe9); // jmp rel32
+		std::uint8_t* patch = e.p;
+		e.u32(0);
+		emit_return(e, ip, index);
+		return patch;
+	}
+
+	// Copies the host flags to eax without disturbing them, so a conditional jump can still use them
+	void emit_read_host_flags(Emitter& e)
+	{
+		e.byte(0x9c); // pushfq
+		e.byte(0x58); // pop rax
+	}
+
+	// Writes the arithmetic flags emit_read_host_flags left in eax to the context, clobbers edx and the host flags.
+	// The guest and host flags share their bit positions and the 16-bit host instructions set them exactly as the
+	// guest ones do.
+	void emit_write_flags(Emitter& e)
+	{
+		e.byte(0x25); // and eax, Flags_arithmetic
+		e.u32(sim86::Context::Flags_arithmetic);
+		e.bytes({ 0x0f, 0xb7, 0x93 }); // movzx edx, word [rbx + flags]
+		e.u32(s_flags_offset);
+		e.bytes({ 0x81, 0xe2 }); // and edx, ~Flags_arithmetic
+		e.u32(~static_cast<std::uint32_t>(sim86::Context::Flags_arithmetic) & 0xffff);
+		e.bytes({ 0x09, 0xd0 }); // or eax, edx
+		e.bytes({ 0x66, 0x89, 0x83 }); // mov word [rbx + flags], ax
+		e.u32(s_flags_offset);
+	}
+
+	// Marks the pages written by a store to the address in eax, clobbers edx and the host flags. The page is a bit
+	// offset from the start of dirty_pages, which bts takes as a bit string.
+	void emit_mark_dirty(Emitter& e, const std::uint32_t size)
+	{
+		e.bytes({ 0x89, 0xc2 }); // mov edx, eax
+		e.bytes({ 0xc1, 0xea, 0x08 }); // shr edx, 8
+		e.bytes({ 0x0f, 0xab, 0x93 }); // bts dword [rbx + dirty_pages], edx
+		e.u32(s_dirty_pages_offset);
+		if (size == 1) return;
+		e.bytes({ 0x8d, 0x50, 0x01 }); // lea edx, [rax + 1]
+		e.bytes({ 0xc1, 0xea, 0x08 }); // shr edx, 8
+		e.bytes({ 0x81, 0xe2 }); // and edx, page count - 1
+		e.u32(sim86::page_count - 1);
+		e.bytes({ 0x0f, 0xab, 0x93 }); // bts dword [rbx + dirty_pages], edx
+		e.u32(s_dirty_pages_offset);
+	}
+
+	// Adds the clocks to the total when the address in eax is odd, clobbers the host flags
+	void emit_odd_address_penalty(Emitter& e, const std::uint32_t clocks)
+	{
+		e.bytes({ 0xa8, 0x01 }); // test al, 1
+		e.bytes({ 0x74, 0x0a }); // jz past the add
+		e.bytes({ 0x81, 0x83 }); // add dword [rbx + total_clocks], imm32
+		e.u32(s_total_clocks_offset);
+		e.u32(clocks);
+	}
+
+	// Leaves the physical address of the operand in eax, clobbers edx. A word whose second byte wraps around, to the
+	// start of its segment or of memory, jumps to the patches left in wraps instead, returns how many there are.
+	std::uint32_t emit_address(Emitter& e, const sim86::Instruction& inst, const sim86::Operand& operand, std::uint8_t* (&wraps)[2])
+	{
+		std::uint32_t wrap_count = 0;
+		if (operand.type == sim86::Operand_direct)
+		{
+			e.byte(0xb8); // mov eax, imm32
+			e.u32(operand.value);
+		}
+		else
+		{
+			// bx+si, bx+di, bp+si, bp+di, si, di, bp, bx
+			static const std::uint8_t s_base[8] = { 3, 3, 5, 5, 6, 7, 5, 3 };
+			static const std::uint8_t s_index[8] = { 6, 7, 6, 7, 0, 0, 0, 0 };
+			if (operand.reg < 4)
+			{
+				// lea eax, [base + index + disp32]
+				e.bytes({ 0x43, 0x8d, 0x84, static_cast<std::uint8_t>((s_index[operand.reg] << 3) | s_base[operand.reg]) });
+			}
+			else
+			{
+				// lea eax, [base + disp32]
+				e.bytes({ 0x41, 0x8d, static_cast<std::uint8_t>(0x80 | s_base[operand.reg]) });
+			}
+			e.u32(operand.value);
+			e.bytes({ 0x0f, 0xb7, 0xc0 }); // movzx eax, ax
+			if (inst.w)
+			{
+				e.bytes({ 0x66, 0x83, 0xf8, 0xff }); // cmp ax, 0xffff
+				wraps[wrap_count++] = e.jcc(0x84); // je
+			}
+		}
+
+		// NOTE(rksouthee): The segment registers only change in the interpreter, but they are read each time rather
+		// than compiled in so that changing one doesn't discard the blocks.
+		e.bytes({ 0x0f, 0xb7, 0x93 }); // movzx edx, word [rbx + segments + segment * 2]
+		e.u32(s_segments_offset + sim86::get_segment(inst, operand) * 2);
+		e.bytes({ 0xc1, 0xe2, 0x04 }); // shl edx, 4
+		e.bytes({ 0x01, 0xd0 }); // add eax, edx
+		e.byte(0x25); // and eax, memory size - 1
+		e.u32(sim86::memory_size - 1);
+		if (inst.w)
+		{
+			e.byte(0x3d); // cmp eax, memory size - 1
+			e.u32(sim86::memory_size - 1);
+			wraps[wrap_count++] = e.jcc(0x84); // je
+		}
+		return wrap_count;
+	}
+
+	// The r/m operand of the mod reg r/m instructions the translator handles
+	const sim86::Operand& get_r_m(const sim86::Instruction& inst)
+	{
+		return inst.opcode == 0x8b ? inst.operands[1] : inst.operands[0];
+	}
+
+	// The reg field of the mod reg r/m instructions the translator handles, the operation for the immediate group
+	std::uint8_t get_reg(const sim86::Instruction& inst)
+	{
+		switch (inst.opcode)
+		{
+		case 0x81:
+		case 0x83: return static_cast<std::uint8_t>(inst.operation - sim86::Operation_add);
+		case 0x8b: return inst.operands[0].reg;
+		default: return inst.operands[1].reg;
+		}
+	}
+
+	// Clocks for the instructions the translator handles as the simulator times them, apart from the penalty for
+	// a word at an odd address which emit_odd_address_penalty charges when the address is known
+	std::uint32_t get_clocks(const sim86::Instruction& inst, const sim86::Cpu cpu)
+	{
+		const sim86::Operand& r_m = get_r_m(inst);
+		const sim86::Timing timing = sim86::get_timing(inst);
+		if (r_m.type == sim86::Operand_register) return timing.clocks;
+		const std::uint32_t ea = r_m.type == sim86::Operand_direct ? sim86::get_clocks_for_ea_components(0b00, 0b110)
+			: sim86::get_clocks_for_ea_components(r_m.mod, r_m.reg);
+		const std::uint32_t penalty = inst.w ? timing.transfers * sim86::get_word_transfer_penalty(cpu, 0) : 0;
+		return timing.clocks + ea + penalty;
+	}
+
+	// The clocks a word at an odd address costs on top of get_clocks
+	std::uint32_t get_odd_address_penalty(const sim86::Instruction& inst, const sim86::Cpu cpu)
+	{
+		if (!inst.w || get_r_m(inst).type == sim86::Operand_register) return 0;
+		const std::uint32_t odd = sim86::get_word_transfer_penalty(cpu, 1) - sim86::get_word_transfer_penalty(cpu, 0);
+		return sim86::get_timing(inst).transfers * odd;
+	}
+
+	bool is_supported(const sim86::Instruction& inst)
+	{
+		// NOTE(rksouthee): A segment prefix only changes the segment register emit_address reads, the translator has
+		// no string instructions to repeat
+		if (inst.flags & ~sim86::Instruction_segment) return false;
+		// A word at the last offset of its segment always wraps around
+		const sim86::Operand& r_m = get_r_m(inst);
+		if (inst.w && r_m.type == sim86::Operand_direct && r_m.value == 0xffff) return false;
+		switch (inst.opcode)
+		{
+		case 0x01:
+		case 0x29:
+		case 0x39:
+		case 0x75:
+		case 0x89:
+		case 0x8b:
+		case 0xc7:
+			return true;
+		case 0xc6:
+			// NOTE(rksouthee): ah, ch, dh and bh have no encoding alongside the r8-r11 the guest registers live in
+			return inst.operands[0].type != sim86::Operand_register || inst.operands[0].reg < 4;
+		case 0x81:
+		case 0x83:
+			return inst.operation == sim86::Operation_add || inst.operation == sim86::Operation_sub || inst.operation == sim86::Operation_cmp;
+		default:
+			return inst.opcode >= 0xb8 && inst.opcode <= 0xbf;
+		}
+	}
+
+	bool protect(std::uint8_t* buffer, const std::size_t size, const bool executable)
+	{
+#if SIM86_JIT
+#ifdef _WIN32
+		DWORD old_protect;
+		if (!VirtualProtect(buffer, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old_protect)) return false;
+		if (executable) FlushInstructionCache(GetCurrentProcess(), buffer, size);
+		return true;
+#else
+		return mprotect(buffer, size, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+#else
+		(void)buffer;
+		(void)size;
+		(void)executable;
+		return false;
+#endif
+	}
+}
+
+namespace sim86
+{
+	Jit::Jit() :
+		m_block_index(0x10000, s_not_compiled),
+		m_code_map(memory_size + 1, 0)
+	{
+#if SIM86_JIT
+#ifdef _WIN32
+		void* buffer = VirtualAlloc(nullptr, s_buffer_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void* buffer = mmap(nullptr, s_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buffer == MAP_FAILED) buffer = nullptr;
+#endif
+		if (buffer)
+		{
+			m_buffer = static_cast<std::uint8_t*>(buffer);
+			m_buffer_size = s_buffer_size;
+		}
+#endif
+	}
+
+	Jit::~Jit()
+	{
+#if SIM86_JIT
+		if (!m_buffer) return;
+#ifdef _WIN32
+		VirtualFree(m_buffer, 0, MEM_RELEASE);
+#else
+		munmap(m_buffer, m_buffer_size);
+#endif
+#endif
+	}
+
+	void Jit::flush(Context& ctx)
+	{
+		for (const Code_range& range : m_code_ranges) std::fill(m_code_map.begin() + range.first, m_code_map.begin() + range.last, 0);
+		m_code_ranges.clear();
+		m_blocks.clear();
+		m_chain_exits.clear();
+		for (const std::uint16_t ip : m_indexed) m_block_index[ip] = s_not_compiled;
+		m_indexed.clear();
+		m_buffer_used = 0;
+		// NOTE(rksouthee): Stores from compiled code don't invalidate the decoded instruction cache, so it can only
+		// be trusted for what the JIT has seen since the last flush.
+		for (Decoded_instruction& inst : ctx.decoded) inst.instruction.size = 0;
+	}
+
+	void Jit::mark_code(const std::uint32_t first, const std::uint32_t last)
+	{
+		std::fill(m_code_map.begin() + first, m_code_map.begin() + last, 1);
+		m_code_ranges.push_back({ first, last });
+	}
+
+	// NOTE(rksouthee): The interpreter caches what it decodes, and a store from compiled code doesn't drop it, so
+	// the instruction it stepped (and a jump fused with it) are marked as code. A store to them leaves the block and
+	// the flush that follows drops the cache.
+	void Jit::mark_interpreted(const Context& ctx, const std::ptrdiff_t ip)
+	{
+		const std::uint32_t size = ctx.decoded[ip].instruction.size;
+		if (size == 0) return;
+		std::uint32_t last = static_cast<std::uint32_t>(ip) + size;
+		if (ctx.decoded[ip].fused_handler != ctx.decoded[ip].handler) last += ctx.decoded[last].instruction.size;
+		const std::uint32_t code_base = get_physical_address(ctx.segments[Segment_cs], 0);
+		// The code map marks one run of memory, an instruction that wraps is left unmarked and never cached
+		if (code_base + last > memory_size) return;
+		const std::uint32_t first = code_base + static_cast<std::uint32_t>(ip);
+		// A loop the interpreter steps through is only marked once
+		const auto marked = m_code_map.begin();
+		if (std::all_of(marked + first, marked + code_base + last, [](std::uint8_t code) { return code != 0; })) return;
+		mark_code(first, code_base + last);
+	}
+
+	// NOTE(rksouthee): An exit is only patched once the block it leads to is compiled, compiling that here could
+	// flush the buffer the exit is in
+	void Jit::chain(const Chain_exit& exit)
+	{
+		if (exit.ip < 0 || exit.ip >= static_cast<std::ptrdiff_t>(m_block_index.size())) return;
+		const std::int32_t index = m_block_index[exit.ip];
+		if (index < 0 || !protect(m_buffer, m_buffer_size, false)) return;
+		patch_rel32(exit.patch, m_blocks[index].chain_entry);
+		protect(m_buffer, m_buffer_size, true);
+	}
+
+	std::int32_t Jit::compile(Context& ctx, const std::ptrdiff_t ip, const std::ptrdiff_t end)
+	{
+		if (m_buffer_size - m_buffer_used < s_max_block_bytes) flush(ctx);
+		if (!protect(m_buffer, m_buffer_size, false)) return s_not_compilable;
+
+		struct Pending_exit
+		{
+			std::uint8_t* patch;
+			std::ptrdiff_t ip;
+			std::uint32_t clocks;
+			std::uint32_t instructions;
+		};
+		// Each instruction can leave for the interpreter before writing to compiled code or to a word that wraps
+		Pending_exit interpreter_exits[s_max_block_instructions * 3];
+		std::uint32_t interpreter_exit_count = 0;
+
+		const std::uint32_t code_base = get_physical_address(ctx.segments[Segment_cs], 0);
+		std::uint8_t* const start = m_buffer + m_buffer_used;
+		Emitter e{ start };
+		emit_prologue(e);
+
+		// NOTE(rksouthee): Another block jumping in checks here that the budget covers this one, as run does before
+		// calling it. The instructions and clocks are filled in once they are known.
+		std::uint8_t* const chain_entry = e.p;
+		e.bytes({ 0x48, 0x81, 0xfe }); // cmp rsi, instruction count
+		std::uint8_t* const count_patch = e.p;
+		e.u32(0);
+		std::uint8_t* over_budget[2];
+		over_budget[0] = e.jcc(0x82); // jb
+		e.bytes({ 0x8b, 0x83 }); // mov eax, dword [rbx + total_clocks]
+		e.u32(s_total_clocks_offset);
+		e.bytes({ 0x48, 0x05 }); // add rax, max clocks
+		std::uint8_t* const clocks_patch = e.p;
+		e.u32(0);
+		e.bytes({ 0x48, 0x39, 0xf8 }); // cmp rax, rdi
+		over_budget[1] = e.jcc(0x87); // ja
+
+		std::uint32_t clocks = 0;
+		std::uint32_t count = 0;
+		std::uint32_t max_clocks = 0;
+		std::uint32_t odd_address_penalties = 0; // the most that words at odd addresses can add to clocks
+		bool host_flags = false; // the host flags hold the zero and sign flags of the last arithmetic instruction
+		bool terminated = false;
+		std::ptrdiff_t pc = ip;
+
+		const auto store_flags = [&]()
+		{
+			if (host_flags)
+			{
+				emit_read_host_flags(e);
+				emit_write_flags(e);
+			}
+			host_flags = false;
+		};
+
+		const auto chain_exit = [&](const std::ptrdiff_t target, const std::uint32_t exit_clocks, const std::uint32_t exit_count)
+		{
+			const auto index = static_cast<std::uint32_t>(m_chain_exits.size());
+			m_chain_exits.push_back({ emit_chain_exit(e, target, exit_clocks, exit_count, index), target });
+		};
+
+		// Leaves the physical address of the r/m operand in eax, a word that wraps around is left to the interpreter
+		const auto emit_r_m_address = [&](const Instruction& inst, const Operand& r_m)
+		{
+			std::uint8_t* wraps[2];
+			const std::uint32_t wrap_count = emit_address(e, inst, r_m, wraps);
+			for (std::uint32_t i = 0; i < wrap_count; ++i) interpreter_exits[interpreter_exit_count++] = { wraps[i], pc, clocks, count };
+		};
+
+		// Leaves the block before an instruction that writes to compiled code, the interpreter executes it instead.
+		// Otherwise marks the pages the store is about to write.
+		const auto check_code_write = [&](const std::uint32_t size)
+		{
+			if (size == 2) e.bytes({ 0x66, 0x83, 0x7c, 0x05, 0x00, 0x00 }); // cmp word [rbp + rax], 0
+			else e.bytes({ 0x80, 0x7c, 0x05, 0x00, 0x00 }); // cmp byte [rbp + rax], 0
+			interpreter_exits[interpreter_exit_count++] = { e.jcc(0x85), pc, clocks, count };
+			emit_mark_dirty(e, size);
+		};
+
+		while (count < s_max_block_instructions && pc < end && !terminated)
+		{
+			const Instruction inst = fetch(ctx, pc, end);
+			if (inst.operation == Operation_none || !is_supported(inst)) break;
+			const std::ptrdiff_t next = pc + inst.size;
+			// The code map marks a block as one run of memory
+			if (code_base + static_cast<std::size_t>(next) > memory_size) break;
+			const Operand& r_m = get_r_m(inst);
+			const std::uint8_t reg_field = get_reg(inst);
+			const std::uint8_t mod_reg_rm = static_cast<std::uint8_t>(0xc0 | (reg_field << 3) | r_m.reg);
+			const std::uint8_t mod_rm_reg = static_cast<std::uint8_t>(0xc0 | (r_m.reg << 3) | reg_field);
+			const std::uint8_t sib_reg = static_cast<std::uint8_t>(0x04 | (reg_field << 3));
+			const bool reg = r_m.type == Operand_register;
+			const std::uint32_t odd_address_penalty = get_odd_address_penalty(inst, ctx.cpu);
+			const auto charge_odd_address = [&]()
+			{
+				if (odd_address_penalty == 0) return;
+				emit_odd_address_penalty(e, odd_address_penalty);
+				odd_address_penalties += odd_address_penalty;
+			};
+			switch (inst.opcode)
+			{
+			case 0x01: // add rm16,reg16
+			case 0x29: // sub rm16,reg16
+			case 0x39: // cmp rm16,reg16
+				if (reg)
+				{
+					e.bytes({ 0x66, 0x45, inst.opcode, mod_reg_rm });
+				}
+				else
+				{
+					store_flags();
+					emit_r_m_address(inst, r_m);
+					if (inst.opcode != 0x39) check_code_write(2);
+					charge_odd_address();
+					e.bytes({ 0x66, 0x44, inst.opcode, sib_reg, 0x01 }); // op word [rcx + rax], reg16
+				}
+				host_flags = true;
+				break;
+			case 0x81: // op rm16,immed16
+			case 0x83: // op rm16,immed8
+				{
+					if (reg)
+					{
+						e.bytes({ 0x66, 0x41, 0x81, mod_reg_rm });
+					}
+					else
+					{
+						store_flags();
+						emit_r_m_address(inst, r_m);
+						if (inst.operation != Operation_cmp) check_code_write(2);
+						charge_odd_address();
+						e.bytes({ 0x66, 0x81, sib_reg, 0x01 });
+					}
+					e.u16(inst.operands[1].value);
+					host_flags = true;
+				}
+				break;
+			case 0x89: // mov rm16,reg16
+				if (reg)
+				{
+					e.bytes({ 0x66, 0x45, 0x89, mod_reg_rm });
+				}
+				else
+				{
+					store_flags();
+					emit_r_m_address(inst, r_m);
+					check_code_write(2);
+					charge_odd_address();
+					e.bytes({ 0x66, 0x44, 0x89, sib_reg, 0x01 });
+				}
+				break;
+			case 0x8b: // mov reg16,rm16
+				if (reg)
+				{
+					e.bytes({ 0x66, 0x45, 0x89, mod_rm_reg });
+				}
+				else
+				{
+					store_flags();
+					emit_r_m_address(inst, r_m);
+					charge_odd_address();
+					e.bytes({ 0x66, 0x44, 0x8b, sib_reg, 0x01 });
+				}
+				break;
+			case 0xc6: // mov rm8,immed8
+				if (reg)
+				{
+					e.bytes({ 0x41, 0xc6, static_cast<std::uint8_t>(0xc0 | r_m.reg) });
+				}
+				else
+				{
+					store_flags();
+					emit_r_m_address(inst, r_m);
+					check_code_write(1);
+					e.bytes({ 0xc6, 0x04, 0x01 });
+				}
+				e.byte(inst.operands[1].value & 0xff);
+				break;
+			case 0xc7: // mov rm16,immed16
+				if (reg)
+				{
+					e.bytes({ 0x66, 0x41, 0xc7, static_cast<std::uint8_t>(0xc0 | r_m.reg) });
+				}
+				else
+				{
+					store_flags();
+					emit_r_m_address(inst, r_m);
+					check_code_write(2);
+					charge_odd_address();
+					e.bytes({ 0x66, 0xc7, 0x04, 0x01 });
+				}
+				e.u16(inst.operands[1].value);
+				break;
+			case 0x75: // jnz short-label
+				{
+					const std::ptrdiff_t target = next + static_cast<std::int16_t>(inst.operands[0].value);
+					std::uint8_t* taken;
+					if (host_flags)
+					{
+						emit_read_host_flags(e);
+						taken = e.jcc(0x85); // jnz
+						emit_write_flags(e);
+					}
+					else
+					{
+						e.bytes({ 0xf6, 0x83 }); // test byte [rbx + flags], Flags_zero
+						e.u32(s_flags_offset);
+						e.byte(Context::Flags_zero);
+						taken = e.jcc(0x84); // jz
+					}
+					const Timing timing = get_timing(inst);
+					chain_exit(next, clocks + timing.not_taken_clocks, count + 1);
+					patch_rel32(taken, e.p);
+					if (host_flags) emit_write_flags(e);
+					host_flags = false;
+					chain_exit(target, clocks + timing.clocks, count + 1);
+					max_clocks = clocks + timing.clocks + odd_address_penalties;
+					terminated = true;
+				}
+				break;
+			default: // mov reg16,immed16
+				e.bytes({ 0x66, 0x41, static_cast<std::uint8_t>(inst.opcode) });
+				e.u16(inst.operands[1].value);
+				break;
+			}
+
+			if (!terminated) clocks += get_clocks(inst, ctx.cpu);
+			++count;
+			pc = next;
+		}
+
+		if (count == 0)
+		{
+			protect(m_buffer, m_buffer_size, true);
+			return s_not_compilable;
+		}
+
+		if (!terminated)
+		{
+			store_flags();
+			chain_exit(pc, clocks, count);
+			max_clocks = clocks + odd_address_penalties;
+		}
+
+		for (std::uint32_t i = 0; i < interpreter_exit_count; ++i)
+		{
+			const Pending_exit& exit = interpreter_exits[i];
+			patch_rel32(exit.patch, e.p);
+			emit_exit(e, exit.ip, exit.clocks, exit.instructions, s_exit_interpret);
+		}
+
+		for (std::uint8_t* const patch : over_budget) patch_rel32(patch, e.p);
+		emit_return(e, ip, s_exit_budget);
+		patch_u32(count_patch, count);
+		patch_u32(clocks_patch, max_clocks);
+
+		m_buffer_used += e.p - start;
+		if (!protect(m_buffer, m_buffer_size, true)) return s_not_compilable;
+
+		const std::uint32_t code_first = static_cast<std::uint32_t>(code_base + ip);
+		const std::uint32_t code_last = static_cast<std::uint32_t>(code_base + pc);
+		mark_code(code_first, code_last);
+		m_blocks.push_back({ reinterpret_cast<Block_fn>(start), chain_entry, count, max_clocks });
+		return static_cast<std::int32_t>(m_blocks.size() - 1);
+	}
+
+	const Jit::Block* Jit::get_block(Context& ctx, const std::ptrdiff_t ip, const std::ptrdiff_t end)
+	{
+		std::int32_t index = m_block_index[ip];
+		if (index == s_not_compiled)
+		{
+			index = compile(ctx, ip, end);
+			m_block_index[ip] = index;
+			m_indexed.push_back(static_cast<std::uint16_t>(ip));
+		}
+		if (index < 0) return nullptr;
+		return &m_blocks[index];
+	}
+
+	Run_result Jit::run(Context& ctx, const Limits& limits)
+	{
+		// NOTE(rksouthee): Compiled blocks don't count their instructions, check breakpoints and watchpoints or log
+		// their writes and accesses, a profiled, counted, debugged, recorded or cached run is left to the interpreter
+		if (!is_available() || ctx.profile || ctx.counters || ctx.debug || ctx.history || ctx.cache) return sim86::run(ctx, limits);
+
+		const std::uint64_t max_instructions = limits.max_instructions ? limits.max_instructions : UINT64_MAX;
+		const std::uint64_t max_clocks = limits.max_clocks ? limits.max_clocks : UINT64_MAX;
+		flush(ctx);
+		m_code_segment = ctx.segments[Segment_cs];
+		ctx.code_map = m_code_map.data();
+		ctx.code_modified = false;
+
+		Run_result result{ Stop_reason::end_of_program, 0 };
+		bool interpret_next = false;
+		for (;;)
+		{
+			if (result.instructions == max_instructions)
+			{
+				result.reason = Stop_reason::instruction_limit;
+				break;
+			}
+			if (ctx.total_clocks >= max_clocks)
+			{
+				result.reason = Stop_reason::clock_limit;
+				break;
+			}
+			if (ctx.ip < 0 || ctx.ip >= limits.end)
+			{
+				result.reason = Stop_reason::end_of_program;
+				break;
+			}
+			if (ctx.code_modified || ctx.segments[Segment_cs] != m_code_segment)
+			{
+				flush(ctx);
+				m_code_segment = ctx.segments[Segment_cs];
+				ctx.code_modified = false;
+			}
+
+			const Block* block = interpret_next ? nullptr : get_block(ctx, ctx.ip, limits.end);
+			interpret_next = false;
+			if (block && max_instructions - result.instructions >= block->instruction_count &&
+				ctx.total_clocks + static_cast<std::uint64_t>(block->max_clocks) <= max_clocks)
+			{
+				// NOTE(rksouthee): Compiled code reads and writes the flags directly, so resolve any the interpreter
+				// left pending
+				if (ctx.flags_op != Context::Flags_op_none) set_flags(ctx, get_flags(ctx));
+				Budget budget{ max_instructions - result.instructions, max_clocks };
+				const std::uint32_t exit = block->code(&ctx, m_code_map.data(), ctx.memory.data(), &budget);
+				result.instructions = max_instructions - budget.instructions;
+				interpret_next = exit == s_exit_interpret;
+				if (exit < m_chain_exits.size()) chain(m_chain_exits[exit]);
+				continue;
+			}
+
+			const std::ptrdiff_t ip = ctx.ip;
+			const Run_result step = sim86::run(ctx, { limits.end, 1, limits.max_clocks });
+			if (ctx.segments[Segment_cs] == m_code_segment) mark_interpreted(ctx, ip);
+			result.instructions += step.instructions;
+			if (step.reason != Stop_reason::instruction_limit)
+			{
+				result.reason = step.reason;
+				break;
+			}
+		}
+
+		ctx.code_map = nullptr;
+		return result;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sim86
+{
+	// Translates guest basic blocks into x86-64 code, instructions the translator doesn't handle (and anything when
+	// the host isn't x86-64) are executed by the interpreter.
+	class Jit
+	{
+	private:
+		// What compiled code may still run before it returns, blocks jump straight into one another while it lasts
+		struct Budget
+		{
+			std::uint64_t instructions;
+			std::uint64_t clocks; // the total_clocks a block may not take the run past
+		};
+
+		using Block_fn = std::uint32_t (*)(Context* ctx, const std::uint8_t* code_map, std::uint8_t* memory, Budget* budget);
+
+		struct Block
+		{
+			Block_fn code;
+			const std::uint8_t* chain_entry; // where another block jumps in, with the guest registers still in the host ones
+			std::uint32_t instruction_count;
+			std::uint32_t max_clocks;
+		};
+
+		// A jump out of a block to the guest ip of another, patched to go straight into it once that is compiled
+		struct Chain_exit
+		{
+			std::uint8_t* patch;
+			std::ptrdiff_t ip;
+		};
+
+		struct Code_range
+		{
+			std::uint32_t first;
+			std::uint32_t last;
+		};
+
+		std::uint8_t* m_buffer = nullptr;
+		std::size_t m_buffer_size = 0;
+		std::size_t m_buffer_used = 0;
+		std::vector<Block> m_blocks;
+		std::vector<Chain_exit> m_chain_exits;
+		std::vector<std::int32_t> m_block_index;
+		std::vector<std::uint16_t> m_indexed; // the ips with an entry in m_block_index, so a flush only resets those
+		std::vector<std::uint8_t> m_code_map;
+		std::vector<Code_range> m_code_ranges; // what is marked in the code map, so a flush only clears those
+		std::uint16_t m_code_segment = 0; // the cs the blocks were compiled from
+
+		const Block* get_block(Context& ctx, std::ptrdiff_t ip, std::ptrdiff_t end);
+		std::int32_t compile(Context& ctx, std::ptrdiff_t ip, std::ptrdiff_t end);
+		void flush(Context& ctx);
+		void mark_code(std::uint32_t first, std::uint32_t last);
+		void mark_interpreted(const Context& ctx, std::ptrdiff_t ip);
+		void chain(const Chain_exit& exit);
+
+	public:
+		Jit();
+		~Jit();
+		Jit(const Jit&) = delete;
+		Jit& operator=(const Jit&) = delete;
+
+		[[nodiscard]] bool is_available() const { return m_buffer != nullptr; }
+		Run_result run(Context& ctx, const Limits& limits);
+	};
+}
@@ -1,14 +1,33 @@
+#include "batch.h"
+#include "cache.h"
+#include "counters.h"
+#include "debug.h"
+#include "disassembler.h"
+#include "estimate.h"
+#include "history.h"
+#include "jit.h"
+#include "mapped_file.h"
+#include "prefetch.h"
 #include "printer.h"
+#include "profile.h"
 #include "simulator.h"
+#include "trace.h"
+#include "writer.h"
 
 #include <cstdlib>
 #include <cstdint>
 
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <span>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include <cxxopts.hpp>
@@ -42,74 +61,437 @@ namespace
 		}
 	}
 
-	void write_file(const std::vector<std::uint8_t>& data, std::ostream& os, const cxxopts::ParseResult& options)
+	sim86::Mapped_file map_file(const std::string& file_name)
 	{
-		os << "bits 16" << std::endl;
+		try
+		{
+			return sim86::Mapped_file(file_name.c_str());
+		}
+		catch (const std::system_error&)
+		{
+			std::cerr << "unable to open " << file_name << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+	}
 
-		if (data.empty()) return;
-		if (data.size() > sizeof(sim86::Context::memory))
+	sim86::Cpu get_cpu(const cxxopts::ParseResult& options)
+	{
+		const std::string& name = options["cpu"].as<std::string>();
+		if (name == "8086") return sim86::Cpu_8086;
+		if (name == "8088") return sim86::Cpu_8088;
+		std::cerr << "unknown cpu " << name << ", expected 8086 or 8088" << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+
+	// Zero for one per core
+	unsigned get_thread_count(const cxxopts::ParseResult& options)
+	{
+		return options.count("threads") ? options["threads"].as<unsigned>() : 0;
+	}
+
+	const char* get_stop_reason_name(const sim86::Stop_reason reason)
+	{
+		switch (reason)
 		{
-			std::cerr << "file too large" << std::endl;
+		case sim86::Stop_reason::halt: return "halt";
+		case sim86::Stop_reason::end_of_program: return "end of program";
+		case sim86::Stop_reason::instruction_limit: return "instruction limit";
+		case sim86::Stop_reason::clock_limit: return "clock limit";
+		case sim86::Stop_reason::invalid_instruction: return "invalid instruction";
+		case sim86::Stop_reason::breakpoint: return "breakpoint";
+		case sim86::Stop_reason::watchpoint: return "watchpoint";
+		}
+		return "unknown";
+	}
+
+	// A hex address given to an option, which must be below limit
+	std::uint32_t parse_address(const std::string& text, const std::uint32_t limit)
+	{
+		std::uint32_t value = 0;
+		const char* const last = text.data() + text.size();
+		const auto [ptr, ec] = std::from_chars(text.data(), last, value, 16);
+		if (ec != std::errc() || ptr != last || text.empty() || value >= limit)
+		{
+			std::cerr << "expected a hex address below " << std::hex << limit << ", got '" << text << "'" << std::endl;
 			std::exit(EXIT_FAILURE);
 		}
+		return value;
+	}
 
-		sim86::Context ctx{};
-		const std::uint8_t* last = std::copy(data.begin(), data.end(), ctx.memory);
-		while (static_cast<std::size_t>(ctx.ip) < data.size())
+	// The breakpoints and watchpoints asked for, null when there are none
+	std::unique_ptr<sim86::Debug> get_debug(const cxxopts::ParseResult& options)
+	{
+		if (!options.count("break") && !options.count("watch")) return nullptr;
+		std::unique_ptr<sim86::Debug> debug = std::make_unique<sim86::Debug>();
+		if (options.count("break"))
+		{
+			for (const std::string& text : options["break"].as<std::vector<std::string>>())
+			{
+				debug->breakpoints[parse_address(text, sim86::segment_size)] = 1;
+			}
+		}
+		if (options.count("watch"))
 		{
-			const std::uint8_t* first = &ctx.memory[ctx.ip];
-			const sim86::PrintResult result = sim86::print(first, last);
-			ctx.ip += result.end - first;
-			std::string comment;
-			if (options.count("execute"))
+			const bool reads = options.count("watch-reads") != 0;
+			for (const std::string& text : options["watch"].as<std::vector<std::string>>())
 			{
-				sim86::execute(first, result.end, ctx);
-				if (options.count("showclocks"))
+				// An address or an inclusive range of them
+				const std::size_t dash = text.find('-');
+				const std::uint32_t first = parse_address(text.substr(0, dash), sim86::memory_size);
+				const std::uint32_t last = dash == std::string::npos ? first : parse_address(text.substr(dash + 1), sim86::memory_size);
+				if (last < first)
 				{
-					if (ctx.clocks == 0) os << " no clocks for " << std::hex << (int)first[0] << std::endl;
-					comment = std::format("Clocks: {:+d} = {:d}", ctx.clocks, ctx.total_clocks);
+					std::cerr << "the watched range '" << text << "' is empty" << std::endl;
+					std::exit(EXIT_FAILURE);
 				}
+				debug->watchpoints.push_back({ first, last + 1, reads });
 			}
+		}
+		return debug;
+	}
 
-			os << result.code;
-			if (!comment.empty())
+	// The cache asked for as its size, line size and ways, null when there isn't one
+	std::unique_ptr<sim86::Cache> get_cache(const cxxopts::ParseResult& options)
+	{
+		if (!options.count("cache")) return nullptr;
+		const std::vector<std::uint32_t>& geometry = options["cache"].as<std::vector<std::uint32_t>>();
+		if (geometry.size() != 3 || !sim86::Cache::is_valid(geometry[0], geometry[1], geometry[2]))
+		{
+			std::cerr << "expected the cache as size,line size,ways, powers of two with size at least line size * ways" << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		return std::make_unique<sim86::Cache>(geometry[0], geometry[1], geometry[2]);
+	}
+
+	// Prints a line per file with how it stopped and its final registers
+	void execute_batch(const std::vector<std::string>& file_names, std::ostream& os, const cxxopts::ParseResult& options)
+	{
+		std::vector<sim86::Mapped_file> programs;
+		programs.reserve(file_names.size());
+		std::vector<sim86::Batch_job> jobs(file_names.size());
+		const sim86::Cpu cpu = get_cpu(options);
+		for (std::size_t i = 0; i < file_names.size(); ++i)
+		{
+			programs.push_back(map_file(file_names[i]));
+			if (programs.back().size() > sim86::memory_size)
 			{
-				os << " ; " << comment;
+				std::cerr << file_names[i] << ": file too large" << std::endl;
+				std::exit(EXIT_FAILURE);
 			}
-			os << std::endl;
+			jobs[i].program = programs.back().bytes();
+			jobs[i].cpu = cpu;
+			if (options.count("max-instructions")) jobs[i].limits.max_instructions = options["max-instructions"].as<std::uint64_t>();
+			if (options.count("max-clocks")) jobs[i].limits.max_clocks = options["max-clocks"].as<std::uint64_t>();
+		}
+
+		const std::vector<sim86::Batch_result> results = sim86::run_batch(jobs, get_thread_count(options));
+		sim86::Writer writer(os);
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			const sim86::Batch_result& result = results[i];
+			const std::uint16_t* r = result.registers;
+			char* out = writer.reserve(file_names[i].size() + 256);
+			out = std::format_to(out, "{}: {}, {} instructions, {} clocks, ip: {:x}", file_names[i],
+				get_stop_reason_name(result.run.reason), result.run.instructions, result.total_clocks, result.ip);
+			out = std::format_to(out, " ax: {:x} cx: {:x} dx: {:x} bx: {:x} sp: {:x} bp: {:x} si: {:x} di: {:x} flags: {:x}\n",
+				r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], result.flags);
+			writer.commit(out);
+		}
+	}
+
+	void print_state(std::ostream& os, const std::ptrdiff_t ip, const std::uint16_t* registers, const std::uint16_t* segments, const std::uint16_t flags)
+	{
+		os << "ip: " << std::hex << ip << '\n';
+		static const char* const s_names[8] = {
+			"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"
+		};
+		for (std::size_t i = 0; i < std::size(s_names); ++i)
+		{
+			os << s_names[i] << ": " << std::hex << registers[i] << '\n';
+		}
+		// NOTE(rksouthee): Segment registers are only shown once a program has loaded one
+		static const char* const s_segment_names[4] = {
+			"es", "cs", "ss", "ds"
+		};
+		for (std::size_t i = 0; i < std::size(s_segment_names); ++i)
+		{
+			if (segments[i]) os << s_segment_names[i] << ": " << std::hex << segments[i] << '\n';
 		}
 
-		if (options.count("execute"))
+		static const struct
 		{
-			std::cout << "ip: " << std::hex << ctx.ip << std::endl;
-			static const char* const s_names[8] = {
-				"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"
+			sim86::Context::Flags flag;
+			char name;
+		} s_flags[] = {
+			{ sim86::Context::Flags_carry, 'C' },
+			{ sim86::Context::Flags_parity, 'P' },
+			{ sim86::Context::Flags_auxiliary, 'A' },
+			{ sim86::Context::Flags_zero, 'Z' },
+			{ sim86::Context::Flags_sign, 'S' },
+			{ sim86::Context::Flags_trap, 'T' },
+			{ sim86::Context::Flags_interrupt, 'I' },
+			{ sim86::Context::Flags_direction, 'D' },
+			{ sim86::Context::Flags_overflow, 'O' },
+		};
+		os << "flags: ";
+		for (const auto& f : s_flags)
+		{
+			os << ((flags & f.flag) ? f.name : '-');
+		}
+		os << '\n';
+	}
+
+	// NOTE(rksouthee): The dump is an image of the whole address space, but only the runs of pages marked in
+	// pages are written and the file is left sparse where the others, which are all zero, would be.
+	void dump_memory(const std::uint8_t* memory, const sim86::Page_set& pages)
+	{
+		{
+			std::ofstream dump_file("dump.data", std::ios::out | std::ios::binary | std::ios::trunc);
+			const auto write_run = [&dump_file, memory](const std::size_t first, const std::size_t last)
+			{
+				dump_file.seekp(static_cast<std::streamoff>(first * sim86::snapshot_page_size));
+				dump_file.write(reinterpret_cast<const char*>(memory + first * sim86::snapshot_page_size),
+					static_cast<std::streamsize>((last - first) * sim86::snapshot_page_size));
 			};
-			for (std::size_t i = 0; i < std::size(ctx.registers); ++i)
+			std::size_t first = 0;
+			std::size_t last = 0;
+			pages.for_each([&](const std::size_t page)
 			{
-				os << s_names[i] << ": " << std::hex << ctx.registers[i] << std::endl;
-			}
+				if (page != last)
+				{
+					if (first != last) write_run(first, last);
+					first = page;
+				}
+				last = page + 1;
+			});
+			if (first != last) write_run(first, last);
 		}
+		std::filesystem::resize_file("dump.data", sim86::memory_size);
+	}
 
-		const char flags[] = "ZS";
-		os << "flags: ";
-		for (std::size_t i = 0; i < std::size(flags) - 1; ++i)
+	void mark_nonzero_pages(const std::uint8_t* memory, sim86::Page_set& pages)
+	{
+		pages.clear();
+		for (std::size_t page = 0; page < sim86::page_count; ++page)
+		{
+			const std::uint8_t* const first = memory + page * sim86::snapshot_page_size;
+			if (std::any_of(first, first + sim86::snapshot_page_size, [](const std::uint8_t b) { return b != 0; })) pages.insert(page);
+		}
+	}
+
+	// Rebuilds the state after a number of steps of a recorded trace, the last one by default
+	void replay(const std::string& file_name, std::ostream& os, const cxxopts::ParseResult& options)
+	{
+		std::ifstream file(file_name, std::ios::in | std::ios::binary);
+		sim86::Trace_reader reader(file);
+		const std::unique_ptr<sim86::Trace_state> state = std::make_unique<sim86::Trace_state>();
+		if (!reader.start(*state))
+		{
+			std::cerr << file_name << ": not a trace" << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+		const std::uint64_t step = options.count("step") ? options["step"].as<std::uint64_t>() : UINT64_MAX;
+		while (state->steps < step && reader.next(*state))
+		{
+		}
+		if (step != UINT64_MAX && state->steps < step)
+		{
+			std::cerr << "the trace ends after " << std::dec << state->steps << " steps" << std::endl;
+		}
+
+		os << "step: " << std::dec << state->steps << '\n';
+		os << "clocks: " << std::dec << state->total_clocks << '\n';
+		print_state(os, state->ip, state->registers, state->segments, state->flags);
+		if (options.count("dump"))
+		{
+			// A trace doesn't say which pages were written, those that aren't zero are
+			sim86::Page_set pages;
+			mark_nonzero_pages(state->memory, pages);
+			dump_memory(state->memory, pages);
+		}
+	}
+
+	void disassemble(const std::span<const std::uint8_t> data, std::ostream& os, const cxxopts::ParseResult& options)
+	{
+		sim86::Writer writer(os);
+		writer.write("bits 16\n");
+		sim86::disassemble(data, writer, get_thread_count(options));
+	}
+
+	void estimate(const std::span<const std::uint8_t> data, std::ostream& os, const cxxopts::ParseResult& options)
+	{
+		const sim86::Cpu cpu = get_cpu(options);
+		sim86::print_estimate(os, data, sim86::estimate_clocks(data, cpu), cpu);
+	}
+
+	void execute(const std::span<const std::uint8_t> data, std::ostream& os, const cxxopts::ParseResult& options)
+	{
+		os << "bits 16\n";
+
+		if (data.empty()) return;
+		if (data.size() > sim86::memory_size)
+		{
+			std::cerr << "file too large" << std::endl;
+			std::exit(EXIT_FAILURE);
+		}
+
+		// NOTE(rksouthee): The context carries the decoded instruction cache and is too large for the stack. The
+		// program is loaded at address 0 with every segment register zero, it executes from the first segment and
+		// reaches the rest of itself through the others.
+		const std::unique_ptr<sim86::Context> p_ctx = std::make_unique<sim86::Context>();
+		sim86::Context& ctx = *p_ctx;
+		std::copy(data.begin(), data.end(), ctx.memory.begin());
+		const std::size_t loaded_pages = (data.size() + sim86::snapshot_page_size - 1) / sim86::snapshot_page_size;
+		for (std::size_t page = 0; page < loaded_pages; ++page) ctx.dirty_pages.insert(page);
+		ctx.cpu = get_cpu(options);
+		sim86::Writer writer(os);
+		sim86::Limits limits{};
+		limits.end = static_cast<std::ptrdiff_t>(std::min(data.size(), sim86::segment_size));
+		if (options.count("max-instructions")) limits.max_instructions = options["max-instructions"].as<std::uint64_t>();
+		if (options.count("max-clocks")) limits.max_clocks = options["max-clocks"].as<std::uint64_t>();
+
+		std::ofstream record_file;
+		std::unique_ptr<sim86::Trace_recorder> recorder;
+		if (options.count("record"))
+		{
+			record_file.open(options["record"].as<std::string>(), std::ios::out | std::ios::binary);
+			recorder = std::make_unique<sim86::Trace_recorder>(record_file, ctx);
+		}
+
+		std::unique_ptr<sim86::Profile> profile;
+		if (options.count("profile"))
+		{
+			profile = std::make_unique<sim86::Profile>();
+			ctx.profile = profile.get();
+		}
+
+#if SIM86_COUNTERS
+		std::unique_ptr<sim86::Counters> counters;
+		if (options.count("counters"))
 		{
-			if (ctx.flags & (1 << i))
+			counters = std::make_unique<sim86::Counters>();
+			ctx.counters = counters.get();
+		}
+#endif
+
+		const std::unique_ptr<sim86::Debug> debug = get_debug(options);
+		ctx.debug = debug.get();
+
+		// NOTE(rksouthee): Going back happens once the run stops, for a breakpoint or a limit say
+		std::unique_ptr<sim86::History> history;
+		const std::ptrdiff_t run_back_to = options.count("run-back-to") ? static_cast<std::ptrdiff_t>(parse_address(options["run-back-to"].as<std::string>(), sim86::segment_size)) : -1;
+		if (options.count("step-back") || run_back_to >= 0)
+		{
+			history = std::make_unique<sim86::History>(ctx, limits.end);
+			ctx.history = history.get();
+		}
+
+		std::unique_ptr<sim86::Prefetch_model> prefetch;
+		if (options.count("prefetch")) prefetch = std::make_unique<sim86::Prefetch_model>(ctx);
+
+		const std::unique_ptr<sim86::Cache> cache = get_cache(options);
+		ctx.cache = cache.get();
+
+		sim86::Trace_fn trace;
+		const bool show_instructions = !options.count("quiet");
+		if (show_instructions || recorder || prefetch || history || cache)
+		{
+			const bool show_clocks = options.count("showclocks") != 0;
+			trace = [&writer, &recorder, &prefetch, &history, &cache, show_instructions, show_clocks](const sim86::Context& ctx, std::ptrdiff_t ip, const sim86::Instruction& inst)
 			{
-				os << flags[i];
-			}
-			else
+				const std::uint64_t prefetch_clocks = prefetch ? prefetch->clocks() : 0;
+				if (prefetch) prefetch->step(ctx, ip, inst);
+				if (recorder) recorder->record(ctx, inst);
+				if (history) history->record();
+				if (cache) cache->step(ctx, ip, inst);
+				if (!show_instructions) return;
+
+				char* out = writer.reserve(160);
+				if (show_clocks && ctx.clocks == 0) out = std::format_to(out, " no clocks for {:x}\n", inst.opcode);
+				out = sim86::print(inst, out);
+				if (show_clocks)
+				{
+					out = std::format_to(out, " ; Clocks: {:+d} = {:d}", ctx.clocks, ctx.total_clocks);
+					if (ctx.ea_clocks || ctx.penalty_clocks)
+					{
+						out = std::format_to(out, " ({:d}", ctx.clocks - ctx.ea_clocks - ctx.penalty_clocks);
+						if (ctx.ea_clocks) out = std::format_to(out, " + {:d}ea", ctx.ea_clocks);
+						if (ctx.penalty_clocks) out = std::format_to(out, " + {:d}p", ctx.penalty_clocks);
+						*out++ = ')';
+					}
+					if (prefetch) out = std::format_to(out, " | Prefetch: {:+d} = {:d}", prefetch->clocks() - prefetch_clocks, prefetch->clocks());
+				}
+				*out++ = '\n';
+				writer.commit(out);
+			};
+		}
+		sim86::Run_result run_result;
+		if (options.count("jit") && !trace)
+		{
+			const std::unique_ptr<sim86::Jit> jit = std::make_unique<sim86::Jit>();
+			run_result = jit->run(ctx, limits);
+		}
+		else
+		{
+			run_result = sim86::run(ctx, limits, trace);
+		}
+		if (run_result.reason == sim86::Stop_reason::invalid_instruction)
+		{
+			std::cerr << "invalid instruction at " << std::hex << ctx.ip << std::endl;
+		}
+		else if (run_result.reason == sim86::Stop_reason::breakpoint)
+		{
+			std::cerr << "breakpoint at " << std::hex << ctx.ip << std::endl;
+		}
+		else if (run_result.reason == sim86::Stop_reason::watchpoint)
+		{
+			std::cerr << "watchpoint at " << std::hex << debug->hit_address << " touched by the instruction at " << debug->hit_ip << std::endl;
+		}
+		writer.flush();
+		if (recorder) recorder->flush();
+
+		if (history)
+		{
+			if (options.count("step-back")) history->step_back(options["step-back"].as<std::uint64_t>());
+			if (run_back_to >= 0 && !history->run_back_to(run_back_to))
 			{
-				os << '-';
+				std::cerr << "the history doesn't reach back to " << std::hex << run_back_to << std::endl;
 			}
+			os << "step: " << std::dec << history->steps() << '\n';
+		}
+
+		print_state(os, ctx.ip, ctx.registers, ctx.segments, sim86::get_flags(ctx));
+		if (prefetch)
+		{
+			os << "clocks: " << std::dec << ctx.total_clocks << '\n';
+			os << "prefetch clocks: " << prefetch->clocks() << " (" << prefetch->queue_stalls() << " waiting for the queue, "
+				<< prefetch->bus_stalls() << " waiting for the bus, " << prefetch->transfers() << " operand transfers)\n";
+		}
+		if (profile)
+		{
+			os << '\n';
+			sim86::print_profile(os, ctx, *profile);
+		}
+		if (cache)
+		{
+			os << '\n';
+			sim86::print_cache(os, ctx, *cache);
 		}
-		os << std::endl;
+
+#if SIM86_COUNTERS
+		if (counters)
+		{
+			std::ofstream counters_file(options["counters"].as<std::string>(), std::ios::out | std::ios::trunc);
+			sim86::write_counters_csv(counters_file, *counters);
+		}
+#endif
 
 		if (options.count("dump"))
 		{
-			std::ofstream dump_file("dump.data", std::ios::out | std::ios::binary);
-			dump_file.write(reinterpret_cast<const char*>(ctx.memory), std::size(ctx.memory));
+			// The checkpoints of the history take snapshots, which leave only the pages written since the last
+			// of them marked
+			if (history) mark_nonzero_pages(ctx.memory.data(), ctx.dirty_pages);
+			dump_memory(ctx.memory.data(), ctx.dirty_pages);
 		}
 	}
 }
@@ -121,16 +503,36 @@ int main(int argc, char** argv)
 		("file", "the binary file to decode", cxxopts::value<std::string>())
 		("o,output", "write output to file", cxxopts::value<std::string>())
 		("execute", "Execute the listing")
-		("dump", "Dump the memory to a file")
+		("quiet", "Don't print each instruction as it is executed")
+		("jit", "Translate the listing to host code when executing quietly")
+		("max-instructions", "Stop executing after this many instructions", cxxopts::value<std::uint64_t>())
+		("max-clocks", "Stop executing once this many clocks have elapsed", cxxopts::value<std::uint64_t>())
+		("dump", "Dump the memory to a sparse file, with only the pages the program loaded or wrote in it")
+		("batch", "Execute each of these files quietly, in parallel", cxxopts::value<std::vector<std::string>>())
+		("threads", "The number of threads for --batch and for disassembling, one per core by default", cxxopts::value<unsigned>())
 		("showclocks", "Show the number of clocks taken")
+		("prefetch", "Estimate the clocks with the prefetch queue and the bus modelled")
+		("cpu", "The processor to time instructions for, 8086 or 8088", cxxopts::value<std::string>()->default_value("8086"))
+		("estimate", "Estimate the best and worst clocks of each block and loop without executing")
+		("profile", "Show the executed instructions with their counts and clocks, hottest blocks first")
+		("cache", "Model a set associative cache given as size,line size,ways and show the hits and misses of each instruction", cxxopts::value<std::vector<std::uint32_t>>())
+		("record", "Record a binary trace of the execution to a file", cxxopts::value<std::string>())
+		("replay", "Show the state recorded in a trace file")
+		("step", "The step of the trace to replay up to, the last by default", cxxopts::value<std::uint64_t>())
+		("break", "Stop executing before the instruction at any of these hex offsets", cxxopts::value<std::vector<std::string>>())
+		("watch", "Stop executing after an instruction writes to any of these hex addresses or first-last ranges", cxxopts::value<std::vector<std::string>>())
+		("watch-reads", "Stop for reads of the watched memory as well")
+		("step-back", "Once execution stops, go back this many instructions", cxxopts::value<std::uint64_t>())
+		("run-back-to", "Once execution stops, go back to the last time the instruction at this hex offset was about to execute", cxxopts::value<std::string>())
+		;
+#if SIM86_COUNTERS
+	options.add_options()
+		("counters", "Write the counts of the opcodes, effective addresses, jumps and memory traffic to a CSV file", cxxopts::value<std::string>())
 		;
+#endif
 	options.parse_positional({ "file" });
 
 	const cxxopts::ParseResult& result = parse(options, argc, argv);
-	const std::string& file_name = get_file_name(result);
-	std::ifstream file(file_name, std::ios::in | std::ios::binary);
-	using I = typename std::istreambuf_iterator<char>;
-	const std::vector<std::uint8_t> data(I{file}, I{});
 
 	std::ofstream outfile;
 	std::ostream* p_out;
@@ -145,6 +547,31 @@ int main(int argc, char** argv)
 		p_out = &std::cout;
 	}
 
-	write_file(data, *p_out, result);
+	if (result.count("batch"))
+	{
+		execute_batch(result["batch"].as<std::vector<std::string>>(), *p_out, result);
+		return EXIT_SUCCESS;
+	}
+
+	if (result.count("replay"))
+	{
+		replay(get_file_name(result), *p_out, result);
+		return EXIT_SUCCESS;
+	}
+
+	// NOTE(rksouthee): The listing is decoded, or copied into the memory of the guest, straight from the mapping
+	const sim86::Mapped_file file = map_file(get_file_name(result));
+	if (result.count("execute"))
+	{
+		execute(file.bytes(), *p_out, result);
+	}
+	else if (result.count("estimate"))
+	{
+		estimate(file.bytes(), *p_out, result);
+	}
+	else
+	{
+		disassemble(file.bytes(), *p_out, result);
+	}
 	return EXIT_SUCCESS;
 }
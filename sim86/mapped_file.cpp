@@ -0,0 +1,115 @@
+#include "mapped_file.h"
+
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace
+{
+#ifdef _WIN32
+	[[noreturn]] void throw_last_error(const char* what)
+	{
+		throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+	}
+#else
+	[[noreturn]] void throw_last_error(const char* what)
+	{
+		throw std::system_error(errno, std::generic_category(), what);
+	}
+#endif
+
+	void unmap(const std::uint8_t* const data, const std::size_t size)
+	{
+		if (!data) return;
+#ifdef _WIN32
+		(void)size;
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<std::uint8_t*>(data), size);
+#endif
+	}
+}
+
+namespace sim86
+{
+	Mapped_file::Mapped_file(const char* const path)
+	{
+#ifdef _WIN32
+		const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) throw_last_error(path);
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+		{
+			CloseHandle(file);
+			throw_last_error(path);
+		}
+		m_size = static_cast<std::size_t>(size.QuadPart);
+		if (m_size == 0)
+		{
+			CloseHandle(file);
+			return;
+		}
+		// The view keeps the file and the mapping open once their handles are closed
+		const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping) throw_last_error(path);
+		m_data = static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!m_data) throw_last_error(path);
+#else
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0) throw_last_error(path);
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			const int error = errno;
+			close(fd);
+			throw std::system_error(error, std::generic_category(), path);
+		}
+		m_size = static_cast<std::size_t>(st.st_size);
+		if (m_size == 0)
+		{
+			close(fd);
+			return;
+		}
+		// The mapping keeps the file open once the descriptor is closed
+		void* const data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		const int error = errno;
+		close(fd);
+		if (data == MAP_FAILED) throw std::system_error(error, std::generic_category(), path);
+		m_data = static_cast<const std::uint8_t*>(data);
+		madvise(data, m_size, MADV_SEQUENTIAL);
+#endif
+	}
+
+	Mapped_file::~Mapped_file()
+	{
+		unmap(m_data, m_size);
+	}
+
+	Mapped_file::Mapped_file(Mapped_file&& other) noexcept
+		: m_data(std::exchange(other.m_data, nullptr))
+		, m_size(std::exchange(other.m_size, 0))
+	{
+	}
+
+	Mapped_file& Mapped_file::operator=(Mapped_file&& other) noexcept
+	{
+		if (this != &other)
+		{
+			unmap(m_data, m_size);
+			m_data = std::exchange(other.m_data, nullptr);
+			m_size = std::exchange(other.m_size, 0);
+		}
+		return *this;
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace sim86
+{
+	// NOTE(rksouthee): A file mapped read only, a guest binary is decoded or copied into the memory of the guest
+	// straight from the pages the host already caches for it rather than being read into a buffer first.
+	class Mapped_file
+	{
+	private:
+		const std::uint8_t* m_data = nullptr; // null for an empty file
+		std::size_t m_size = 0;
+
+	public:
+		Mapped_file() = default;
+		// Throws std::system_error when the file can't be opened or mapped
+		explicit Mapped_file(const char* path);
+		~Mapped_file();
+		Mapped_file(Mapped_file&& other) noexcept;
+		Mapped_file& operator=(Mapped_file&& other) noexcept;
+
+		const std::uint8_t* data() const { return m_data; }
+		std::size_t size() const { return m_size; }
+		const std::uint8_t* begin() const { return m_data; }
+		const std::uint8_t* end() const { return m_data + m_size; }
+		std::span<const std::uint8_t> bytes() const { return { m_data, m_size }; }
+	};
+}
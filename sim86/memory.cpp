@@ -0,0 +1,63 @@
+#include "memory.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	// NOTE(rksouthee): Guest programs aren't trusted, so memory is followed by a page that faults on any access rather
+	// than by whatever the host has there. Nothing in range of a guest address goes past the end of memory.
+	constexpr std::size_t s_guard_size = 4096;
+	constexpr std::size_t s_reserved_size = sim86::memory_size + s_guard_size;
+}
+
+namespace sim86
+{
+	Memory::Memory()
+	{
+#ifdef _WIN32
+		void* data = VirtualAlloc(nullptr, s_reserved_size, MEM_RESERVE, PAGE_NOACCESS);
+		if (data && !VirtualAlloc(data, memory_size, MEM_COMMIT, PAGE_READWRITE))
+		{
+			VirtualFree(data, 0, MEM_RELEASE);
+			data = nullptr;
+		}
+#else
+		void* data = mmap(nullptr, s_reserved_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (data == MAP_FAILED) data = nullptr;
+		if (data && mprotect(static_cast<std::uint8_t*>(data) + memory_size, s_guard_size, PROT_NONE) != 0)
+		{
+			munmap(data, s_reserved_size);
+			data = nullptr;
+		}
+#endif
+		if (!data) throw std::bad_alloc();
+		m_data = static_cast<std::uint8_t*>(data);
+	}
+
+	Memory::~Memory()
+	{
+#ifdef _WIN32
+		VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+		munmap(m_data, s_reserved_size);
+#endif
+	}
+
+	void Memory::clear()
+	{
+#ifdef _WIN32
+		if (VirtualFree(m_data, memory_size, MEM_DECOMMIT) && VirtualAlloc(m_data, memory_size, MEM_COMMIT, PAGE_READWRITE)) return;
+#else
+		// Private anonymous pages read as zero again once they are dropped
+		if (madvise(m_data, memory_size, MADV_DONTNEED) == 0) return;
+#endif
+		std::memset(m_data, 0, memory_size);
+	}
+}
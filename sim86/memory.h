@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sim86
+{
+	// The 20 address lines of the 8086 reach a megabyte
+	constexpr std::size_t memory_size = 0x100000;
+
+	// NOTE(rksouthee): The whole address space is reserved up front, the host only backs a page of it once the guest
+	// writes there and pages that are only read stay zero without being committed. A guest pays for the memory it
+	// touches rather than for all it can address.
+	class Memory
+	{
+	private:
+		std::uint8_t* m_data;
+
+	public:
+		Memory();
+		~Memory();
+		Memory(const Memory&) = delete;
+		Memory& operator=(const Memory&) = delete;
+
+		static constexpr std::size_t size() { return memory_size; }
+
+		std::uint8_t* data() { return m_data; }
+		const std::uint8_t* data() const { return m_data; }
+		std::uint8_t* begin() { return m_data; }
+		const std::uint8_t* begin() const { return m_data; }
+		std::uint8_t* end() { return m_data + memory_size; }
+		const std::uint8_t* end() const { return m_data + memory_size; }
+		std::uint8_t& operator[](const std::size_t addr) { return m_data[addr]; }
+		const std::uint8_t& operator[](const std::size_t addr) const { return m_data[addr]; }
+
+		// Zeroes the whole address space, handing the pages backing it back to the host
+		void clear();
+	};
+}
@@ -0,0 +1,86 @@
+#include "prefetch.h"
+
+#include <algorithm>
+
+namespace
+{
+	constexpr std::uint32_t s_bus_cycle_clocks = 4;
+
+	// The 8086 fetches a word at a time and only waits for room for one, the 8088 a byte
+	std::uint32_t get_fetch_size(const sim86::Cpu cpu)
+	{
+		return cpu == sim86::Cpu_8088 ? 1 : 2;
+	}
+}
+
+namespace sim86
+{
+	Prefetch_model::Prefetch_model(const Context& ctx) :
+		m_cpu(ctx.cpu),
+		m_queue_size(ctx.cpu == Cpu_8088 ? 4 : 6),
+		m_fetch_address(static_cast<std::uint16_t>(ctx.ip))
+	{
+	}
+
+	void Prefetch_model::fetch()
+	{
+		// NOTE(rksouthee): A word fetch from an odd address only brings in the byte there, the next is aligned
+		const std::uint32_t size = get_fetch_size(m_cpu) == 2 && (m_fetch_address & 1) ? 1 : get_fetch_size(m_cpu);
+		m_bus_free += s_bus_cycle_clocks;
+		m_queued += size;
+		m_last_fetch = size;
+		m_fetch_address = static_cast<std::uint16_t>(m_fetch_address + size);
+	}
+
+	void Prefetch_model::prefetch(const std::uint64_t until)
+	{
+		while (m_bus_free < until && m_queue_size - m_queued >= get_fetch_size(m_cpu)) fetch();
+		// The queue is full, nothing more is fetched until the execution unit takes from it
+		m_bus_free = std::max(m_bus_free, until);
+	}
+
+	void Prefetch_model::step(const Context& ctx, const std::ptrdiff_t ip, const Instruction& inst)
+	{
+		std::uint64_t start = m_clocks;
+		prefetch(start);
+		if (static_cast<std::uint16_t>(m_fetch_address - m_queued) != ip)
+		{
+			// The queue holds what followed a jump, the bus cycle under way still has to complete
+			m_queued = 0;
+			m_last_fetch = 0;
+			m_fetch_address = static_cast<std::uint16_t>(ip);
+		}
+
+		if (m_queued < inst.size)
+		{
+			while (m_queued < inst.size) fetch();
+			start = m_bus_free;
+		}
+		else if (m_queued - m_last_fetch < inst.size)
+		{
+			// The last of the instruction is still being fetched
+			start = std::max(start, m_bus_free);
+		}
+		m_queue_stalls += start - m_clocks;
+		m_queued -= inst.size;
+		m_last_fetch = std::min(m_last_fetch, m_queued);
+
+		std::uint64_t end = start + ctx.clocks;
+		// A string instruction with a rep prefix transfers its operands on every repetition
+		const Timing timing = get_timing(inst);
+		const std::uint32_t transfers = timing.repeat_clocks != 0 ? timing.transfers * ctx.repetitions : timing.transfers;
+		if (transfers != 0)
+		{
+			// NOTE(rksouthee): The operand transfers are taken together once the effective address is known
+			const std::uint64_t request = start + ctx.ea_clocks;
+			prefetch(request);
+			const std::uint64_t wait = m_bus_free - request;
+			m_bus_stalls += wait;
+			end += wait;
+			m_bus_free += transfers * s_bus_cycle_clocks + ctx.penalty_clocks;
+			m_transfers += transfers;
+			m_last_fetch = 0;
+		}
+		m_clocks = end;
+	}
+}
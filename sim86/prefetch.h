@@ -0,0 +1,49 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sim86
+{
+	// NOTE(rksouthee): Estimates the clocks of a run with the execution unit and the bus interface unit working in
+	// parallel. The bus interface unit fills the prefetch queue whenever it has room for a fetch and the bus is
+	// free, the execution unit waits for it when the bytes of the next instruction haven't arrived or when it wants
+	// the bus for an operand while a fetch is under way. The queue is emptied when ip moves anywhere but the next
+	// instruction. The clocks of the execution unit are those the simulator charges, which for the jumps already
+	// include some of the cost of refilling the queue, so taken jumps come out slightly pessimistic.
+	class Prefetch_model
+	{
+	private:
+		Cpu m_cpu;
+		std::uint32_t m_queue_size;
+		std::uint16_t m_fetch_address; // of the next byte to fetch
+		std::uint32_t m_queued = 0; // bytes in the queue once the last bus cycle completes
+		std::uint32_t m_last_fetch = 0; // bytes the last bus cycle brought in, zero for an operand transfer
+		std::uint64_t m_bus_free = 0; // when the last bus cycle completes
+		std::uint64_t m_clocks = 0; // when the execution unit finished the last instruction
+		std::uint64_t m_queue_stalls = 0;
+		std::uint64_t m_bus_stalls = 0;
+		std::uint64_t m_transfers = 0;
+
+		void fetch();
+		// Lets the bus interface unit fetch ahead until the execution unit next needs it
+		void prefetch(std::uint64_t until);
+
+	public:
+		// Starts with an empty queue at the ip of ctx, timed for its cpu
+		explicit Prefetch_model(const Context& ctx);
+
+		// Call after each instruction, as a Trace_fn
+		void step(const Context& ctx, std::ptrdiff_t ip, const Instruction& inst);
+
+		[[nodiscard]] std::uint64_t clocks() const { return m_clocks; }
+		// Clocks the execution unit spent waiting for instruction bytes
+		[[nodiscard]] std::uint64_t queue_stalls() const { return m_queue_stalls; }
+		// Clocks the execution unit spent waiting for a fetch to release the bus
+		[[nodiscard]] std::uint64_t bus_stalls() const { return m_bus_stalls; }
+		// Bus cycles spent transferring operands rather than fetching instructions
+		[[nodiscard]] std::uint64_t transfers() const { return m_transfers; }
+	};
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "decoder.h"
+
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -11,5 +14,15 @@ namespace sim86
 		const std::uint8_t* end;
 	};
 
+	// Longest text print writes for a single instruction, e.g. "lock repne add word [es:bp+si-0x8000],byte +0xff"
+	constexpr std::size_t max_print_size = 64;
+
+	// Writes the instruction to out without allocating, out must have room for max_print_size characters
+	char* print(const Instruction& inst, char* out);
+	std::string print(const Instruction& inst);
+	// The mnemonic of an operation, the string instructions without their size
+	const char* get_operation_name(Operation op);
+	// The registers an r/m effective address formula adds, that of r/m 6 with mod 0 is a direct address instead
+	const char* get_ea_name(std::uint8_t r_m);
 	PrintResult print(const std::uint8_t* first, const std::uint8_t* last);
 }
@@ -0,0 +1,102 @@
+#include "profile.h"
+#include "printer.h"
+#include "writer.h"
+
+#include <algorithm>
+#include <format>
+
+namespace
+{
+	// The instruction as executed, or as the memory now decodes if it was invalidated since
+	sim86::Instruction get_instruction(const sim86::Context& ctx, const std::ptrdiff_t ip)
+	{
+		const sim86::Instruction& inst = ctx.decoded[ip].instruction;
+		if (inst.size != 0) return inst;
+		const std::uint32_t addr = sim86::get_physical_address(ctx.segments[sim86::Segment_cs], static_cast<std::uint16_t>(ip));
+		return sim86::decode(ctx.memory.data() + addr, ctx.memory.end());
+	}
+
+	bool ends_block(const sim86::Operation op)
+	{
+		switch (op)
+		{
+		case sim86::Operation_hlt:
+		case sim86::Operation_call:
+		case sim86::Operation_jmp:
+		case sim86::Operation_ret:
+		case sim86::Operation_retf:
+		case sim86::Operation_int:
+		case sim86::Operation_int3:
+		case sim86::Operation_into:
+		case sim86::Operation_iret:
+			return true;
+		default:
+			// The conditional jumps, the loops and jcxz
+			return op >= sim86::Operation_jo && op <= sim86::Operation_jcxz;
+		}
+	}
+}
+
+namespace sim86
+{
+	std::vector<Profile_block> get_hot_blocks(const Context& ctx, const Profile& profile)
+	{
+		// NOTE(rksouthee): A jump into the middle of a block only shows as a change in the count, so a block that
+		// is entered at two places as often as it is entered at its start is not split.
+		std::vector<Profile_block> blocks;
+		bool open = false;
+		for (std::ptrdiff_t ip = 0; ip < static_cast<std::ptrdiff_t>(std::size(profile.counters)); ++ip)
+		{
+			const Profile_counters& counters = profile.counters[ip];
+			if (counters.count == 0) continue;
+			if (!open || blocks.back().last != ip || blocks.back().count != counters.count)
+			{
+				blocks.push_back({ ip, ip, counters.count, 0, 0 });
+			}
+			Profile_block& block = blocks.back();
+			const Instruction inst = get_instruction(ctx, ip);
+			block.last = ip + inst.size;
+			block.clocks += counters.clocks;
+			block.ea_clocks += counters.ea_clocks;
+			open = !ends_block(inst.operation);
+		}
+
+		std::stable_sort(blocks.begin(), blocks.end(), [](const Profile_block& a, const Profile_block& b)
+		{
+			return a.clocks > b.clocks;
+		});
+		return blocks;
+	}
+
+	void print_profile(std::ostream& os, const Context& ctx, const Profile& profile)
+	{
+		const std::vector<Profile_block> blocks = get_hot_blocks(ctx, profile);
+		std::uint64_t total_clocks = 0;
+		for (const Profile_block& block : blocks) total_clocks += block.clocks;
+		const double scale = total_clocks ? 100.0 / static_cast<double>(total_clocks) : 0.0;
+
+		Writer writer(os);
+		char* out = writer.reserve(128);
+		out = std::format_to(out, "; {} clocks in {} blocks\n", total_clocks, blocks.size());
+		out = std::format_to(out, "{:<4} {:>12} {:>12} {:>12}\n", "; ip", "count", "clocks", "ea clocks");
+		writer.commit(out);
+		for (const Profile_block& block : blocks)
+		{
+			out = writer.reserve(128);
+			out = std::format_to(out, "\n; {:04x}-{:04x}: {} clocks ({:.1f}%), {} ea clocks\n", block.first,
+				block.last, block.clocks, static_cast<double>(block.clocks) * scale, block.ea_clocks);
+			writer.commit(out);
+			for (std::ptrdiff_t ip = block.first; ip < block.last;)
+			{
+				const Instruction inst = get_instruction(ctx, ip);
+				const Profile_counters& counters = profile.counters[ip];
+				out = writer.reserve(max_print_size + 64);
+				out = std::format_to(out, "{:04x} {:>12} {:>12} {:>12}  ", ip, counters.count, counters.clocks, counters.ea_clocks);
+				out = print(inst, out);
+				*out++ = '\n';
+				writer.commit(out);
+				ip += inst.size;
+			}
+		}
+	}
+}
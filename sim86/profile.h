@@ -0,0 +1,40 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace sim86
+{
+	struct Profile_counters
+	{
+		std::uint64_t count; // times the instruction at the address was executed
+		std::uint64_t clocks;
+		std::uint64_t ea_clocks; // of clocks, those spent calculating the effective address
+	};
+
+	// Counters for every offset in the code segment, set Context::profile to one to have run fill it in
+	struct Profile
+	{
+		Profile_counters counters[segment_size];
+	};
+
+	// A run of executed instructions with no control transfer and the same count, taken as a basic block
+	struct Profile_block
+	{
+		std::ptrdiff_t first;
+		std::ptrdiff_t last; // one past the last instruction
+		std::uint64_t count;
+		std::uint64_t clocks;
+		std::uint64_t ea_clocks;
+	};
+
+	// The blocks of the instructions the profile counted, those with the most clocks first
+	std::vector<Profile_block> get_hot_blocks(const Context& ctx, const Profile& profile);
+
+	// Prints the disassembly of each block, hottest first, with the counters of every instruction
+	void print_profile(std::ostream& os, const Context& ctx, const Profile& profile);
+}
@@ -1,8 +1,17 @@
 #include "simulator.h"
+#include "cache.h"
+#include "counters.h"
+#include "debug.h"
+#include "history.h"
+#include "profile.h"
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <initializer_list>
 #include <iostream>
 
-namespace
+namespace sim86
 {
 	std::uint32_t get_clocks_for_ea_components(std::uint8_t mod, std::uint8_t r_m)
 	{
@@ -72,598 +81,1326 @@ namespace
 		return clocks;
 	}
 
-	std::uint32_t get_effective_address(const std::uint8_t r_m, const sim86::Context& ctx)
+	bool get_flag(const Context& ctx, const Context::Flags flag)
+	{
+		if (ctx.flags_op == Context::Flags_op_none || !(flag & Context::Flags_arithmetic)) return (ctx.flags & flag) != 0;
+
+		bool w = false;
+		bool add = false;
+		switch (ctx.flags_op)
+		{
+		case Context::Flags_op_add_16:
+		case Context::Flags_op_inc_16:
+			w = true;
+			[[fallthrough]];
+		case Context::Flags_op_add_8:
+		case Context::Flags_op_inc_8:
+			add = true;
+			break;
+		case Context::Flags_op_sub_16:
+		case Context::Flags_op_dec_16:
+			w = true;
+			break;
+		default:
+			break;
+		}
+		const std::uint16_t mask = w ? 0xffff : 0xff;
+		const std::uint16_t sign = w ? 0x8000 : 0x80;
+		const std::uint16_t dst = ctx.flags_dst & mask;
+		const std::uint16_t src = ctx.flags_src & mask;
+		const std::uint16_t result = ctx.flags_result & mask;
+		switch (flag)
+		{
+		case Context::Flags_carry:
+			if (ctx.flags_op >= Context::Flags_op_inc_8) return (ctx.flags & Context::Flags_carry) != 0;
+			return add ? result < dst : src > dst;
+		case Context::Flags_parity:
+			return (std::popcount(static_cast<std::uint8_t>(result)) & 1) == 0;
+		case Context::Flags_auxiliary:
+			return ((dst ^ src ^ result) & 0x10) != 0;
+		case Context::Flags_zero:
+			return result == 0;
+		case Context::Flags_sign:
+			return (result & sign) != 0;
+		case Context::Flags_overflow:
+			if (add) return ((dst ^ result) & (src ^ result) & sign) != 0;
+			return ((dst ^ src) & (dst ^ result) & sign) != 0;
+		default:
+			return false;
+		}
+	}
+
+	std::uint16_t get_flags(const Context& ctx)
+	{
+		if (ctx.flags_op == Context::Flags_op_none) return ctx.flags;
+		std::uint16_t flags = ctx.flags & ~Context::Flags_arithmetic;
+		for (const Context::Flags flag : { Context::Flags_carry, Context::Flags_parity, Context::Flags_auxiliary, Context::Flags_zero, Context::Flags_sign, Context::Flags_overflow })
+		{
+			if (get_flag(ctx, flag)) flags |= flag;
+		}
+		return flags;
+	}
+
+	void set_flags(Context& ctx, const std::uint16_t flags)
+	{
+		ctx.flags = flags;
+		ctx.flags_op = Context::Flags_op_none;
+	}
+}
+
+namespace
+{
+	std::uint32_t get_effective_address(const std::uint8_t r_m, const std::uint16_t* registers)
 	{
 		std::uint32_t addr = 0;
 		switch (r_m)
 		{
 		case 0: // bx + si
-			addr = ctx.registers[3] + ctx.registers[6];
+			addr = registers[3] + registers[6];
 			break;
 		case 1: // bx + di
-			addr = ctx.registers[3] + ctx.registers[7]; 
+			addr = registers[3] + registers[7]; 
 			break;
 		case 2: // bp + si
-			addr = ctx.registers[5] + ctx.registers[6];
+			addr = registers[5] + registers[6];
 			break;
 		case 3: // bp + di
-			addr = ctx.registers[5] + ctx.registers[7];
+			addr = registers[5] + registers[7];
 			break;
 		case 4: // si
-			addr = ctx.registers[6];
+			addr = registers[6];
 			break;
 		case 5: // di
-			addr = ctx.registers[7];
+			addr = registers[7];
 			break;
 		case 6: // bp
-			addr = ctx.registers[5];
+			addr = registers[5];
 			break;
 		case 7: // bx
-			addr = ctx.registers[3];
+			addr = registers[3];
 			break;
 		}
 		return addr;
 	}
 
-	std::uint8_t* get_address(std::uint8_t mod, std::uint8_t r_m, const std::uint8_t*& first, const std::uint8_t* last, sim86::Context& ctx)
+	enum Access
 	{
-		std::uint32_t addr = 0;
-		switch (mod)
+		Access_read,
+		Access_write,
+	};
+
+	// Drops what the write of size bytes at the physical address addr makes stale and marks the pages it dirties,
+	// before the write is made
+	void note_write(const std::uint32_t addr, const std::uint32_t size, sim86::Context& ctx)
+	{
+		if (ctx.history) ctx.history->note_write(addr, size);
+		// NOTE(rksouthee): Any cached instruction overlapping the write starts less than the longest instruction
+		// before it, only a write within the code segment can reach one.
+		const std::uint32_t code_base = sim86::get_physical_address(ctx.segments[sim86::Segment_cs], 0);
+		for (std::uint32_t i = addr - (sim86::max_instruction_size - 1); i != addr + size; ++i)
 		{
-		case 0:
-			if (r_m == 6)
+			const std::uint32_t offset = (i - code_base) & (sim86::memory_size - 1);
+			if (offset < sim86::segment_size) ctx.decoded[offset].instruction.size = 0;
+		}
+		if (ctx.code_map)
+		{
+			for (std::uint32_t i = addr; i != addr + size; ++i)
 			{
-				addr = first[0] | (first[1] << 8);
-				first += 2;
+				if (ctx.code_map[i & (sim86::memory_size - 1)]) ctx.code_modified = true;
 			}
-			else
+		}
+		const std::uint32_t last_page = ((addr + size - 1) & (sim86::memory_size - 1)) / sim86::snapshot_page_size;
+		for (std::uint32_t page = addr / sim86::snapshot_page_size; ; page = (page + 1) % sim86::page_count)
+		{
+			ctx.dirty_pages.insert(page);
+			if (page == last_page) break;
+		}
+	}
+
+	// Notes the first access of the run to a watched byte, the run stops once the instruction making it is done
+	void watch(const std::uint32_t addr, const std::uint32_t size, const Access access, sim86::Context& ctx)
+	{
+		sim86::Debug& debug = *ctx.debug;
+		if (debug.hit) return;
+		for (const sim86::Watchpoint& watchpoint : debug.watchpoints)
+		{
+			if (access == Access_read && !watchpoint.reads) continue;
+			for (std::uint32_t i = 0; i < size; ++i)
 			{
-				addr = get_effective_address(r_m, ctx);
+				const std::uint32_t byte = (addr + i) & (sim86::memory_size - 1);
+				if (byte < watchpoint.first || byte >= watchpoint.last) continue;
+				debug.hit = true;
+				debug.hit_address = byte;
+				return;
 			}
-			break;
-		case 1:
-			addr = get_effective_address(r_m, ctx) + static_cast<std::int8_t>(first[0]);
-			++first;
-			break;
-		case 2:
-			addr = get_effective_address(r_m, ctx) + (first[0] | (first[1] << 8));
-			first += 2;
-			break;
-		case 3:
-			return reinterpret_cast<std::uint8_t*>(&ctx.registers[r_m]);
-		default:
-			std::cerr << "unhandled mod " << static_cast<int>(mod) << std::endl;
-			break;
 		}
-		ctx.clocks += get_clocks_for_ea_components(mod, r_m);
-		return ctx.memory + addr;
 	}
 
-#define EXECUTE_FN(name) void name(const std::uint8_t* first, const std::uint8_t* last, sim86::Context& ctx)
-	typedef EXECUTE_FN((*Execute_fn));
+	std::uint32_t get_clocks_for_ea(const sim86::Operand& operand)
+	{
+		if (operand.type == sim86::Operand_direct) return sim86::get_clocks_for_ea_components(0b00, 0b110);
+		return sim86::get_clocks_for_ea_components(operand.mod, operand.reg);
+	}
+
+	// NOTE(rksouthee): The second byte of a word is at the next offset in its segment, from offset 0xffff that wraps
+	// around to the start of the segment and from the last byte of memory to the start of memory.
+	struct Location
+	{
+		std::uint8_t* lo;
+		std::uint8_t* hi;
+	};
+
+	template <bool W>
+	Location get_register(const std::uint8_t reg, sim86::Context& ctx)
+	{
+		// NOTE(rksouthee): The byte registers are al, cl, dl, bl followed by their high halves ah, ch, dh, bh
+		std::uint8_t* const lo = W ? reinterpret_cast<std::uint8_t*>(&ctx.registers[reg]) : reinterpret_cast<std::uint8_t*>(&ctx.registers[reg & 3]) + (reg >> 2);
+		return { lo, lo + 1 };
+	}
+
+	// The direct address of the accumulator forms of mov costs no effective address calculation. The segment of the
+	// operand was settled when the instruction was decoded into the cache.
+	template <bool Ea, bool Watch>
+	Location get_memory(const sim86::Instruction& inst, const sim86::Operand& operand, const Access access, const std::uint32_t size, sim86::Context& ctx)
+	{
+		const std::uint16_t segment = ctx.segments[inst.segment];
+		const std::uint16_t offset = sim86::get_memory_address(operand, ctx.registers);
+		const std::uint32_t addr = sim86::get_physical_address(segment, offset);
+		const std::uint32_t next = sim86::get_physical_address(segment, offset + 1);
+		if constexpr (Ea)
+		{
+			ctx.ea_clocks = get_clocks_for_ea(operand);
+			ctx.clocks += ctx.ea_clocks;
+		}
+		// A word that wraps around is two bytes apart
+		const std::uint32_t first_size = next == addr + 1 ? size : 1;
+		if constexpr (Watch) watch(addr, first_size, access, ctx);
+		if (access == Access_write) note_write(addr, first_size, ctx);
+		if (ctx.cache) ctx.cache->access(addr, first_size);
+		if (first_size != size)
+		{
+			if constexpr (Watch) watch(next, 1, access, ctx);
+			if (access == Access_write) note_write(next, 1, ctx);
+			if (ctx.cache) ctx.cache->access(next, 1);
+		}
+		SIM86_COUNT(ctx,
+			++(operand.type == sim86::Operand_direct ? counters.ea_modes[0][6] : counters.ea_modes[operand.mod][operand.reg]);
+			(access == Access_write ? counters.written_bytes : counters.read_bytes) += size);
+		return { ctx.memory.data() + addr, ctx.memory.data() + next };
+	}
 
-	EXECUTE_FN(noop)
+	template <bool W>
+	std::uint16_t load(const std::uint8_t* ptr)
 	{
-		std::cout << "skipping " << std::hex << static_cast<int>(*first) << std::endl;
+		if constexpr (!W) return ptr[0];
+		return ptr[0] | (ptr[1] << 8);
 	}
 
-	void store_little_endian(std::uint8_t* ptr, std::uint16_t val)
+	template <bool W>
+	void store(std::uint8_t* ptr, const std::uint16_t val)
 	{
 		ptr[0] = val & 0xff;
-		ptr[1] = (val >> 8) & 0xff;
+		if constexpr (W) ptr[1] = (val >> 8) & 0xff;
+	}
+
+	template <bool W>
+	std::uint16_t load(const Location location)
+	{
+		if constexpr (!W) return *location.lo;
+		return *location.lo | (*location.hi << 8);
+	}
+
+	template <bool W>
+	void store(const Location location, const std::uint16_t val)
+	{
+		*location.lo = val & 0xff;
+		if constexpr (W) *location.hi = (val >> 8) & 0xff;
 	}
 
-	void set_flags(std::uint16_t val, sim86::Context& ctx)
+	// NOTE(rksouthee): The decoder resolves the d bit into the order of the operands, so the binary executors are
+	// specialized on the kinds of their destination and source instead of on the bits of the opcode.
+	enum Form : std::uint8_t
+	{
+		Form_reg_reg,
+		Form_reg_mem,
+		Form_mem_reg,
+		Form_reg_immed,
+		Form_mem_immed,
+		Form_acc_mem, // mov al/ax,[addr]
+		Form_mem_acc, // mov [addr],al/ax
+		Form_reg, // inc and dec
+		Form_mem,
+		Form_count,
+	};
+
+	// NOTE(rksouthee): The clocks are those of the instruction timings in the 8086 family user's manual, the 8088
+	// only differs in the penalty it pays for transferring words.
+	struct Binary_timing
+	{
+		sim86::Operation operation;
+		Form form;
+		std::uint8_t clocks_8;
+		std::uint8_t clocks_16;
+		std::uint8_t transfers;
+	};
+
+	constexpr Binary_timing s_binary_timings[] =
+	{
+		{ sim86::Operation_mov, Form_reg_reg, 2, 2, 0 },
+		{ sim86::Operation_mov, Form_reg_mem, 8, 8, 1 },
+		{ sim86::Operation_mov, Form_mem_reg, 9, 9, 1 },
+		{ sim86::Operation_mov, Form_reg_immed, 4, 4, 0 },
+		{ sim86::Operation_mov, Form_mem_immed, 10, 10, 1 },
+		{ sim86::Operation_mov, Form_acc_mem, 10, 10, 1 },
+		{ sim86::Operation_mov, Form_mem_acc, 10, 10, 1 },
+		{ sim86::Operation_add, Form_reg_reg, 3, 3, 0 },
+		{ sim86::Operation_add, Form_reg_mem, 9, 9, 1 },
+		{ sim86::Operation_add, Form_mem_reg, 16, 16, 2 },
+		{ sim86::Operation_add, Form_reg_immed, 4, 4, 0 },
+		{ sim86::Operation_add, Form_mem_immed, 17, 17, 2 },
+		{ sim86::Operation_sub, Form_reg_reg, 3, 3, 0 },
+		{ sim86::Operation_sub, Form_reg_mem, 9, 9, 1 },
+		{ sim86::Operation_sub, Form_mem_reg, 16, 16, 2 },
+		{ sim86::Operation_sub, Form_reg_immed, 4, 4, 0 },
+		{ sim86::Operation_sub, Form_mem_immed, 17, 17, 2 },
+		{ sim86::Operation_cmp, Form_reg_reg, 3, 3, 0 },
+		{ sim86::Operation_cmp, Form_reg_mem, 9, 9, 1 },
+		{ sim86::Operation_cmp, Form_mem_reg, 9, 9, 1 },
+		{ sim86::Operation_cmp, Form_reg_immed, 4, 4, 0 },
+		{ sim86::Operation_cmp, Form_mem_immed, 10, 10, 1 },
+		// The word registers have one byte encodings of their own
+		{ sim86::Operation_inc, Form_reg, 3, 2, 0 },
+		{ sim86::Operation_inc, Form_mem, 15, 15, 2 },
+		{ sim86::Operation_dec, Form_reg, 3, 2, 0 },
+		{ sim86::Operation_dec, Form_mem, 15, 15, 2 },
+	};
+
+	// The conditional jumps, from first to last, share their timing
+	struct Jump_timing
 	{
-		if (val >> 15)
+		sim86::Operation first;
+		sim86::Operation last;
+		std::uint8_t taken_clocks;
+		std::uint8_t not_taken_clocks;
+	};
+
+	constexpr Jump_timing s_jump_timings[] =
+	{
+		{ sim86::Operation_jo, sim86::Operation_jg, 16, 4 },
+		{ sim86::Operation_loopne, sim86::Operation_loopne, 19, 5 },
+		{ sim86::Operation_loope, sim86::Operation_loope, 18, 6 },
+		{ sim86::Operation_loop, sim86::Operation_loop, 17, 5 },
+		{ sim86::Operation_jcxz, sim86::Operation_jcxz, 18, 6 },
+		{ sim86::Operation_hlt, sim86::Operation_hlt, 2, 2 },
+	};
+
+	// The instructions that only set, clear or move the flags
+	struct Flag_timing
+	{
+		sim86::Operation operation;
+		std::uint8_t clocks;
+		std::uint8_t transfers;
+	};
+
+	constexpr Flag_timing s_flag_timings[] =
+	{
+		{ sim86::Operation_clc, 2, 0 },
+		{ sim86::Operation_cmc, 2, 0 },
+		{ sim86::Operation_stc, 2, 0 },
+		{ sim86::Operation_cld, 2, 0 },
+		{ sim86::Operation_std, 2, 0 },
+		{ sim86::Operation_cli, 2, 0 },
+		{ sim86::Operation_sti, 2, 0 },
+		{ sim86::Operation_lahf, 4, 0 },
+		{ sim86::Operation_sahf, 4, 0 },
+		{ sim86::Operation_pushf, 10, 1 },
+		{ sim86::Operation_popf, 8, 1 },
+	};
+
+	// NOTE(rksouthee): lahf and sahf move sign, zero, auxiliary, parity and carry through ah. The bits the 8086
+	// doesn't use read as 1 in the low byte at bit 1 and in the high byte at bits 12 to 15.
+	constexpr std::uint16_t s_ah_flags = sim86::Context::Flags_sign | sim86::Context::Flags_zero |
+		sim86::Context::Flags_auxiliary | sim86::Context::Flags_parity | sim86::Context::Flags_carry;
+	constexpr std::uint16_t s_stored_flags = sim86::Context::Flags_arithmetic | sim86::Context::Flags_trap |
+		sim86::Context::Flags_interrupt | sim86::Context::Flags_direction;
+	constexpr std::uint16_t s_reserved_flags = 0xf002;
+
+	// A rep prefix takes s_repeat_clocks before the first repetition
+	struct String_timing
+	{
+		sim86::Operation operation;
+		std::uint8_t clocks;
+		std::uint8_t repeat_clocks;
+		std::uint8_t transfers;
+	};
+
+	constexpr std::uint8_t s_repeat_clocks = 9;
+
+	constexpr String_timing s_string_timings[] =
+	{
+		{ sim86::Operation_movs, 18, 17, 2 },
+		{ sim86::Operation_cmps, 22, 22, 2 },
+		{ sim86::Operation_scas, 15, 15, 1 },
+		{ sim86::Operation_lods, 12, 13, 1 },
+		{ sim86::Operation_stos, 11, 10, 1 },
+	};
+
+	struct Timings
+	{
+		sim86::Timing binary[sim86::Operation_count][Form_count][2];
+		sim86::Timing other[sim86::Operation_count]; // jumps, hlt, the flag and the string instructions
+		sim86::Timing repeated[sim86::Operation_count]; // the string instructions with a rep prefix
+	};
+
+	constexpr Timings build_timings()
+	{
+		Timings result{};
+		for (const Binary_timing& row : s_binary_timings)
 		{
-			ctx.flags = (sim86::Context::Flags)(ctx.flags | sim86::Context::Flags_sign);
+			result.binary[row.operation][row.form][0] = { row.clocks_8, 0, row.transfers, 0 };
+			result.binary[row.operation][row.form][1] = { row.clocks_16, 0, row.transfers, 0 };
 		}
-		else
+		for (const Jump_timing& row : s_jump_timings)
 		{
-			ctx.flags = (sim86::Context::Flags)(ctx.flags & ~sim86::Context::Flags_sign);
+			for (std::size_t op = row.first; op <= row.last; ++op)
+			{
+				result.other[op] = { row.taken_clocks, row.not_taken_clocks, 0, 0 };
+			}
 		}
-
-		if (val == 0)
+		for (const Flag_timing& row : s_flag_timings)
 		{
-			ctx.flags = (sim86::Context::Flags)(ctx.flags | sim86::Context::Flags_zero);
+			result.other[row.operation] = { row.clocks, 0, row.transfers, 0 };
 		}
-		else
+		for (const String_timing& row : s_string_timings)
 		{
-			ctx.flags = (sim86::Context::Flags)(ctx.flags & ~sim86::Context::Flags_zero);
+			result.other[row.operation] = { row.clocks, 0, row.transfers, 0 };
+			result.repeated[row.operation] = { s_repeat_clocks, 0, row.transfers, row.repeat_clocks };
 		}
+		return result;
 	}
 
-	void mov_reg_immed_16(std::size_t reg, const std::uint8_t* first, const std::uint8_t* last, sim86::Context& ctx)
-	{
-		auto* ptr = reinterpret_cast<std::uint8_t*>(&ctx.registers[reg]);
-		const std::uint16_t immed = first[1] | (first[2] << 8);
-		store_little_endian(ptr, immed);
-		ctx.clocks = 4;
-	}
+	constexpr Timings s_timings = build_timings();
 
-	EXECUTE_FN(sub_rm_reg_16)
+	// Charges the penalties for the transfers of a word at addr
+	void charge_transfers(const std::uint32_t addr, const std::uint32_t transfers, sim86::Context& ctx)
 	{
-		// NOTE(rksouthee): This is only handling the case where the mod is 11 (register)
-		const std::uint8_t r_m = (first[1] >> 0) & 0x7;
-		const std::uint8_t reg = (first[1] >> 3) & 0x7;
-		ctx.registers[r_m] -= ctx.registers[reg];
-		set_flags(ctx.registers[r_m], ctx);
-		ctx.clocks = 4;
+		ctx.penalty_clocks = transfers * sim86::get_word_transfer_penalty(ctx.cpu, addr);
+		ctx.clocks += ctx.penalty_clocks;
 	}
 
-	EXECUTE_FN(cmp_rm_reg_16)
+	// NOTE(rksouthee): Every executor is specialized on whether the run checks watchpoints, only those reaching
+	// memory make use of it.
+#define EXECUTE_FN(name) template <bool Watch> void name(const sim86::Instruction& inst, sim86::Context& ctx)
+
+	// NOTE(rksouthee): Executors that ignore an operand leave it unnamed rather than going through EXECUTE_FN
+	template <bool Watch>
+	void noop(const sim86::Instruction& inst, sim86::Context&)
 	{
-		// NOTE(rksouthee): This is only handling the case where the mod is 11 (register)
-		const std::uint8_t r_m = (first[1] >> 0) & 0x7;
-		const std::uint8_t reg = (first[1] >> 3) & 0x7;
-		const std::uint16_t result = ctx.registers[r_m] - ctx.registers[reg];
-		set_flags(result, ctx);
-		ctx.clocks = 3;
+		std::cerr << "skipping " << std::hex << static_cast<int>(inst.opcode) << std::endl;
 	}
 
-	EXECUTE_FN(jnz_short_label)
+	// NOTE(rksouthee): Only the operands are recorded, the flags themselves are computed if something reads them
+	template <sim86::Operation Op, bool W>
+	void record_flags(const std::uint16_t dst, const std::uint16_t src, const std::uint16_t result, sim86::Context& ctx)
 	{
-		const std::int8_t offset = static_cast<std::int8_t>(first[1]);
-		if (!(ctx.flags & sim86::Context::Flags_zero))
+		if constexpr (Op == sim86::Operation_add)
 		{
-			ctx.ip += offset;
-			ctx.clocks = 16;
+			ctx.flags_op = W ? sim86::Context::Flags_op_add_16 : sim86::Context::Flags_op_add_8;
+		}
+		else if constexpr (Op == sim86::Operation_sub || Op == sim86::Operation_cmp)
+		{
+			ctx.flags_op = W ? sim86::Context::Flags_op_sub_16 : sim86::Context::Flags_op_sub_8;
 		}
 		else
 		{
-			ctx.clocks = 4;
+			// inc and dec keep the carry of whatever came before them
+			const bool carry = sim86::get_flag(ctx, sim86::Context::Flags_carry);
+			ctx.flags = (ctx.flags & ~sim86::Context::Flags_carry) | (carry ? sim86::Context::Flags_carry : 0);
+			if constexpr (Op == sim86::Operation_inc) ctx.flags_op = W ? sim86::Context::Flags_op_inc_16 : sim86::Context::Flags_op_inc_8;
+			else ctx.flags_op = W ? sim86::Context::Flags_op_dec_16 : sim86::Context::Flags_op_dec_8;
+		}
+		ctx.flags_dst = dst;
+		ctx.flags_src = src;
+		ctx.flags_result = result;
+	}
+
+	// NOTE(rksouthee): The conditional jumps come in pairs testing a condition and its negation, in the order of
+	// their opcodes.
+	bool get_condition(const sim86::Operation op, const sim86::Context& ctx)
+	{
+		const std::uint32_t index = op - sim86::Operation_jo;
+		bool condition = false;
+		switch (index >> 1)
+		{
+		case 0: // jo
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_overflow);
+			break;
+		case 1: // jc
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_carry);
+			break;
+		case 2: // jz
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_zero);
+			break;
+		case 3: // jna
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_carry) || sim86::get_flag(ctx, sim86::Context::Flags_zero);
+			break;
+		case 4: // js
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_sign);
+			break;
+		case 5: // jpe
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_parity);
+			break;
+		case 6: // jl
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_sign) != sim86::get_flag(ctx, sim86::Context::Flags_overflow);
+			break;
+		case 7: // jng
+			condition = sim86::get_flag(ctx, sim86::Context::Flags_zero) ||
+				sim86::get_flag(ctx, sim86::Context::Flags_sign) != sim86::get_flag(ctx, sim86::Context::Flags_overflow);
+			break;
 		}
+		return condition != ((index & 1) != 0);
 	}
 
-	EXECUTE_FN(add_rm_reg_16)
+	bool is_conditional_jump(const sim86::Operation op)
 	{
-		const std::uint8_t mod = first[1] >> 6;
-		const std::uint8_t r_m = (first[1] >> 0) & 0x7;
-		const std::uint8_t reg = (first[1] >> 3) & 0x7;
-		std::uint16_t* dst = reinterpret_cast<std::uint16_t*>(get_address(mod, r_m, first, last, ctx));
-		const std::uint16_t* src = &ctx.registers[reg];
-		*dst += *src;
-		set_flags(*dst, ctx);
-		if (mod == 0b11)
+		return op >= sim86::Operation_jo && op <= sim86::Operation_jg;
+	}
+
+	void jump(const sim86::Instruction& inst, const bool taken, sim86::Context& ctx)
+	{
+		const sim86::Timing& timing = s_timings.other[inst.operation];
+		SIM86_COUNT(ctx, ++(taken ? counters.taken : counters.not_taken)[inst.operation]);
+		if (taken)
 		{
-			// register,register
-			ctx.clocks += 3;
+			ctx.ip += static_cast<std::int16_t>(inst.operands[0].value);
+			ctx.clocks = timing.clocks;
 		}
 		else
 		{
-			// memory,register
-			ctx.clocks += 16;
+			ctx.clocks = timing.not_taken_clocks;
 		}
 	}
 
-	EXECUTE_FN(op_rm_imm_16)
+	EXECUTE_FN(jcc)
 	{
-		const std::uint8_t op = (first[1] >> 3) & 0x7;
-		const std::uint8_t r_m = first[1] & 0x7;
-		const std::uint16_t imm = first[2] | (first[3] << 8);
-		std::uint16_t result = 0;
-		switch (op)
+		jump(inst, get_condition(inst.operation, ctx), ctx);
+	}
+
+	// The jump after an arithmetic instruction, which has just recorded its result for the flags
+	template <bool W>
+	void fused_jcc(const sim86::Instruction& inst, sim86::Context& ctx)
+	{
+		constexpr std::uint16_t mask = W ? 0xffff : 0xff;
+		switch (inst.operation)
 		{
-		case 0: // add
-			result = ctx.registers[r_m] += imm;
-			ctx.clocks += 4;
-			break;
-		case 5: // sub
-			result = ctx.registers[r_m] -= imm;
-			ctx.clocks += 4;
+		case sim86::Operation_jz:
+			jump(inst, (ctx.flags_result & mask) == 0, ctx);
 			break;
-		case 7: // cmp
-			result = ctx.registers[r_m] - imm;
-			ctx.clocks += 4;
+		case sim86::Operation_jnz:
+			jump(inst, (ctx.flags_result & mask) != 0, ctx);
 			break;
 		default:
-			std::cout << "unhandled op " << static_cast<int>(op) << std::endl;
+			jcc<false>(inst, ctx);
 			break;
 		}
-		set_flags(result, ctx);
 	}
 
-	EXECUTE_FN(op_rm16_immed8)
+	EXECUTE_FN(loop)
+	{
+		jump(inst, --ctx.registers[1] != 0, ctx);
+	}
+
+	EXECUTE_FN(loope)
+	{
+		jump(inst, --ctx.registers[1] != 0 && sim86::get_flag(ctx, sim86::Context::Flags_zero), ctx);
+	}
+
+	EXECUTE_FN(loopne)
+	{
+		jump(inst, --ctx.registers[1] != 0 && !sim86::get_flag(ctx, sim86::Context::Flags_zero), ctx);
+	}
+
+	EXECUTE_FN(jcxz)
 	{
-		const std::uint8_t op = (first[1] >> 3) & 0x7;
-		const std::uint8_t r_m = first[1] & 0x7;
-		const auto imm = static_cast<std::int16_t>(static_cast<std::int8_t>(first[2]));
-		std::uint16_t result = 0;
-		switch (op)
+		jump(inst, ctx.registers[1] == 0, ctx);
+	}
+
+	template <bool Watch>
+	void hlt(const sim86::Instruction&, sim86::Context& ctx)
+	{
+		ctx.clocks += s_timings.other[sim86::Operation_hlt].clocks;
+	}
+
+	// NOTE(rksouthee): The carry is one of the flags computed from the last operation, so it has to be settled
+	// before it can be changed. The others are always held in Context::flags.
+	EXECUTE_FN(flag)
+	{
+		switch (inst.operation)
 		{
-		case 0: // add
-			result = ctx.registers[r_m] += imm;
-			ctx.clocks += 4;
+		case sim86::Operation_clc:
+			sim86::set_flags(ctx, static_cast<std::uint16_t>(sim86::get_flags(ctx) & ~sim86::Context::Flags_carry));
+			break;
+		case sim86::Operation_cmc:
+			sim86::set_flags(ctx, static_cast<std::uint16_t>(sim86::get_flags(ctx) ^ sim86::Context::Flags_carry));
+			break;
+		case sim86::Operation_stc:
+			sim86::set_flags(ctx, static_cast<std::uint16_t>(sim86::get_flags(ctx) | sim86::Context::Flags_carry));
+			break;
+		case sim86::Operation_cld:
+			ctx.flags &= ~sim86::Context::Flags_direction;
+			break;
+		case sim86::Operation_std:
+			ctx.flags |= sim86::Context::Flags_direction;
 			break;
-		case 5: // sub
-			result = ctx.registers[r_m] -= imm;
-			ctx.clocks += 4;
+		case sim86::Operation_cli:
+			ctx.flags &= ~sim86::Context::Flags_interrupt;
 			break;
-		case 7: // cmp
-			result = ctx.registers[r_m] - imm;
-			ctx.clocks += 4;
+		case sim86::Operation_sti:
+			ctx.flags |= sim86::Context::Flags_interrupt;
+			break;
+		case sim86::Operation_lahf:
+			ctx.registers[0] = static_cast<std::uint16_t>((ctx.registers[0] & 0xff) | ((sim86::get_flags(ctx) & s_ah_flags) | (s_reserved_flags & 0xff)) << 8);
+			break;
+		case sim86::Operation_sahf:
+			sim86::set_flags(ctx, static_cast<std::uint16_t>((sim86::get_flags(ctx) & ~s_ah_flags) | ((ctx.registers[0] >> 8) & s_ah_flags)));
 			break;
 		default:
-			std::cerr << "unhandled op " << static_cast<int>(op) << std::endl;
 			break;
 		}
-		set_flags(result, ctx);
+		ctx.clocks += s_timings.other[inst.operation].clocks;
+	}
+
+	template <sim86::Operation Op, Form F, bool W, bool Watch>
+	void binary(const sim86::Instruction& inst, sim86::Context& ctx)
+	{
+		constexpr std::uint32_t size = W ? 2 : 1;
+		constexpr Access access = Op == sim86::Operation_cmp ? Access_read : Access_write;
+		constexpr sim86::Timing timing = s_timings.binary[Op][F][W];
+
+		Location mem{};
+		Location dst;
+		if constexpr (F == Form_mem_reg || F == Form_mem_immed || F == Form_mem) dst = mem = get_memory<true, Watch>(inst, inst.operands[0], access, size, ctx);
+		else if constexpr (F == Form_mem_acc) dst = mem = get_memory<false, Watch>(inst, inst.operands[0], access, size, ctx);
+		else dst = get_register<W>(inst.operands[0].reg, ctx);
+		// The destination is read as well as written, except by mov
+		if constexpr (Op != sim86::Operation_mov && Op != sim86::Operation_cmp && (F == Form_mem_reg || F == Form_mem_immed || F == Form_mem))
+		{
+			SIM86_COUNT(ctx, counters.read_bytes += size);
+		}
+
+		std::uint16_t src;
+		if constexpr (F == Form_reg || F == Form_mem) src = 1;
+		else if constexpr (F == Form_reg_immed || F == Form_mem_immed) src = inst.operands[1].value;
+		else if constexpr (F == Form_reg_mem) src = load<W>(mem = get_memory<true, Watch>(inst, inst.operands[1], Access_read, size, ctx));
+		else if constexpr (F == Form_acc_mem) src = load<W>(mem = get_memory<false, Watch>(inst, inst.operands[1], Access_read, size, ctx));
+		else src = load<W>(get_register<W>(inst.operands[1].reg, ctx));
+
+		if constexpr (Op == sim86::Operation_mov)
+		{
+			store<W>(dst, src);
+		}
+		else
+		{
+			constexpr bool add = Op == sim86::Operation_add || Op == sim86::Operation_inc;
+			const std::uint16_t value = load<W>(dst);
+			const std::uint16_t result = add ? value + src : value - src;
+			if constexpr (Op != sim86::Operation_cmp) store<W>(dst, result);
+			record_flags<Op, W>(value, src, result, ctx);
+		}
+		ctx.clocks += timing.clocks;
+		if constexpr (W && timing.transfers != 0) charge_transfers(static_cast<std::uint32_t>(mem.lo - ctx.memory.data()), timing.transfers, ctx);
 	}
 
-	EXECUTE_FN(mov_ax_immed_16)
+	// NOTE(rksouthee): Moves to and from the segment registers are timed as those of a word register, they are
+	// rare enough to share one executor.
+	EXECUTE_FN(mov_segment)
 	{
-		mov_reg_immed_16(0, first, last, ctx);
+		const sim86::Operand& dst = inst.operands[0];
+		const bool to_segment = dst.type == sim86::Operand_segment;
+		const sim86::Operand& other = to_segment ? inst.operands[1] : dst;
+		std::uint16_t& segment = ctx.segments[to_segment ? dst.reg : inst.operands[1].reg];
+		Location mem{};
+		Form form;
+		if (other.type == sim86::Operand_register)
+		{
+			form = Form_reg_reg;
+			if (to_segment) segment = ctx.registers[other.reg];
+			else ctx.registers[other.reg] = segment;
+		}
+		else
+		{
+			form = to_segment ? Form_reg_mem : Form_mem_reg;
+			mem = get_memory<true, Watch>(inst, other, to_segment ? Access_read : Access_write, 2, ctx);
+			if (to_segment) segment = load<true>(mem);
+			else store<true>(mem, segment);
+		}
+		const sim86::Timing& timing = s_timings.binary[sim86::Operation_mov][form][1];
+		ctx.clocks += timing.clocks;
+		if (mem.lo) charge_transfers(static_cast<std::uint32_t>(mem.lo - ctx.memory.data()), timing.transfers, ctx);
+		// The cached instructions were decoded from the old code segment
+		if (to_segment && dst.reg == sim86::Segment_cs)
+		{
+			for (sim86::Decoded_instruction& decoded : ctx.decoded) decoded.instruction.size = 0;
+		}
 	}
 
-	EXECUTE_FN(mov_cx_immed_16)
+	// Feeds a word at lo and hi to the cache, as one access unless it wraps around
+	void note_access(const std::uint32_t lo, const std::uint32_t hi, sim86::Context& ctx)
 	{
-		mov_reg_immed_16(1, first, last, ctx);
+		if (!ctx.cache) return;
+		if (hi == lo + 1) ctx.cache->access(lo, 2);
+		else
+		{
+			ctx.cache->access(lo, 1);
+			ctx.cache->access(hi, 1);
+		}
 	}
 
-	EXECUTE_FN(mov_dx_immed_16)
+	// NOTE(rksouthee): The string instructions read at ds:si, or the segment of a prefix, and write at es:di. Words
+	// are read and written a byte at a time so that one at offset 0xffff wraps around to the start of its segment.
+	template <bool W, bool Watch>
+	std::uint16_t load_at(const std::uint16_t segment, const std::uint16_t offset, sim86::Context& ctx)
 	{
-		mov_reg_immed_16(2, first, last, ctx);
+		const std::uint32_t lo = sim86::get_physical_address(segment, offset);
+		if constexpr (Watch) watch(lo, 1, Access_read, ctx);
+		SIM86_COUNT(ctx, counters.read_bytes += W ? 2 : 1);
+		if constexpr (!W)
+		{
+			if (ctx.cache) ctx.cache->access(lo, 1);
+			return ctx.memory[lo];
+		}
+		const std::uint32_t hi = sim86::get_physical_address(segment, offset + 1);
+		if constexpr (Watch) watch(hi, 1, Access_read, ctx);
+		note_access(lo, hi, ctx);
+		return ctx.memory[lo] | (ctx.memory[hi] << 8);
 	}
 
-	EXECUTE_FN(mov_bx_immed_16)
+	template <bool W, bool Watch>
+	void store_at(const std::uint16_t segment, const std::uint16_t offset, const std::uint16_t val, sim86::Context& ctx)
 	{
-		mov_reg_immed_16(3, first, last, ctx);
+		const std::uint32_t lo = sim86::get_physical_address(segment, offset);
+		if constexpr (Watch) watch(lo, 1, Access_write, ctx);
+		SIM86_COUNT(ctx, counters.written_bytes += W ? 2 : 1);
+		note_write(lo, 1, ctx);
+		ctx.memory[lo] = val & 0xff;
+		if constexpr (!W)
+		{
+			if (ctx.cache) ctx.cache->access(lo, 1);
+		}
+		else
+		{
+			const std::uint32_t hi = sim86::get_physical_address(segment, offset + 1);
+			if constexpr (Watch) watch(hi, 1, Access_write, ctx);
+			note_write(hi, 1, ctx);
+			ctx.memory[hi] = (val >> 8) & 0xff;
+			note_access(lo, hi, ctx);
+		}
 	}
 
-	EXECUTE_FN(mov_sp_immed_16)
+	// NOTE(rksouthee): The flags are pushed to and popped from ss:sp as a word, with the bits the 8086 doesn't use
+	// set. Popping them back leaves those bits out.
+	EXECUTE_FN(pushf)
 	{
-		mov_reg_immed_16(4, first, last, ctx);
+		std::uint16_t& sp = ctx.registers[4];
+		sp -= 2;
+		store_at<true, Watch>(ctx.segments[sim86::Segment_ss], sp, sim86::get_flags(ctx) | s_reserved_flags, ctx);
+		ctx.clocks += s_timings.other[inst.operation].clocks;
+		charge_transfers(sim86::get_physical_address(ctx.segments[sim86::Segment_ss], sp), s_timings.other[inst.operation].transfers, ctx);
 	}
 
-	EXECUTE_FN(mov_bp_immed_16)
+	EXECUTE_FN(popf)
 	{
-		mov_reg_immed_16(5, first, last, ctx);
+		std::uint16_t& sp = ctx.registers[4];
+		sim86::set_flags(ctx, load_at<true, Watch>(ctx.segments[sim86::Segment_ss], sp, ctx) & s_stored_flags);
+		ctx.clocks += s_timings.other[inst.operation].clocks;
+		charge_transfers(sim86::get_physical_address(ctx.segments[sim86::Segment_ss], sp), s_timings.other[inst.operation].transfers, ctx);
+		sp += 2;
 	}
 
-	EXECUTE_FN(mov_si_immed_16)
+	// Fills size bytes at dst with the period bytes already there repeated
+	void replicate(std::uint8_t* const dst, const std::size_t period, const std::size_t size)
 	{
-		mov_reg_immed_16(6, first, last, ctx);
+		for (std::size_t done = period; done < size; done *= 2)
+		{
+			std::memcpy(dst + done, dst, std::min(done, size - done));
+		}
 	}
 
-	EXECUTE_FN(mov_di_immed_16)
+	// Whether the bytes from offset fit in their segment and in memory without wrapping around either
+	bool is_contiguous(const std::uint16_t segment, const std::uint16_t offset, const std::uint32_t bytes)
 	{
-		mov_reg_immed_16(7, first, last, ctx);
+		return offset + bytes <= sim86::segment_size && sim86::get_physical_address(segment, 0) + offset + bytes <= sim86::memory_size;
 	}
 
-	EXECUTE_FN(mov_mem_immed_8)
+	// NOTE(rksouthee): A forward rep movs or stos that doesn't wrap around its segments, with no cache to feed, is
+	// done in one go. A movs whose destination starts inside its source repeats what lies between them just as
+	// copying an element at a time would, unless they are a single byte apart with words to copy.
+	template <sim86::Operation Op, bool W>
+	bool try_bulk_string(const sim86::Instruction& inst, const std::uint32_t count, sim86::Context& ctx)
 	{
-		const std::uint8_t mod = first[1] >> 6;
-		const std::uint8_t r_m = first[1] & 0x7;
-		first += 2;
-		std::uint8_t* ptr = get_address(mod, r_m, first, last, ctx);
-		ptr[0] = first[0];
-		ctx.clocks += 10;
+		constexpr std::uint32_t size = W ? 2 : 1;
+		const std::uint16_t ds = ctx.segments[inst.segment];
+		const std::uint16_t es = ctx.segments[sim86::Segment_es];
+		const std::uint32_t bytes = count * size;
+		if (ctx.cache || sim86::get_flag(ctx, sim86::Context::Flags_direction) || !is_contiguous(es, ctx.registers[7], bytes)) return false;
+		const std::uint32_t di = sim86::get_physical_address(es, ctx.registers[7]);
+		std::uint8_t* const dst = ctx.memory.data() + di;
+		if constexpr (Op == sim86::Operation_movs)
+		{
+			if (!is_contiguous(ds, ctx.registers[6], bytes)) return false;
+			const std::uint32_t si = sim86::get_physical_address(ds, ctx.registers[6]);
+			const std::uint32_t period = di - si;
+			const bool overlaps = di > si && period < bytes;
+			if (W && overlaps && period == 1) return false;
+			note_write(di, bytes, ctx);
+			SIM86_COUNT(ctx, counters.read_bytes += bytes; counters.written_bytes += bytes);
+			if (overlaps) replicate(dst - period, period, bytes + period);
+			else std::memmove(dst, ctx.memory.data() + si, bytes);
+		}
+		else
+		{
+			note_write(di, bytes, ctx);
+			SIM86_COUNT(ctx, counters.written_bytes += bytes);
+			const std::uint16_t ax = ctx.registers[0];
+			if (!W || (ax & 0xff) == (ax >> 8))
+			{
+				std::memset(dst, ax & 0xff, bytes);
+			}
+			else
+			{
+				dst[0] = ax & 0xff;
+				dst[1] = ax >> 8;
+				replicate(dst, 2, bytes);
+			}
+		}
+		return true;
 	}
 
-	EXECUTE_FN(mov_mem_immed_16)
+	// Runs count repetitions, stopping early for a cmps or scas whose zero flag differs from zero, and returns how
+	// many ran. Watching memory takes each element in turn so that every one of them is checked.
+	template <sim86::Operation Op, bool W, bool Watch>
+	std::uint32_t repeat_string(const sim86::Instruction& inst, const std::uint32_t count, const bool zero, sim86::Context& ctx)
 	{
-		const std::uint8_t mod = first[1] >> 6;
-		const std::uint8_t r_m = first[1] & 0x7;
-		first += 2;
-		std::uint8_t* ptr = get_address(mod, r_m, first, last, ctx);
-		ptr[0] = first[0];
-		ptr[1] = first[1];
-		ctx.clocks += 10;
+		constexpr std::uint16_t size = W ? 2 : 1;
+		const std::uint16_t step = sim86::get_flag(ctx, sim86::Context::Flags_direction) ? -size : size;
+		const std::uint16_t ds = ctx.segments[inst.segment];
+		const std::uint16_t es = ctx.segments[sim86::Segment_es];
+		std::uint16_t& ax = ctx.registers[0];
+		std::uint16_t& si = ctx.registers[6];
+		std::uint16_t& di = ctx.registers[7];
+		if constexpr (Op == sim86::Operation_lods && !Watch)
+		{
+			// Only the last element loaded survives, unless the cache has to see every one
+			if (!ctx.cache)
+			{
+				const std::uint16_t last = static_cast<std::uint16_t>(si + (count - 1) * step);
+				SIM86_COUNT(ctx, counters.read_bytes += (count - 1) * (W ? 2 : 1)); // those of the loads skipped
+				store<W>(reinterpret_cast<std::uint8_t*>(&ax), load_at<W, false>(ds, last, ctx));
+				si = static_cast<std::uint16_t>(si + count * step);
+				return count;
+			}
+		}
+		if constexpr ((Op == sim86::Operation_movs || Op == sim86::Operation_stos) && !Watch)
+		{
+			if (count > 1 && try_bulk_string<Op, W>(inst, count, ctx))
+			{
+				if constexpr (Op == sim86::Operation_movs) si = static_cast<std::uint16_t>(si + count * step);
+				di = static_cast<std::uint16_t>(di + count * step);
+				return count;
+			}
+		}
+
+		for (std::uint32_t i = 0; i < count;)
+		{
+			if constexpr (Op == sim86::Operation_movs)
+			{
+				store_at<W, Watch>(es, di, load_at<W, Watch>(ds, si, ctx), ctx);
+			}
+			else if constexpr (Op == sim86::Operation_stos)
+			{
+				store_at<W, Watch>(es, di, ax, ctx);
+			}
+			else if constexpr (Op == sim86::Operation_lods)
+			{
+				store<W>(reinterpret_cast<std::uint8_t*>(&ax), load_at<W, Watch>(ds, si, ctx));
+			}
+			else
+			{
+				const std::uint16_t dst = Op == sim86::Operation_cmps ? load_at<W, Watch>(ds, si, ctx) : load<W>(reinterpret_cast<std::uint8_t*>(&ax));
+				const std::uint16_t src = load_at<W, Watch>(es, di, ctx);
+				record_flags<sim86::Operation_cmp, W>(dst, src, static_cast<std::uint16_t>(dst - src), ctx);
+			}
+			if constexpr (Op != sim86::Operation_scas && Op != sim86::Operation_stos) si += step;
+			di += step;
+			++i;
+			if constexpr (Op == sim86::Operation_cmps || Op == sim86::Operation_scas)
+			{
+				constexpr std::uint16_t mask = W ? 0xffff : 0xff;
+				if (((ctx.flags_result & mask) == 0) != zero) return i;
+			}
+		}
+		return count;
 	}
 
-	EXECUTE_FN(mov_rm_reg_16)
+	template <sim86::Operation Op, bool W, bool Watch>
+	void string_instruction(const sim86::Instruction& inst, sim86::Context& ctx)
 	{
-		const std::uint8_t mod = first[1] >> 6;
-		const std::uint8_t r_m = (first[1] >> 0) & 0x7;
-		const std::uint8_t reg = (first[1] >> 3) & 0x7;
-		first += 2;
-		std::uint8_t* dst = get_address(mod, r_m, first, last, ctx);
-		const auto* src = reinterpret_cast<std::uint8_t*>(&ctx.registers[reg]);
-		dst[0] = src[0];
-		dst[1] = src[1];
-		if (mod == 0b11)
+		constexpr bool reads_si = Op != sim86::Operation_scas && Op != sim86::Operation_stos;
+		constexpr bool uses_di = Op != sim86::Operation_lods;
+		const bool repeat = (inst.flags & (sim86::Instruction_rep | sim86::Instruction_repne)) != 0;
+		const sim86::Timing& timing = repeat ? s_timings.repeated[Op] : s_timings.other[Op];
+
+		// NOTE(rksouthee): Every repetition moves si and di by a whole element, so every one of them pays the same
+		// penalty for transferring words. Segments start at even addresses, the offsets alone decide it.
+		std::uint32_t penalty = 0;
+		if constexpr (W)
 		{
-			// register,register
-			ctx.clocks += 2;
+			if (reads_si) penalty += sim86::get_word_transfer_penalty(ctx.cpu, ctx.registers[6]);
+			if (uses_di) penalty += sim86::get_word_transfer_penalty(ctx.cpu, ctx.registers[7]);
 		}
-		else
+
+		const std::uint32_t count = repeat ? ctx.registers[1] : 1;
+		const std::uint32_t done = count ? repeat_string<Op, W, Watch>(inst, count, (inst.flags & sim86::Instruction_repne) == 0, ctx) : 0;
+		if (repeat) ctx.registers[1] = static_cast<std::uint16_t>(count - done);
+		ctx.repetitions = done;
+		ctx.penalty_clocks = done * penalty;
+		ctx.clocks += timing.clocks + done * timing.repeat_clocks + ctx.penalty_clocks;
+	}
+
+#define STRING_EXECUTOR(op)\
+	EXECUTE_FN(op)\
+	{\
+		if (inst.w) string_instruction<sim86::Operation_##op, true, Watch>(inst, ctx);\
+		else string_instruction<sim86::Operation_##op, false, Watch>(inst, ctx);\
+	}
+	STRING_EXECUTOR(movs)
+	STRING_EXECUTOR(cmps)
+	STRING_EXECUTOR(scas)
+	STRING_EXECUTOR(lods)
+	STRING_EXECUTOR(stos)
+#undef STRING_EXECUTOR
+
+#define BINARY_FORMS(B, op)\
+	B(op##_reg_reg_8, op, reg_reg, false)\
+	B(op##_reg_reg_16, op, reg_reg, true)\
+	B(op##_reg_mem_8, op, reg_mem, false)\
+	B(op##_reg_mem_16, op, reg_mem, true)\
+	B(op##_mem_reg_8, op, mem_reg, false)\
+	B(op##_mem_reg_16, op, mem_reg, true)\
+	B(op##_reg_immed_8, op, reg_immed, false)\
+	B(op##_reg_immed_16, op, reg_immed, true)\
+	B(op##_mem_immed_8, op, mem_immed, false)\
+	B(op##_mem_immed_16, op, mem_immed, true)
+
+#define UNARY_FORMS(B, op)\
+	B(op##_reg_8, op, reg, false)\
+	B(op##_reg_16, op, reg, true)\
+	B(op##_mem_8, op, mem, false)\
+	B(op##_mem_16, op, mem, true)
+
+	// NOTE(rksouthee): X lists the plain executors, B the instantiations of binary with the operation, form and
+	// width they are specialized on and F the same instantiations fused with the conditional jump after them.
+#define HANDLERS(X, B, F)\
+	X(noop)\
+	X(hlt)\
+	X(jcc)\
+	X(loop)\
+	X(loope)\
+	X(loopne)\
+	X(jcxz)\
+	X(flag)\
+	X(pushf)\
+	X(popf)\
+	X(movs)\
+	X(cmps)\
+	X(scas)\
+	X(lods)\
+	X(stos)\
+	X(mov_segment)\
+	BINARY_FORMS(B, mov)\
+	B(mov_acc_mem_8, mov, acc_mem, false)\
+	B(mov_acc_mem_16, mov, acc_mem, true)\
+	B(mov_mem_acc_8, mov, mem_acc, false)\
+	B(mov_mem_acc_16, mov, mem_acc, true)\
+	BINARY_FORMS(B, add)\
+	BINARY_FORMS(B, sub)\
+	BINARY_FORMS(B, cmp)\
+	UNARY_FORMS(B, inc)\
+	UNARY_FORMS(B, dec)\
+	F(cmp_reg_reg_16_jcc, cmp, reg_reg, true)\
+	F(cmp_reg_mem_16_jcc, cmp, reg_mem, true)\
+	F(cmp_mem_reg_16_jcc, cmp, mem_reg, true)\
+	F(cmp_reg_immed_8_jcc, cmp, reg_immed, false)\
+	F(cmp_reg_immed_16_jcc, cmp, reg_immed, true)\
+	F(cmp_mem_immed_8_jcc, cmp, mem_immed, false)\
+	F(cmp_mem_immed_16_jcc, cmp, mem_immed, true)\
+	F(sub_reg_reg_16_jcc, sub, reg_reg, true)\
+	F(sub_reg_immed_16_jcc, sub, reg_immed, true)\
+	F(add_reg_reg_16_jcc, add, reg_reg, true)\
+	F(add_reg_immed_16_jcc, add, reg_immed, true)\
+	F(dec_reg_16_jcc, dec, reg, true)\
+	F(inc_reg_16_jcc, inc, reg, true)
+
+#define HANDLER_ENUM(name) Handler_##name,
+#define BINARY_HANDLER_ENUM(name, op, form, w) Handler_##name,
+	enum Handler : std::uint8_t
+	{
+		HANDLERS(HANDLER_ENUM, BINARY_HANDLER_ENUM, BINARY_HANDLER_ENUM)
+		Handler_count,
+	};
+
+	struct Binary_handlers
+	{
+		Handler handlers[sim86::Operation_count][Form_count][2];
+		Handler fused[Handler_count]; // the fused variant of each handler, or the handler itself
+	};
+
+	constexpr Binary_handlers build_binary_handlers()
+	{
+		Binary_handlers result{};
+		for (auto& forms : result.handlers)
+		{
+			for (auto& widths : forms)
+			{
+				widths[0] = Handler_noop;
+				widths[1] = Handler_noop;
+			}
+		}
+		for (std::size_t i = 0; i < Handler_count; ++i)
 		{
-			// memory,register
-			ctx.clocks += 9;
+			result.fused[i] = static_cast<Handler>(i);
 		}
+#define BINARY_HANDLER_ENTRY(name, op, form, w) result.handlers[sim86::Operation_##op][Form_##form][w] = Handler_##name;
+#define FUSED_HANDLER_ENTRY(name, op, form, w) result.fused[result.handlers[sim86::Operation_##op][Form_##form][w]] = Handler_##name;
+#define IGNORE_HANDLER(...)
+		HANDLERS(IGNORE_HANDLER, BINARY_HANDLER_ENTRY, IGNORE_HANDLER)
+		HANDLERS(IGNORE_HANDLER, IGNORE_HANDLER, FUSED_HANDLER_ENTRY)
+#undef IGNORE_HANDLER
+#undef FUSED_HANDLER_ENTRY
+#undef BINARY_HANDLER_ENTRY
+		return result;
 	}
 
-	EXECUTE_FN(mov_reg_rm_16)
+	constexpr Binary_handlers s_binary_handlers = build_binary_handlers();
+
+	bool is_memory(const sim86::Operand& operand)
 	{
-		const std::uint8_t mod = first[1] >> 6;
-		const std::uint8_t reg = (first[1] >> 3) & 0x7;
-		const std::uint8_t r_m = first[1] & 0x7;
-		first += 2;
-		const std::uint8_t* src = get_address(mod, r_m, first, last, ctx);
-		auto* dst = reinterpret_cast<std::uint8_t*>(&ctx.registers[reg]);
-		dst[0] = src[0];
-		dst[1] = src[1];
-		if (mod == 0b11)
+		return operand.type == sim86::Operand_memory || operand.type == sim86::Operand_direct;
+	}
+
+	// A segment register is timed as any other word register
+	bool is_register(const sim86::Operand& operand)
+	{
+		return operand.type == sim86::Operand_register || operand.type == sim86::Operand_segment;
+	}
+
+	// The kinds of destination and source of an arithmetic instruction or a move, false for any other operands
+	bool get_form(const sim86::Instruction& inst, Form& form)
+	{
+		const sim86::Operand& dst = inst.operands[0];
+		const sim86::Operand& src = inst.operands[1];
+		if (inst.opcode >= 0xa0 && inst.opcode <= 0xa3)
 		{
-			// register,register
-			ctx.clocks += 2;
+			form = dst.type == sim86::Operand_register ? Form_acc_mem : Form_mem_acc;
+		}
+		else if (is_register(dst))
+		{
+			if (src.type == sim86::Operand_none) form = Form_reg;
+			else if (is_register(src)) form = Form_reg_reg;
+			else if (is_memory(src)) form = Form_reg_mem;
+			else if (src.type == sim86::Operand_immediate) form = Form_reg_immed;
+			else return false;
+		}
+		else if (is_memory(dst))
+		{
+			if (src.type == sim86::Operand_none) form = Form_mem;
+			else if (is_register(src)) form = Form_mem_reg;
+			else if (src.type == sim86::Operand_immediate) form = Form_mem_immed;
+			else return false;
 		}
 		else
 		{
-			// register,memory
-			ctx.clocks += 8;
-		}
-	}
-
-	const Execute_fn s_executors[256] =
-	{
-		/* 0x00 */ noop,
-		/* 0x01 */ add_rm_reg_16,
-		/* 0x02 */ noop,
-		/* 0x03 */ noop,
-		/* 0x04 */ noop,
-		/* 0x05 */ noop,
-		/* 0x06 */ noop,
-		/* 0x07 */ noop,
-		/* 0x08 */ noop,
-		/* 0x09 */ noop,
-		/* 0x0a */ noop,
-		/* 0x0b */ noop,
-		/* 0x0c */ noop,
-		/* 0x0d */ noop,
-		/* 0x0e */ noop,
-		/* 0x0f */ noop,
-		/* 0x10 */ noop,
-		/* 0x11 */ noop,
-		/* 0x12 */ noop,
-		/* 0x13 */ noop,
-		/* 0x14 */ noop,
-		/* 0x15 */ noop,
-		/* 0x16 */ noop,
-		/* 0x17 */ noop,
-		/* 0x18 */ noop,
-		/* 0x19 */ noop,
-		/* 0x1a */ noop,
-		/* 0x1b */ noop,
-		/* 0x1c */ noop,
-		/* 0x1d */ noop,
-		/* 0x1e */ noop,
-		/* 0x1f */ noop,
-		/* 0x20 */ noop,
-		/* 0x21 */ noop,
-		/* 0x22 */ noop,
-		/* 0x23 */ noop,
-		/* 0x24 */ noop,
-		/* 0x25 */ noop,
-		/* 0x26 */ noop,
-		/* 0x27 */ noop,
-		/* 0x28 */ noop,
-		/* 0x29 */ sub_rm_reg_16,
-		/* 0x2a */ noop,
-		/* 0x2b */ noop,
-		/* 0x2c */ noop,
-		/* 0x2d */ noop,
-		/* 0x2e */ noop,
-		/* 0x2f */ noop,
-		/* 0x30 */ noop,
-		/* 0x31 */ noop,
-		/* 0x32 */ noop,
-		/* 0x33 */ noop,
-		/* 0x34 */ noop,
-		/* 0x35 */ noop,
-		/* 0x36 */ noop,
-		/* 0x37 */ noop,
-		/* 0x38 */ noop,
-		/* 0x39 */ cmp_rm_reg_16,
-		/* 0x3a */ noop,
-		/* 0x3b */ noop,
-		/* 0x3c */ noop,
-		/* 0x3d */ noop,
-		/* 0x3e */ noop,
-		/* 0x3f */ noop,
-		/* 0x40 */ noop,
-		/* 0x41 */ noop,
-		/* 0x42 */ noop,
-		/* 0x43 */ noop,
-		/* 0x44 */ noop,
-		/* 0x45 */ noop,
-		/* 0x46 */ noop,
-		/* 0x47 */ noop,
-		/* 0x48 */ noop,
-		/* 0x49 */ noop,
-		/* 0x4a */ noop,
-		/* 0x4b */ noop,
-		/* 0x4c */ noop,
-		/* 0x4d */ noop,
-		/* 0x4e */ noop,
-		/* 0x4f */ noop,
-		/* 0x50 */ noop,
-		/* 0x51 */ noop,
-		/* 0x52 */ noop,
-		/* 0x53 */ noop,
-		/* 0x54 */ noop,
-		/* 0x55 */ noop,
-		/* 0x56 */ noop,
-		/* 0x57 */ noop,
-		/* 0x58 */ noop,
-		/* 0x59 */ noop,
-		/* 0x5a */ noop,
-		/* 0x5b */ noop,
-		/* 0x5c */ noop,
-		/* 0x5d */ noop,
-		/* 0x5e */ noop,
-		/* 0x5f */ noop,
-		/* 0x60 */ noop,
-		/* 0x61 */ noop,
-		/* 0x62 */ noop,
-		/* 0x63 */ noop,
-		/* 0x64 */ noop,
-		/* 0x65 */ noop,
-		/* 0x66 */ noop,
-		/* 0x67 */ noop,
-		/* 0x68 */ noop,
-		/* 0x69 */ noop,
-		/* 0x6a */ noop,
-		/* 0x6b */ noop,
-		/* 0x6c */ noop,
-		/* 0x6d */ noop,
-		/* 0x6e */ noop,
-		/* 0x6f */ noop,
-		/* 0x70 */ noop,
-		/* 0x71 */ noop,
-		/* 0x72 */ noop,
-		/* 0x73 */ noop,
-		/* 0x74 */ noop,
-		/* 0x75 */ jnz_short_label,
-		/* 0x76 */ noop,
-		/* 0x77 */ noop,
-		/* 0x78 */ noop,
-		/* 0x79 */ noop,
-		/* 0x7a */ noop,
-		/* 0x7b */ noop,
-		/* 0x7c */ noop,
-		/* 0x7d */ noop,
-		/* 0x7e */ noop,
-		/* 0x7f */ noop,
-		/* 0x80 */ noop,
-		/* 0x81 */ op_rm_imm_16,
-		/* 0x82 */ noop,
-		/* 0x83 */ op_rm16_immed8,
-		/* 0x84 */ noop,
-		/* 0x85 */ noop,
-		/* 0x86 */ noop,
-		/* 0x87 */ noop,
-		/* 0x88 */ noop,
-		/* 0x89 */ mov_rm_reg_16,
-		/* 0x8a */ noop,
-		/* 0x8b */ mov_reg_rm_16,
-		/* 0x8c */ noop,
-		/* 0x8d */ noop,
-		/* 0x8e */ noop,
-		/* 0x8f */ noop,
-		/* 0x90 */ noop,
-		/* 0x91 */ noop,
-		/* 0x92 */ noop,
-		/* 0x93 */ noop,
-		/* 0x94 */ noop,
-		/* 0x95 */ noop,
-		/* 0x96 */ noop,
-		/* 0x97 */ noop,
-		/* 0x98 */ noop,
-		/* 0x99 */ noop,
-		/* 0x9a */ noop,
-		/* 0x9b */ noop,
-		/* 0x9c */ noop,
-		/* 0x9d */ noop,
-		/* 0x9e */ noop,
-		/* 0x9f */ noop,
-		/* 0xa0 */ noop,
-		/* 0xa1 */ noop,
-		/* 0xa2 */ noop,
-		/* 0xa3 */ noop,
-		/* 0xa4 */ noop,
-		/* 0xa5 */ noop,
-		/* 0xa6 */ noop,
-		/* 0xa7 */ noop,
-		/* 0xa8 */ noop,
-		/* 0xa9 */ noop,
-		/* 0xaa */ noop,
-		/* 0xab */ noop,
-		/* 0xac */ noop,
-		/* 0xad */ noop,
-		/* 0xae */ noop,
-		/* 0xaf */ noop,
-		/* 0xb0 */ noop,
-		/* 0xb1 */ noop,
-		/* 0xb2 */ noop,
-		/* 0xb3 */ noop,
-		/* 0xb4 */ noop,
-		/* 0xb5 */ noop,
-		/* 0xb6 */ noop,
-		/* 0xb7 */ noop,
-		/* 0xb8 */ mov_ax_immed_16,
-		/* 0xb9 */ mov_cx_immed_16,
-		/* 0xba */ mov_dx_immed_16,
-		/* 0xbb */ mov_bx_immed_16,
-		/* 0xbc */ mov_sp_immed_16,
-		/* 0xbd */ mov_bp_immed_16,
-		/* 0xbe */ mov_si_immed_16,
-		/* 0xbf */ mov_di_immed_16,
-		/* 0xc0 */ noop,
-		/* 0xc1 */ noop,
-		/* 0xc2 */ noop,
-		/* 0xc3 */ noop,
-		/* 0xc4 */ noop,
-		/* 0xc5 */ noop,
-		/* 0xc6 */ mov_mem_immed_8,
-		/* 0xc7 */ mov_mem_immed_16,
-		/* 0xc8 */ noop,
-		/* 0xc9 */ noop,
-		/* 0xca */ noop,
-		/* 0xcb */ noop,
-		/* 0xcc */ noop,
-		/* 0xcd */ noop,
-		/* 0xce */ noop,
-		/* 0xcf */ noop,
-		/* 0xd0 */ noop,
-		/* 0xd1 */ noop,
-		/* 0xd2 */ noop,
-		/* 0xd3 */ noop,
-		/* 0xd4 */ noop,
-		/* 0xd5 */ noop,
-		/* 0xd6 */ noop,
-		/* 0xd7 */ noop,
-		/* 0xd8 */ noop,
-		/* 0xd9 */ noop,
-		/* 0xda */ noop,
-		/* 0xdb */ noop,
-		/* 0xdc */ noop,
-		/* 0xdd */ noop,
-		/* 0xde */ noop,
-		/* 0xdf */ noop,
-		/* 0xe0 */ noop,
-		/* 0xe1 */ noop,
-		/* 0xe2 */ noop,
-		/* 0xe3 */ noop,
-		/* 0xe4 */ noop,
-		/* 0xe5 */ noop,
-		/* 0xe6 */ noop,
-		/* 0xe7 */ noop,
-		/* 0xe8 */ noop,
-		/* 0xe9 */ noop,
-		/* 0xea */ noop,
-		/* 0xeb */ noop,
-		/* 0xec */ noop,
-		/* 0xed */ noop,
-		/* 0xee */ noop,
-		/* 0xef */ noop,
-		/* 0xf0 */ noop,
-		/* 0xf1 */ noop,
-		/* 0xf2 */ noop,
-		/* 0xf3 */ noop,
-		/* 0xf4 */ noop,
-		/* 0xf5 */ noop,
-		/* 0xf6 */ noop,
-		/* 0xf7 */ noop,
-		/* 0xf8 */ noop,
-		/* 0xf9 */ noop,
-		/* 0xfa */ noop,
-		/* 0xfb */ noop,
-		/* 0xfc */ noop,
-		/* 0xfd */ noop,
-		/* 0xfe */ noop,
-		/* 0xff */ noop,
-	};
+			return false;
+		}
+		return true;
+	}
+
+	// Chooses the executor once, when the instruction is decoded into the cache
+	Handler select_handler(const sim86::Instruction& inst)
+	{
+		switch (inst.operation)
+		{
+		case sim86::Operation_hlt:
+			return Handler_hlt;
+		case sim86::Operation_loop:
+			return Handler_loop;
+		case sim86::Operation_loope:
+			return Handler_loope;
+		case sim86::Operation_loopne:
+			return Handler_loopne;
+		case sim86::Operation_jcxz:
+			return Handler_jcxz;
+		case sim86::Operation_clc:
+		case sim86::Operation_cmc:
+		case sim86::Operation_stc:
+		case sim86::Operation_cld:
+		case sim86::Operation_std:
+		case sim86::Operation_cli:
+		case sim86::Operation_sti:
+		case sim86::Operation_lahf:
+		case sim86::Operation_sahf:
+			return Handler_flag;
+		case sim86::Operation_pushf:
+			return Handler_pushf;
+		case sim86::Operation_popf:
+			return Handler_popf;
+		case sim86::Operation_movs:
+			return Handler_movs;
+		case sim86::Operation_cmps:
+			return Handler_cmps;
+		case sim86::Operation_scas:
+			return Handler_scas;
+		case sim86::Operation_lods:
+			return Handler_lods;
+		case sim86::Operation_stos:
+			return Handler_stos;
+		case sim86::Operation_mov:
+			if (inst.operands[0].type == sim86::Operand_segment || inst.operands[1].type == sim86::Operand_segment) return Handler_mov_segment;
+			break;
+		case sim86::Operation_add:
+		case sim86::Operation_sub:
+		case sim86::Operation_cmp:
+		case sim86::Operation_inc:
+		case sim86::Operation_dec:
+			break;
+		default:
+			return is_conditional_jump(inst.operation) ? Handler_jcc : Handler_noop;
+		}
+
+		Form form;
+		if (!get_form(inst, form)) return Handler_noop;
+		return s_binary_handlers.handlers[inst.operation][form][inst.w];
+	}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIM86_THREADED_DISPATCH 1
+#else
+#define SIM86_THREADED_DISPATCH 0
+#endif
+
+	// NOTE(rksouthee): The segment the memory operands of a cached instruction are in is settled once, that of a
+	// string instruction is the segment of its source.
+	void decode_into(sim86::Decoded_instruction& decoded, const sim86::Instruction& inst)
+	{
+		decoded.instruction = inst;
+		const sim86::Operand& operand = is_memory(inst.operands[1]) ? inst.operands[1] : inst.operands[0];
+		decoded.instruction.segment = sim86::get_segment(inst, operand);
+		decoded.handler = select_handler(inst);
+		decoded.fused_handler = decoded.handler;
+	}
+
+	// NOTE(rksouthee): An instruction is fused with a conditional jump straight after it, which is cached at its own
+	// address as well. Only unprefixed instructions are fused, so a write to the jump is always near enough to
+	// invalidate the instruction before it too.
+	void predecode(sim86::Context& ctx, const std::ptrdiff_t ip, const std::ptrdiff_t end)
+	{
+		sim86::Decoded_instruction& inst = ctx.decoded[ip];
+		decode_into(inst, sim86::fetch(ctx, ip, end));
+		const Handler fused = s_binary_handlers.fused[inst.handler];
+		if (fused == inst.handler || inst.instruction.flags != 0) return;
+
+		const std::ptrdiff_t next_ip = ip + inst.instruction.size;
+		if (next_ip >= end) return;
+		const sim86::Instruction next = sim86::fetch(ctx, next_ip, end);
+		if (!is_conditional_jump(next.operation)) return;
+		sim86::Decoded_instruction& jump = ctx.decoded[next_ip];
+		if (jump.instruction.size == 0) decode_into(jump, next);
+		inst.fused_handler = fused;
+	}
+
+	void count_instruction(const sim86::Context& ctx, const std::ptrdiff_t ip)
+	{
+		sim86::Profile_counters& counters = ctx.profile->counters[ip];
+		++counters.count;
+		counters.clocks += ctx.clocks;
+		counters.ea_clocks += ctx.ea_clocks;
+	}
+
+	sim86::Run_result stop_at_watchpoint(sim86::Context& ctx, const std::ptrdiff_t ip, const std::uint64_t count)
+	{
+		ctx.debug->hit_ip = ip;
+		return { sim86::Stop_reason::watchpoint, count };
+	}
+
+	// NOTE(rksouthee): The run is specialized on tracing, profiling and which of the breakpoints and watchpoints it
+	// checks, so that each costs nothing in a run that doesn't use it.
+	template <bool Trace, bool Profile, bool Break, bool Watch>
+	sim86::Run_result run_loop(sim86::Context& ctx, const sim86::Limits& limits, const sim86::Trace_fn& trace)
+	{
+		const std::ptrdiff_t end = limits.end;
+		const std::uint64_t max_instructions = limits.max_instructions ? limits.max_instructions : UINT64_MAX;
+		const std::uint64_t max_clocks = limits.max_clocks ? limits.max_clocks : UINT64_MAX;
+		std::uint64_t count = 0;
+		std::ptrdiff_t ip = 0;
+		sim86::Decoded_instruction* inst = nullptr;
+		std::uint8_t handler = Handler_noop;
+		std::uint32_t fused_clocks = 0;
+
+		// NOTE(rksouthee): With threaded dispatch every handler ends with its own copy of the fetch and indirect
+		// jump, which gives the branch predictor one jump site per handler instead of a single shared one.
+#if SIM86_THREADED_DISPATCH
+#define HANDLER_LABEL_ADDRESS(name) &&label_##name,
+#define BINARY_HANDLER_LABEL_ADDRESS(name, op, form, w) &&label_##name,
+		static void* const s_labels[] =
+		{
+			HANDLERS(HANDLER_LABEL_ADDRESS, BINARY_HANDLER_LABEL_ADDRESS, BINARY_HANDLER_LABEL_ADDRESS)
+		};
+#define DISPATCH() goto *s_labels[handler]
+#define HANDLER_LABEL(name) label_##name:
+#else
+#define DISPATCH() goto dispatch
+#define HANDLER_LABEL(name) case Handler_##name:
+#endif
+
+#define NEXT()\
+		do\
+		{\
+			if (count == max_instructions) return { sim86::Stop_reason::instruction_limit, count };\
+			if (ctx.total_clocks >= max_clocks) return { sim86::Stop_reason::clock_limit, count };\
+			if (ctx.ip < 0 || ctx.ip >= end) return { sim86::Stop_reason::end_of_program, count };\
+			if constexpr (Break) if (ctx.debug->breakpoints[ctx.ip] && count != 0) return { sim86::Stop_reason::breakpoint, count };\
+			ip = ctx.ip;\
+			inst = &ctx.decoded[ip];\
+			if (inst->instruction.size == 0) predecode(ctx, ip, end);\
+			if (inst->instruction.operation == sim86::Operation_none) return { sim86::Stop_reason::invalid_instruction, count };\
+			SIM86_COUNT(ctx, ++counters.opcodes[inst->instruction.opcode]; ++counters.operations[inst->instruction.operation]);\
+			ctx.ip += inst->instruction.size;\
+			ctx.clocks = 0;\
+			ctx.ea_clocks = 0;\
+			ctx.penalty_clocks = 0;\
+			/* NOTE(rksouthee): Tracing, profiling and the last instruction before the limit see each instruction on its own */\
+			handler = Trace || Profile || max_instructions - count < 2 ? inst->handler : inst->fused_handler;\
+			DISPATCH();\
+		}\
+		while (0)
+
+#define EXECUTE_BLOCK(name, executor)\
+		HANDLER_LABEL(name)\
+		executor(inst->instruction, ctx);\
+		ctx.total_clocks += ctx.clocks;\
+		++count;\
+		if constexpr (Profile) count_instruction(ctx, ip);\
+		if constexpr (Trace) trace(ctx, ip, inst->instruction);\
+		if constexpr (Watch) if (ctx.debug->hit) return stop_at_watchpoint(ctx, ip, count);\
+		if (Handler_##name == Handler_hlt) return { sim86::Stop_reason::halt, count };\
+		NEXT();
+#define HANDLER_BLOCK(name) EXECUTE_BLOCK(name, name<Watch>)
+#define BINARY_HANDLER_BLOCK(name, op, form, w) EXECUTE_BLOCK(name, (binary<sim86::Operation_##op, Form_##form, w, Watch>))
+		// NOTE(rksouthee): The jump is only run here if the write of the instruction before it left it in the cache,
+		// both are charged their own clocks and ctx.clocks ends up with the sum. A breakpoint on the jump is left to
+		// NEXT.
+#define FUSED_HANDLER_BLOCK(name, op, form, w)\
+		HANDLER_LABEL(name)\
+		binary<sim86::Operation_##op, Form_##form, w, Watch>(inst->instruction, ctx);\
+		ctx.total_clocks += ctx.clocks;\
+		++count;\
+		if constexpr (Watch) if (ctx.debug->hit) return stop_at_watchpoint(ctx, ip, count);\
+		if (ctx.total_clocks >= max_clocks) return { sim86::Stop_reason::clock_limit, count };\
+		inst = &ctx.decoded[ctx.ip];\
+		if (inst->instruction.size == 0 || inst->handler != Handler_jcc || (Break && ctx.debug->breakpoints[ctx.ip])) NEXT();\
+		fused_clocks = ctx.clocks;\
+		ctx.ip += inst->instruction.size;\
+		SIM86_COUNT(ctx, ++counters.opcodes[inst->instruction.opcode]; ++counters.operations[inst->instruction.operation]);\
+		fused_jcc<w>(inst->instruction, ctx);\
+		ctx.total_clocks += ctx.clocks;\
+		ctx.clocks += fused_clocks;\
+		++count;\
+		NEXT();
+
+		NEXT();
+#if SIM86_THREADED_DISPATCH
+		HANDLERS(HANDLER_BLOCK, BINARY_HANDLER_BLOCK, FUSED_HANDLER_BLOCK)
+#else
+	dispatch:
+		switch (handler)
+		{
+			HANDLERS(HANDLER_BLOCK, BINARY_HANDLER_BLOCK, FUSED_HANDLER_BLOCK)
+		}
+#endif
+		return { sim86::Stop_reason::end_of_program, count };
+
+#undef FUSED_HANDLER_BLOCK
+#undef BINARY_HANDLER_BLOCK
+#undef HANDLER_BLOCK
+#undef EXECUTE_BLOCK
+#undef NEXT
+#undef HANDLER_LABEL
+#undef DISPATCH
+	}
+
+	// NOTE(rksouthee): Breakpoints are checked whenever the run is debugged and watchpoints when there are some. A
+	// traced or profiled run already goes an instruction at a time, it checks both rather than having a loop for
+	// each.
+	template <bool Trace, bool Profile>
+	sim86::Run_result run_debugged(sim86::Context& ctx, const sim86::Limits& limits, const sim86::Trace_fn& trace)
+	{
+		if (!ctx.debug) return run_loop<Trace, Profile, false, false>(ctx, limits, trace);
+		ctx.debug->hit = false;
+		if constexpr (!Trace && !Profile)
+		{
+			if (ctx.debug->watchpoints.empty()) return run_loop<false, false, true, false>(ctx, limits, trace);
+		}
+		return run_loop<Trace, Profile, true, true>(ctx, limits, trace);
+	}
 }
 
 namespace sim86
 {
-	void execute(const std::uint8_t* first, const std::uint8_t* last, Context& ctx)
+	std::uint16_t get_memory_address(const Operand& operand, const std::uint16_t* registers)
+	{
+		if (operand.type == Operand_direct) return operand.value;
+		return static_cast<std::uint16_t>(get_effective_address(operand.reg, registers) + operand.value);
+	}
+
+	Instruction fetch(const Context& ctx, const std::ptrdiff_t ip, const std::ptrdiff_t end)
 	{
-		if (first == last) return;
-		ctx.clocks = 0;
-		s_executors[*first](first, last, ctx);
-		ctx.total_clocks += ctx.clocks;
+		const std::uint32_t addr = get_physical_address(ctx.segments[Segment_cs], static_cast<std::uint16_t>(ip));
+		constexpr std::ptrdiff_t max_fetch_size = max_instruction_size;
+		const std::size_t size = static_cast<std::size_t>(std::min(end - ip, max_fetch_size));
+		if (addr + size <= memory_size) return decode(ctx.memory.data() + addr, ctx.memory.data() + addr + size);
+		std::uint8_t bytes[max_fetch_size];
+		for (std::size_t i = 0; i < size; ++i) bytes[i] = ctx.memory[(addr + i) & (memory_size - 1)];
+		return decode(bytes, bytes + size);
+	}
+
+	Segment get_segment(const Instruction& inst, const Operand& operand)
+	{
+		if (inst.flags & Instruction_segment) return static_cast<Segment>(inst.segment);
+		// bp+si, bp+di and bp+disp
+		if (operand.type == Operand_memory && (operand.reg == 2 || operand.reg == 3 || operand.reg == 6)) return Segment_ss;
+		return Segment_ds;
+	}
+
+	Timing get_timing(const Instruction& inst)
+	{
+		if (s_timings.repeated[inst.operation].repeat_clocks != 0 && (inst.flags & (Instruction_rep | Instruction_repne)))
+		{
+			return s_timings.repeated[inst.operation];
+		}
+		if (s_timings.other[inst.operation].clocks != 0) return s_timings.other[inst.operation];
+		Form form;
+		if (!get_form(inst, form)) return {};
+		return s_timings.binary[inst.operation][form][inst.w];
+	}
+
+	Run_result run(Context& ctx, const Limits& limits, const Trace_fn& trace)
+	{
+		if (ctx.profile)
+		{
+			if (trace) return run_debugged<true, true>(ctx, limits, trace);
+			return run_debugged<false, true>(ctx, limits, trace);
+		}
+		if (trace) return run_debugged<true, false>(ctx, limits, trace);
+		return run_debugged<false, false>(ctx, limits, trace);
 	}
 }
@@ -1,24 +1,221 @@
 #pragma once
 
+#include "decoder.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
 
 namespace sim86
 {
+	class Cache;
+	struct Counters;
+	struct Debug;
+	class History;
+	struct Profile;
+	struct Snapshot;
+
+	// The granularity at which writes are tracked and snapshots share or copy memory
+	constexpr std::size_t snapshot_page_size = 256;
+	constexpr std::size_t page_count = memory_size / snapshot_page_size;
+
+	// NOTE(rksouthee): A bit for each page of memory. It's scanned a word at a time, so the few pages a run writes
+	// are found without looking at each of the others.
+	struct Page_set
+	{
+		std::uint64_t words[page_count / 64];
+
+		void insert(const std::size_t page) { words[page / 64] |= std::uint64_t{ 1 } << (page % 64); }
+		[[nodiscard]] bool contains(const std::size_t page) const { return (words[page / 64] >> (page % 64)) & 1; }
+		void clear() { std::fill(std::begin(words), std::end(words), 0); }
+
+		// Calls fn with each page in the set, lowest first
+		template <typename Fn>
+		void for_each(Fn&& fn) const
+		{
+			for (std::size_t word = 0; word < std::size(words); ++word)
+			{
+				for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+				{
+					fn(word * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+				}
+			}
+		}
+	};
+
+	// The bytes an offset reaches from the base of a segment
+	constexpr std::size_t segment_size = 0x10000;
+
+	// The segment registers in the order of the sr field
+	enum Segment : std::uint8_t
+	{
+		Segment_es,
+		Segment_cs,
+		Segment_ss,
+		Segment_ds,
+	};
+
+	// NOTE(rksouthee): An address past the end of memory wraps around to its start, as it does with 20 address lines
+	constexpr std::uint32_t get_physical_address(const std::uint16_t segment, const std::uint16_t offset)
+	{
+		return ((static_cast<std::uint32_t>(segment) << 4) + offset) & (memory_size - 1);
+	}
+
+	// The processor whose timings are used, they only differ in the width of the bus
+	enum Cpu : std::uint8_t
+	{
+		Cpu_8086,
+		Cpu_8088,
+	};
+
+	struct Timing
+	{
+		std::uint8_t clocks; // excluding the effective address calculation and transfer penalties, jumps when taken
+		std::uint8_t not_taken_clocks; // jumps only
+		std::uint8_t transfers; // memory reads and writes, those of a word may pay get_word_transfer_penalty
+		std::uint8_t repeat_clocks; // string instructions with a rep prefix, each repetition adds these and transfers
+	};
+
+	struct Decoded_instruction
+	{
+		Instruction instruction; // size is zero when the slot has not been decoded yet
+		std::uint8_t handler; // index of the executor within simulator.cpp
+		std::uint8_t fused_handler; // an executor that also runs the conditional jump that follows, or handler
+	};
+
 	struct Context
 	{
-		enum Flags
+		// NOTE(rksouthee): The flags are in the positions pushf stores them in, which are also those of the host
+		// flags on x86.
+		enum Flags : std::uint16_t
+		{
+			Flags_carry = 0x0001,
+			Flags_parity = 0x0004,
+			Flags_auxiliary = 0x0010,
+			Flags_zero = 0x0040,
+			Flags_sign = 0x0080,
+			Flags_trap = 0x0100,
+			Flags_interrupt = 0x0200,
+			Flags_direction = 0x0400,
+			Flags_overflow = 0x0800,
+			Flags_arithmetic = Flags_carry | Flags_parity | Flags_auxiliary | Flags_zero | Flags_sign | Flags_overflow,
+		};
+		// The instruction that last set the arithmetic flags, which are computed from its operands when read
+		enum Flags_op : std::uint8_t
 		{
-			Flags_zero = 1,
-			Flags_sign = 2,
+			Flags_op_none, // the arithmetic flags are those in flags
+			Flags_op_add_8,
+			Flags_op_add_16,
+			Flags_op_sub_8,
+			Flags_op_sub_16,
+			Flags_op_inc_8, // as add 1 but leaving the carry flag alone
+			Flags_op_inc_16,
+			Flags_op_dec_8, // as sub 1 but leaving the carry flag alone
+			Flags_op_dec_16,
 		};
-		std::uint8_t memory[0x10000];
+		Memory memory;
+		// NOTE(rksouthee): Holds the pages of memory written since the last snapshot or restore, the others
+		// still match snapshot_base and are shared with it rather than copied again.
+		Page_set dirty_pages;
+		std::shared_ptr<const Snapshot> snapshot_base;
 		std::uint16_t registers[8];
+		std::uint16_t segments[4]; // es, cs, ss, ds
 		std::ptrdiff_t ip;
 		std::uint32_t clocks;
+		std::uint32_t ea_clocks; // of clocks, those spent calculating the effective address
+		std::uint32_t penalty_clocks; // of clocks, those added for transferring words
+		std::uint32_t repetitions; // those a string instruction with a rep prefix ran
 		std::uint32_t total_clocks;
-		Flags flags;
+		std::uint16_t flags; // use get_flag and get_flags, the arithmetic flags are stale unless flags_op is none
+		Flags_op flags_op;
+		std::uint16_t flags_dst;
+		std::uint16_t flags_src;
+		std::uint16_t flags_result;
+		// NOTE(rksouthee): Instructions are decoded the first time they are executed and cached by their offset in
+		// the code segment, writes through memory operands invalidate any cached instruction they overlap. Loading
+		// cs drops them all.
+		Decoded_instruction decoded[segment_size];
+		// NOTE(rksouthee): Set by the JIT to a map of the bytes of memory backing its compiled blocks, writes to any
+		// of them through get_address set code_modified so the blocks can be discarded.
+		const std::uint8_t* code_map;
+		bool code_modified;
+		// NOTE(rksouthee): Set to have run count each instruction, and its clocks, against the address it was fetched
+		// from. Instructions are then executed one at a time rather than fused.
+		Profile* profile;
+		// NOTE(rksouthee): Set to have run stop at breakpoints and watchpoints. The run is specialized on which of
+		// them it checks, one without any pays nothing for them.
+		Debug* debug;
+		// NOTE(rksouthee): Set to have every write to memory logged, with the bytes it overwrites, before it's made
+		History* history;
+		// NOTE(rksouthee): Set to have run count the instructions it executes by opcode, the effective addresses they
+		// calculate, the jumps they take and the bytes they move. Only a build with SIM86_COUNTERS counts anything.
+		Counters* counters;
+		// NOTE(rksouthee): Set to have every read and write of a memory operand fed to a cache model, which a traced
+		// run charges to the instruction that made it. The string instructions then move an element at a time.
+		Cache* cache;
+		Cpu cpu;
+	};
+
+	struct Limits
+	{
+		std::ptrdiff_t end; // execution stops when ip leaves [0, end), at most segment_size
+		std::uint64_t max_instructions; // zero for no limit
+		std::uint64_t max_clocks; // zero for no limit
+	};
+
+	enum class Stop_reason
+	{
+		halt,
+		end_of_program,
+		instruction_limit,
+		clock_limit,
+		invalid_instruction, // the instruction at ip is unknown or runs past the end of the program
+		breakpoint, // the instruction at ip has a breakpoint
+		watchpoint, // the instruction before ip touched a watchpoint
+	};
+
+	struct Run_result
+	{
+		Stop_reason reason;
+		std::uint64_t instructions;
 	};
 
-	void execute(const std::uint8_t* first, const std::uint8_t* last, Context& ctx);
+	// Called after each instruction with the address it was fetched from
+	using Trace_fn = std::function<void(const Context& ctx, std::ptrdiff_t ip, const Instruction& inst)>;
+
+	Run_result run(Context& ctx, const Limits& limits, const Trace_fn& trace = {});
+
+	std::uint32_t get_clocks_for_ea_components(std::uint8_t mod, std::uint8_t r_m);
+
+	// The timing of an instruction as the simulator executes it, all zero for those it skips
+	Timing get_timing(const Instruction& inst);
+
+	// NOTE(rksouthee): The 8086 transfers a word in one bus cycle unless it is at an odd address, the 8088 always
+	// takes two. Each extra bus cycle costs four clocks.
+	constexpr std::uint32_t get_word_transfer_penalty(const Cpu cpu, const std::uint32_t address)
+	{
+		return cpu == Cpu_8088 || (address & 1) ? 4 : 0;
+	}
+
+	// The offset of a memory or direct operand evaluated with the given register file
+	std::uint16_t get_memory_address(const Operand& operand, const std::uint16_t* registers);
+
+	// NOTE(rksouthee): The instruction at ip in the code segment, decoded from the bytes before end. They wrap around
+	// to the start of memory from the end of it, as the address lines do.
+	Instruction fetch(const Context& ctx, std::ptrdiff_t ip, std::ptrdiff_t end);
+
+	// The segment a memory or direct operand is in, ss for those based on bp and ds for the rest unless the
+	// instruction has a segment prefix
+	Segment get_segment(const Instruction& inst, const Operand& operand);
+
+	bool get_flag(const Context& ctx, Context::Flags flag);
+	// All of the flags as pushf would store them
+	std::uint16_t get_flags(const Context& ctx);
+	// Replaces all of the flags as popf would, discarding any pending arithmetic operation
+	void set_flags(Context& ctx, std::uint16_t flags);
 }
@@ -0,0 +1,112 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+	constexpr std::size_t s_leaf_count = sim86::page_count / sim86::Snapshot::leaf_pages;
+	static_assert(sim86::Snapshot::leaf_pages == 64 && s_leaf_count == std::size(sim86::Page_set{}.words));
+
+	// NOTE(rksouthee): Most of the address space is never written, its pages all share this one and its leaves
+	// this one
+	const std::shared_ptr<const sim86::Snapshot::Page> s_zero_page = std::make_shared<const sim86::Snapshot::Page>();
+	const std::shared_ptr<const sim86::Snapshot::Leaf> s_zero_leaf = []()
+	{
+		const std::shared_ptr<sim86::Snapshot::Leaf> leaf = std::make_shared<sim86::Snapshot::Leaf>();
+		leaf->fill(s_zero_page);
+		return leaf;
+	}();
+
+	std::shared_ptr<const sim86::Snapshot::Page> copy_page(const sim86::Context& ctx, const std::size_t page)
+	{
+		const std::uint8_t* const first = ctx.memory.data() + page * sim86::snapshot_page_size;
+		if (std::all_of(first, first + sim86::snapshot_page_size, [](const std::uint8_t b) { return b == 0; })) return s_zero_page;
+		const std::shared_ptr<sim86::Snapshot::Page> contents = std::make_shared<sim86::Snapshot::Page>();
+		std::copy(first, first + sim86::snapshot_page_size, contents->begin());
+		return contents;
+	}
+
+	void restore_page(sim86::Context& ctx, const std::size_t page, const sim86::Snapshot::Page& contents)
+	{
+		std::uint8_t* const first = ctx.memory.data() + page * sim86::snapshot_page_size;
+		// Leaves a page that never changed uncommitted
+		if (std::equal(contents.begin(), contents.end(), first)) return;
+		std::copy(contents.begin(), contents.end(), first);
+		// NOTE(rksouthee): Any cached instruction overlapping the page may have changed, including one that starts
+		// in the page before it.
+		const std::uint32_t code_base = sim86::get_physical_address(ctx.segments[sim86::Segment_cs], 0);
+		const std::uint32_t addr = static_cast<std::uint32_t>(page * sim86::snapshot_page_size);
+		for (std::uint32_t i = addr - (sim86::max_instruction_size - 1); i != addr + sim86::snapshot_page_size; ++i)
+		{
+			const std::uint32_t offset = (i - code_base) & (sim86::memory_size - 1);
+			if (offset < sim86::segment_size) ctx.decoded[offset].instruction.size = 0;
+		}
+	}
+}
+
+namespace sim86
+{
+	std::shared_ptr<const Snapshot> snapshot(Context& ctx)
+	{
+		const std::shared_ptr<Snapshot> result = std::make_shared<Snapshot>();
+		const Snapshot* const base = ctx.snapshot_base.get();
+		for (std::size_t leaf = 0; leaf < s_leaf_count; ++leaf)
+		{
+			const std::uint64_t dirty = ctx.dirty_pages.words[leaf];
+			if (base && dirty == 0)
+			{
+				result->leaves[leaf] = base->leaves[leaf];
+				continue;
+			}
+			const std::shared_ptr<Snapshot::Leaf> pages = std::make_shared<Snapshot::Leaf>();
+			bool zero = true;
+			for (std::size_t i = 0; i < Snapshot::leaf_pages; ++i)
+			{
+				if (base && !((dirty >> i) & 1)) (*pages)[i] = (*base->leaves[leaf])[i];
+				else (*pages)[i] = copy_page(ctx, leaf * Snapshot::leaf_pages + i);
+				zero = zero && (*pages)[i] == s_zero_page;
+			}
+			result->leaves[leaf] = zero ? s_zero_leaf : pages;
+		}
+		std::copy(std::begin(ctx.registers), std::end(ctx.registers), result->registers);
+		std::copy(std::begin(ctx.segments), std::end(ctx.segments), result->segments);
+		result->ip = ctx.ip;
+		result->flags = get_flags(ctx);
+		result->total_clocks = ctx.total_clocks;
+
+		ctx.dirty_pages.clear();
+		ctx.snapshot_base = result;
+		return result;
+	}
+
+	void restore(Context& ctx, const std::shared_ptr<const Snapshot>& snapshot)
+	{
+		const Snapshot* const base = ctx.snapshot_base.get();
+		for (std::size_t leaf = 0; leaf < s_leaf_count; ++leaf)
+		{
+			const std::uint64_t dirty = ctx.dirty_pages.words[leaf];
+			const Snapshot::Leaf& pages = *snapshot->leaves[leaf];
+			const Snapshot::Leaf* const current = base ? base->leaves[leaf].get() : nullptr;
+			if (current == &pages && dirty == 0) continue;
+			for (std::size_t i = 0; i < Snapshot::leaf_pages; ++i)
+			{
+				if (current && !((dirty >> i) & 1) && (*current)[i] == pages[i]) continue;
+				restore_page(ctx, leaf * Snapshot::leaf_pages + i, *pages[i]);
+			}
+		}
+		std::copy(std::begin(snapshot->registers), std::end(snapshot->registers), ctx.registers);
+		if (ctx.segments[Segment_cs] != snapshot->segments[Segment_cs])
+		{
+			for (Decoded_instruction& decoded : ctx.decoded) decoded.instruction.size = 0;
+		}
+		std::copy(std::begin(snapshot->segments), std::end(snapshot->segments), ctx.segments);
+		ctx.ip = snapshot->ip;
+		ctx.clocks = 0;
+		ctx.total_clocks = snapshot->total_clocks;
+		set_flags(ctx, snapshot->flags);
+
+		ctx.dirty_pages.clear();
+		ctx.snapshot_base = snapshot;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "simulator.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace sim86
+{
+	// An immutable copy of a context's memory and registers, pages with the same contents are shared between
+	// snapshots of the same context.
+	struct Snapshot
+	{
+		using Page = std::array<std::uint8_t, snapshot_page_size>;
+		// NOTE(rksouthee): The pages are grouped into leaves of a word of Context::dirty_pages each, a leaf with
+		// none of its pages written since the snapshot before is shared with it whole.
+		static constexpr std::size_t leaf_pages = 64;
+		using Leaf = std::array<std::shared_ptr<const Page>, leaf_pages>;
+
+		std::shared_ptr<const Leaf> leaves[page_count / leaf_pages];
+		std::uint16_t registers[8];
+		std::uint16_t segments[4];
+		std::ptrdiff_t ip;
+		std::uint16_t flags;
+		std::uint32_t total_clocks;
+
+		[[nodiscard]] const std::shared_ptr<const Page>& get_page(const std::size_t page) const
+		{
+			return (*leaves[page / leaf_pages])[page % leaf_pages];
+		}
+	};
+
+	// Copies only the pages written since the last snapshot or restore of ctx, the first snapshot copies them all
+	// except those still zero, which share a single page. The cost is in the leaves written, not the address space.
+	std::shared_ptr<const Snapshot> snapshot(Context& ctx);
+	// Copies back only the pages that differ from what ctx holds, ctx is then based on the snapshot
+	void restore(Context& ctx, const std::shared_ptr<const Snapshot>& snapshot);
+}
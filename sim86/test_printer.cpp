@@ -1,7 +1,33 @@
+#include "assembler.h"
+#include "batch.h"
+#include "cache.h"
+#include "counters.h"
+#include "debug.h"
+#include "disassembler.h"
+#include "estimate.h"
+#include "history.h"
+#include "jit.h"
+#include "prefetch.h"
 #include "printer.h"
+#include "profile.h"
+#include "simulator.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #include <catch2/catch_test_macros.hpp>
 
+#ifndef SIM86_TEST_DATA_DIR
+#define SIM86_TEST_DATA_DIR "data"
+#endif
+
 TEST_CASE("print mov", "[print]")
 {
 	{
@@ -35,3 +61,1026 @@ TEST_CASE("print mov", "[print]")
 		REQUIRE(result.code == "mov byte [bp+di],0x7");
 	}
 }
+
+TEST_CASE("decode", "[decode]")
+{
+	{
+		std::uint8_t data[5] = {0x83, 0x82, 0xe8, 0x03, 0xfd};
+		const sim86::Instruction inst = sim86::decode(data, data + 5);
+		REQUIRE(inst.size == 5);
+		REQUIRE(inst.operation == sim86::Operation_add);
+		REQUIRE(inst.w);
+		REQUIRE(inst.operands[0].type == sim86::Operand_memory);
+		REQUIRE(inst.operands[0].reg == 2);
+		REQUIRE(inst.operands[0].mod == 2);
+		REQUIRE(inst.operands[0].value == 0x3e8);
+		REQUIRE(inst.operands[1].type == sim86::Operand_immediate);
+		REQUIRE(inst.operands[1].value == 0xfffd);
+	}
+	{
+		std::uint8_t data[2] = {0x75, 0xfc};
+		const sim86::Instruction inst = sim86::decode(data, data + 2);
+		REQUIRE(inst.size == 2);
+		REQUIRE(inst.operation == sim86::Operation_jnz);
+		REQUIRE(inst.operands[0].type == sim86::Operand_relative);
+		REQUIRE(static_cast<std::int16_t>(inst.operands[0].value) == -4);
+		REQUIRE(sim86::print(inst) == "jnz $-0x2");
+	}
+	{
+		std::uint8_t data[3] = {0xb8, 0x01, 0x00};
+		const sim86::Instruction inst = sim86::decode(data, data + 2);
+		REQUIRE(inst.size == 1);
+		REQUIRE(inst.operation == sim86::Operation_none);
+		REQUIRE(sim86::print(inst) == "db 0xb8");
+	}
+}
+
+TEST_CASE("decode prefixes", "[decode]")
+{
+	{
+		std::uint8_t data[2] = {0xf3, 0xa5};
+		const sim86::Instruction inst = sim86::decode(data, data + 2);
+		REQUIRE(inst.size == 2);
+		REQUIRE(inst.operation == sim86::Operation_movs);
+		REQUIRE(inst.opcode == 0xa5);
+		REQUIRE(inst.flags == sim86::Instruction_rep);
+		REQUIRE(sim86::print(inst) == "rep movsw");
+	}
+	{
+		std::uint8_t data[3] = {0x26, 0x8a, 0x07};
+		const sim86::Instruction inst = sim86::decode(data, data + 3);
+		REQUIRE(inst.size == 3);
+		REQUIRE(inst.operation == sim86::Operation_mov);
+		REQUIRE(inst.flags == sim86::Instruction_segment);
+		REQUIRE(inst.segment == 0);
+		REQUIRE(sim86::print(inst) == "mov al,[es:bx]");
+	}
+	{
+		std::uint8_t data[5] = {0x9a, 0xc8, 0x01, 0x7b, 0x00};
+		const sim86::Instruction inst = sim86::decode(data, data + 5);
+		REQUIRE(inst.size == 5);
+		REQUIRE(inst.operation == sim86::Operation_call);
+		REQUIRE(inst.flags == sim86::Instruction_far);
+		REQUIRE(sim86::print(inst) == "call 0x7b:0x1c8");
+	}
+	{
+		// NOTE(rksouthee): A prefix with nothing after it is as truncated as any other instruction
+		std::uint8_t data[1] = {0xf0};
+		const sim86::Instruction inst = sim86::decode(data, data + 1);
+		REQUIRE(inst.size == 1);
+		REQUIRE(inst.operation == sim86::Operation_none);
+	}
+	{
+		// cs: cs: ... mov word [cs:0x200],0x1111, which the limit counts the operands of as well as the prefixes
+		std::uint8_t data[20] = {};
+		std::fill(data, data + 14, 0x2e);
+		const std::uint8_t mov[] = {0xc7, 0x06, 0x00, 0x02, 0x11, 0x11};
+		std::copy(std::begin(mov), std::end(mov), data + 14);
+		sim86::Instruction inst = sim86::decode(data, data + 20);
+		REQUIRE(inst.size == 1);
+		REQUIRE(inst.operation == sim86::Operation_none);
+		inst = sim86::decode(data + 5, data + 20);
+		REQUIRE(inst.size == sim86::max_instruction_size);
+		REQUIRE(inst.operation == sim86::Operation_mov);
+		REQUIRE(sim86::print(inst) == "mov word [cs:0x200],0x1111");
+	}
+}
+
+TEST_CASE("assemble", "[print]")
+{
+	{
+		std::uint8_t bytes[sim86::max_instruction_size];
+		const std::uint8_t expected[] = { 0xf0, 0x26, 0x83, 0x82, 0xe8, 0x03, 0xfd };
+		std::uint8_t* const last = sim86::assemble("lock add word [es:bp+si+0x3e8],byte +0xfd", bytes);
+		REQUIRE(last == bytes + std::size(expected));
+		REQUIRE(std::equal(bytes, last, expected));
+		REQUIRE(sim86::assemble("mov ax,", bytes) == nullptr);
+	}
+
+	// NOTE(rksouthee): The listings were assembled by nasm, so assembling what they disassemble to gives them back
+	// byte for byte
+	for (const char* const listing :
+	{
+		"listing_0037_single_register_mov",
+		"listing_0038_many_register_mov",
+		"listing_0039_more_movs",
+		"listing_0040_challenge_movs",
+		"listing_0041_add_sub_cmp_jnz",
+		"listing_0042_completionist_decode",
+	})
+	{
+		std::ifstream file(std::string(SIM86_TEST_DATA_DIR "/") + listing, std::ios::binary);
+		REQUIRE(file);
+		const std::vector<std::uint8_t> code{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+		std::ostringstream text;
+		{
+			sim86::Writer writer(text);
+			sim86::disassemble(code, writer, 1);
+		}
+		std::vector<std::uint8_t> assembled;
+		INFO(listing);
+		REQUIRE(sim86::assemble(text.str(), assembled) == 0);
+		REQUIRE(assembled == code);
+	}
+
+	// Random bytes aren't all encoded as nasm would, so they're compared by what they decode to rather than byte
+	// for byte
+	std::uint32_t seed = 7;
+	std::uint8_t code[sim86::max_instruction_size + 6];
+	std::uint8_t bytes[sim86::max_instruction_size];
+	for (int count = 0; count < 100000;)
+	{
+		for (std::uint8_t& b : code)
+		{
+			seed = seed * 1664525 + 1013904223;
+			b = static_cast<std::uint8_t>(seed >> 24);
+		}
+		const sim86::Instruction inst = sim86::decode(code, code + std::size(code));
+		const bool has_memory = inst.operands[0].type == sim86::Operand_memory || inst.operands[0].type == sim86::Operand_direct
+			|| inst.operands[1].type == sim86::Operand_memory || inst.operands[1].type == sim86::Operand_direct;
+		// A segment prefix on an instruction without memory isn't printed, which moves where its jumps go
+		if (inst.operation == sim86::Operation_none || ((inst.flags & sim86::Instruction_segment) && !has_memory)) continue;
+		++count;
+
+		const std::string text = sim86::print(inst);
+		INFO(text);
+		std::uint8_t* const last = sim86::assemble(text, bytes);
+		REQUIRE(last != nullptr);
+		sim86::Instruction result = sim86::decode(bytes, last);
+		REQUIRE(result.size == last - bytes);
+		// The short xchg of the accumulator has it first whichever way round it was written
+		if (result.operation == sim86::Operation_xchg && result.operands[0].reg != inst.operands[0].reg) std::swap(result.operands[0], result.operands[1]);
+		REQUIRE(result.operation == inst.operation);
+		REQUIRE(result.w == inst.w);
+		REQUIRE(result.flags == inst.flags);
+		if (inst.flags & sim86::Instruction_segment) REQUIRE(result.segment == inst.segment);
+		for (std::size_t i = 0; i < 2; ++i)
+		{
+			const sim86::Operand& expected = inst.operands[i];
+			const sim86::Operand& actual = result.operands[i];
+			REQUIRE(actual.type == expected.type);
+			if (expected.type == sim86::Operand_relative)
+			{
+				REQUIRE(static_cast<std::uint16_t>(actual.value + result.size) == static_cast<std::uint16_t>(expected.value + inst.size));
+				continue;
+			}
+			REQUIRE(actual.reg == expected.reg);
+			if (expected.type == sim86::Operand_register) REQUIRE(actual.w == expected.w);
+			if (expected.type != sim86::Operand_memory || expected.mod != 0) REQUIRE(actual.value == expected.value);
+		}
+	}
+}
+
+TEST_CASE("print into a buffer", "[print]")
+{
+	std::uint8_t data[6] = {0x81, 0x82, 0x00, 0x80, 0xff, 0xff};
+	const sim86::Instruction inst = sim86::decode(data, data + 6);
+	char buffer[sim86::max_print_size];
+	char* end = sim86::print(inst, buffer);
+	REQUIRE(std::string(buffer, end) == "add word [bp+si-0x8000],0xffff");
+	REQUIRE(sim86::print(inst) == std::string(buffer, end));
+}
+
+TEST_CASE("lazy flags", "[simulate]")
+{
+	const auto run = [](std::initializer_list<std::uint8_t> code)
+	{
+		const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(code.begin(), code.end(), ctx->memory.begin());
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(code.size()), 0, 0 });
+		return sim86::get_flags(*ctx);
+	};
+	using F = sim86::Context;
+	// mov al,0xff; add al,1; hlt
+	REQUIRE(run({ 0xb0, 0xff, 0x04, 0x01, 0xf4 }) == (F::Flags_carry | F::Flags_parity | F::Flags_auxiliary | F::Flags_zero));
+	// mov al,0x7f; add al,1; hlt
+	REQUIRE(run({ 0xb0, 0x7f, 0x04, 0x01, 0xf4 }) == (F::Flags_auxiliary | F::Flags_sign | F::Flags_overflow));
+	// mov ax,0x0; cmp ax,0x1; hlt
+	REQUIRE(run({ 0xb8, 0x00, 0x00, 0x3d, 0x01, 0x00, 0xf4 }) == (F::Flags_carry | F::Flags_parity | F::Flags_auxiliary | F::Flags_sign));
+	// mov al,0xff; add al,1; cmc; hlt
+	REQUIRE(run({ 0xb0, 0xff, 0x04, 0x01, 0xf5, 0xf4 }) == (F::Flags_parity | F::Flags_auxiliary | F::Flags_zero));
+	// mov al,0x7f; add al,1; stc; std; sti; hlt
+	REQUIRE(run({ 0xb0, 0x7f, 0x04, 0x01, 0xf9, 0xfd, 0xfb, 0xf4 }) ==
+		(F::Flags_carry | F::Flags_auxiliary | F::Flags_sign | F::Flags_interrupt | F::Flags_direction | F::Flags_overflow));
+	// stc; std; sti; clc; cld; cli; hlt
+	REQUIRE(run({ 0xf9, 0xfd, 0xfb, 0xf8, 0xfc, 0xfa, 0xf4 }) == 0);
+}
+
+TEST_CASE("flag instructions", "[simulate]")
+{
+	const auto run = [](std::initializer_list<std::uint8_t> code)
+	{
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(code.begin(), code.end(), ctx->memory.begin());
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(code.size()), 0, 0 });
+		return ctx;
+	};
+	using F = sim86::Context;
+	// mov al,0xff; add al,0x1; lahf; hlt
+	REQUIRE(run({ 0xb0, 0xff, 0x04, 0x01, 0x9f, 0xf4 })->registers[0] >> 8 == (0x02 | F::Flags_carry | F::Flags_parity | F::Flags_auxiliary | F::Flags_zero));
+	// mov al,0x0; sub al,0x1; lahf; hlt
+	REQUIRE(run({ 0xb0, 0x00, 0x2c, 0x01, 0x9f, 0xf4 })->registers[0] >> 8 == (0x02 | F::Flags_carry | F::Flags_parity | F::Flags_auxiliary | F::Flags_sign));
+	// stc; mov al,0xf; inc al; lahf; hlt
+	std::unique_ptr<sim86::Context> ctx = run({ 0xf9, 0xb0, 0x0f, 0xfe, 0xc0, 0x9f, 0xf4 });
+	REQUIRE(ctx->registers[0] == (((0x02 | F::Flags_carry | F::Flags_auxiliary) << 8) | 0x10));
+	REQUIRE(ctx->total_clocks == 2 + 4 + 3 + 4 + 2);
+
+	// mov ah,0xff; sahf; hlt
+	ctx = run({ 0xb4, 0xff, 0x9e, 0xf4 });
+	REQUIRE(sim86::get_flags(*ctx) == (F::Flags_carry | F::Flags_parity | F::Flags_auxiliary | F::Flags_zero | F::Flags_sign));
+
+	// mov sp,0x100; stc; std; pushf; clc; cld; popf; hlt
+	ctx = run({ 0xbc, 0x00, 0x01, 0xf9, 0xfd, 0x9c, 0xf8, 0xfc, 0x9d, 0xf4 });
+	REQUIRE(ctx->registers[4] == 0x100);
+	REQUIRE(ctx->memory[0xfe] == (0x02 | F::Flags_carry));
+	REQUIRE(ctx->memory[0xff] == (0xf0 | F::Flags_direction >> 8));
+	REQUIRE(sim86::get_flags(*ctx) == (F::Flags_carry | F::Flags_direction));
+	REQUIRE(ctx->total_clocks == 4 + 2 + 2 + 10 + 2 + 2 + 8 + 2);
+}
+
+TEST_CASE("fused jumps", "[simulate]")
+{
+	// mov cx,0x3; dec cx; jnz $-0x1; cmp cx,0x0; jz $+0x2; hlt; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0x49, 0x75, 0xfd, 0x83, 0xf9, 0x00, 0x74, 0x01, 0xf4, 0xf4 };
+	const auto run = [&code](const sim86::Trace_fn& trace)
+	{
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		const sim86::Run_result result = sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 }, trace);
+		REQUIRE(result.reason == sim86::Stop_reason::halt);
+		REQUIRE(result.instructions == 10);
+		REQUIRE(ctx->ip == 13);
+		return ctx->total_clocks;
+	};
+	const std::uint32_t clocks = 4 + 3 * 2 + 2 * 16 + 4 + 4 + 16 + 2;
+	REQUIRE(run({}) == clocks);
+	REQUIRE(run([](const sim86::Context&, std::ptrdiff_t, const sim86::Instruction&) {}) == clocks);
+}
+
+TEST_CASE("word transfer penalties", "[simulate]")
+{
+	// mov bx,0x101; mov [bx],cx; add [bx+0x1],cx; mov [bx],cl; hlt
+	const std::uint8_t code[] = { 0xbb, 0x01, 0x01, 0x89, 0x0f, 0x01, 0x4f, 0x01, 0x88, 0x0f, 0xf4 };
+	const auto run = [&code](const sim86::Cpu cpu)
+	{
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		ctx->cpu = cpu;
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 });
+		return ctx->total_clocks;
+	};
+	const std::uint32_t clocks = 4 + (9 + 5) + (16 + 9) + (9 + 5) + 2;
+	// The 8086 only pays for the word at the odd address, the 8088 for every word
+	REQUIRE(run(sim86::Cpu_8086) == clocks + 4);
+	REQUIRE(run(sim86::Cpu_8088) == clocks + 4 + 2 * 4);
+
+	REQUIRE(sim86::get_timing(sim86::decode(code + 5, std::end(code))).transfers == 2);
+	// sub cx,dx
+	const std::uint8_t sub[] = { 0x29, 0xd1 };
+	REQUIRE(sim86::get_timing(sim86::decode(std::begin(sub), std::end(sub))).clocks == 3);
+	// jcxz $+0x2
+	const std::uint8_t jcxz[] = { 0xe3, 0x00 };
+	const sim86::Timing timing = sim86::get_timing(sim86::decode(std::begin(jcxz), std::end(jcxz)));
+	REQUIRE(timing.clocks == 18);
+	REQUIRE(timing.not_taken_clocks == 6);
+}
+
+TEST_CASE("prefetch queue", "[simulate]")
+{
+	// mov ax,bx; mov ax,bx; mov ax,bx; hlt
+	const std::uint8_t code[] = { 0x89, 0xd8, 0x89, 0xd8, 0x89, 0xd8, 0xf4 };
+	const auto run = [&code](const sim86::Cpu cpu)
+	{
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		ctx->cpu = cpu;
+		sim86::Prefetch_model prefetch(*ctx);
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 },
+			[&prefetch](const sim86::Context& ctx, std::ptrdiff_t ip, const sim86::Instruction& inst)
+			{
+				prefetch.step(ctx, ip, inst);
+			});
+		REQUIRE(ctx->total_clocks == 3 * 2 + 2);
+		REQUIRE(prefetch.clocks() == ctx->total_clocks + prefetch.queue_stalls() + prefetch.bus_stalls());
+		return prefetch.clocks();
+	};
+	// The execution unit outruns a bus that takes 4 clocks for every word, or every byte on the 8088
+	REQUIRE(run(sim86::Cpu_8086) == 18);
+	REQUIRE(run(sim86::Cpu_8088) == 30);
+
+	// mov cx,...; rep stosw; hlt
+	const auto transfers = [](const std::uint16_t cx)
+	{
+		const std::uint8_t stosw[] = { 0xb9, static_cast<std::uint8_t>(cx), static_cast<std::uint8_t>(cx >> 8), 0xf3, 0xab, 0xf4 };
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(stosw), std::end(stosw), ctx->memory.begin());
+		ctx->registers[7] = 0x1000;
+		sim86::Prefetch_model prefetch(*ctx);
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(stosw)), 0, 0 },
+			[&prefetch](const sim86::Context& ctx, std::ptrdiff_t ip, const sim86::Instruction& inst)
+			{
+				prefetch.step(ctx, ip, inst);
+			});
+		REQUIRE(prefetch.clocks() == ctx->total_clocks + prefetch.queue_stalls() + prefetch.bus_stalls());
+		return prefetch.transfers();
+	};
+	// Every repetition stores a word, none of them do when there are none
+	REQUIRE(transfers(1) == 1);
+	REQUIRE(transfers(100) == 100);
+	REQUIRE(transfers(0) == 0);
+}
+
+TEST_CASE("string instructions", "[simulate]")
+{
+	const auto run = [](std::initializer_list<std::uint8_t> code, const std::uint16_t cx, const std::uint16_t si, const std::uint16_t di)
+	{
+		std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(code.begin(), code.end(), ctx->memory.begin());
+		for (std::uint16_t i = 0; i < 0x100; ++i) ctx->memory[0x1000 + i] = static_cast<std::uint8_t>(i);
+		ctx->registers[0] = 0xaa55;
+		ctx->registers[1] = cx;
+		ctx->registers[6] = si;
+		ctx->registers[7] = di;
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(code.size()), 0, 0 });
+		return ctx;
+	};
+
+	// rep stosw
+	std::unique_ptr<sim86::Context> ctx = run({ 0xf3, 0xab }, 0x4000, 0, 0x2000);
+	REQUIRE(ctx->memory[0x1fff] == 0);
+	REQUIRE(ctx->memory[0x2000] == 0x55);
+	REQUIRE(ctx->memory[0x9fff] == 0xaa);
+	REQUIRE(ctx->memory[0xa000] == 0);
+	REQUIRE(ctx->registers[1] == 0);
+	REQUIRE(ctx->registers[7] == 0xa000);
+	REQUIRE(ctx->total_clocks == 9 + 0x4000 * 10);
+
+	// rep movsb with the destination a byte into the source repeats the first byte
+	ctx = run({ 0xf3, 0xa4 }, 0x80, 0x1004, 0x1005);
+	REQUIRE(ctx->memory[0x1004] == 4);
+	REQUIRE(ctx->memory[0x1005] == 4);
+	REQUIRE(ctx->memory[0x1084] == 4);
+	REQUIRE(ctx->memory[0x1085] == 0x85);
+	REQUIRE(ctx->registers[6] == 0x1084);
+
+	// rep movsw from an odd address pays the penalty for every word it reads
+	ctx = run({ 0xf3, 0xa5 }, 0x10, 0x1001, 0x3000);
+	REQUIRE(ctx->memory[0x3000] == 1);
+	REQUIRE(ctx->memory[0x301f] == 0x20);
+	REQUIRE(ctx->total_clocks == 9 + 0x10 * (17 + 4));
+
+	// repe cmpsb stops at the first difference
+	ctx = run({ 0xf3, 0xa6 }, 0x100, 0x1000, 0x1000);
+	REQUIRE(ctx->registers[1] == 0);
+	REQUIRE(sim86::get_flag(*ctx, sim86::Context::Flags_zero));
+	ctx = run({ 0xf3, 0xa6 }, 0x100, 0x1000, 0x1001);
+	REQUIRE(ctx->registers[1] == 0xff);
+	REQUIRE(ctx->registers[6] == 0x1001);
+	REQUIRE(!sim86::get_flag(*ctx, sim86::Context::Flags_zero));
+	REQUIRE(ctx->total_clocks == 9 + 22);
+
+	// repne scasb finds al
+	ctx = run({ 0xf2, 0xae }, 0x100, 0, 0x1000);
+	REQUIRE(ctx->registers[7] == 0x1056);
+	REQUIRE(ctx->registers[1] == 0x100 - 0x56);
+	REQUIRE(sim86::get_flag(*ctx, sim86::Context::Flags_zero));
+
+	// rep lodsw with no repetitions leaves everything alone
+	ctx = run({ 0xf3, 0xad }, 0, 0x1000, 0);
+	REQUIRE(ctx->registers[0] == 0xaa55);
+	REQUIRE(ctx->total_clocks == 9);
+
+	// std; mov di,0x10; mov cx,0x4; mov al,0x41; rep stosb; hlt
+	ctx = run({ 0xfd, 0xbf, 0x10, 0x00, 0xb9, 0x04, 0x00, 0xb0, 0x41, 0xf3, 0xaa, 0xf4 }, 0, 0, 0);
+	REQUIRE(ctx->registers[7] == 0x0c);
+	REQUIRE(ctx->memory[0x0c] == 0);
+	REQUIRE(ctx->memory[0x0d] == 0x41);
+	REQUIRE(ctx->memory[0x10] == 0x41);
+	REQUIRE(ctx->memory[0x11] == 0);
+	REQUIRE(ctx->total_clocks == 2 + 4 + 4 + 4 + 9 + 4 * 10 + 2);
+
+	// std; mov si,0x1006; mov di,0x3006; mov cx,0x3; rep movsw; cld; hlt
+	ctx = run({ 0xfd, 0xbe, 0x06, 0x10, 0xbf, 0x06, 0x30, 0xb9, 0x03, 0x00, 0xf3, 0xa5, 0xfc, 0xf4 }, 0, 0, 0);
+	REQUIRE(ctx->registers[6] == 0x1000);
+	REQUIRE(ctx->registers[7] == 0x3000);
+	REQUIRE(ctx->memory[0x3001] == 0);
+	REQUIRE(ctx->memory[0x3002] == 2);
+	REQUIRE(ctx->memory[0x3007] == 7);
+	REQUIRE(ctx->memory[0x3008] == 0);
+	REQUIRE(!sim86::get_flag(*ctx, sim86::Context::Flags_direction));
+}
+
+TEST_CASE("batch", "[simulate]")
+{
+	// add ax,cx; loop $-0x2
+	const std::uint8_t code[] = { 0x01, 0xc8, 0xe2, 0xfc };
+	std::vector<sim86::Batch_job> jobs(100);
+	for (std::size_t i = 0; i < jobs.size(); ++i)
+	{
+		jobs[i].program = code;
+		jobs[i].registers[1] = static_cast<std::uint16_t>(i);
+	}
+	const std::vector<sim86::Batch_result> results = sim86::run_batch(jobs, 4);
+	REQUIRE(results.size() == jobs.size());
+	for (std::size_t i = 1; i < results.size(); ++i)
+	{
+		REQUIRE(results[i].run.reason == sim86::Stop_reason::end_of_program);
+		REQUIRE(results[i].run.instructions == 2 * i);
+		REQUIRE(results[i].registers[0] == i * (i + 1) / 2);
+		REQUIRE(results[i].registers[1] == 0);
+		REQUIRE(results[i].total_clocks == 3 * i + 17 * (i - 1) + 5);
+	}
+}
+
+TEST_CASE("snapshots", "[simulate]")
+{
+	// mov word [0x1ff],0x1234; add cx,byte +0x1; hlt
+	const std::uint8_t code[] = { 0xc7, 0x06, 0xff, 0x01, 0x34, 0x12, 0x83, 0xc1, 0x01, 0xf4 };
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	const sim86::Limits limits{ static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 };
+
+	const std::shared_ptr<const sim86::Snapshot> before = sim86::snapshot(*ctx);
+	sim86::run(*ctx, limits);
+	REQUIRE(ctx->dirty_pages.contains(1));
+	REQUIRE(ctx->dirty_pages.contains(2));
+	REQUIRE(!ctx->dirty_pages.contains(0));
+
+	const std::shared_ptr<const sim86::Snapshot> after = sim86::snapshot(*ctx);
+	REQUIRE(after->get_page(0) == before->get_page(0));
+	REQUIRE(after->get_page(1) != before->get_page(1));
+	REQUIRE(after->get_page(3) == before->get_page(3));
+	// The leaves the run didn't write are shared whole
+	REQUIRE(after->leaves[0] != before->leaves[0]);
+	REQUIRE(after->leaves[1] == before->leaves[1]);
+	REQUIRE(after->leaves[std::size(after->leaves) - 1] == before->leaves[std::size(before->leaves) - 1]);
+	REQUIRE(after->registers[1] == 1);
+
+	sim86::restore(*ctx, before);
+	REQUIRE(ctx->memory[0x1ff] == 0);
+	REQUIRE(ctx->memory[0x200] == 0);
+	REQUIRE(ctx->registers[1] == 0);
+	REQUIRE(ctx->ip == 0);
+	REQUIRE(ctx->total_clocks == 0);
+
+	sim86::run(*ctx, limits);
+	REQUIRE(ctx->memory[0x1ff] == 0x34);
+	REQUIRE(ctx->memory[0x200] == 0x12);
+	REQUIRE(ctx->registers[1] == 1);
+	REQUIRE(ctx->total_clocks == after->total_clocks);
+}
+
+TEST_CASE("estimate", "[estimate]")
+{
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xf4 };
+	sim86::Estimate estimate = sim86::estimate_clocks(code, sim86::Cpu_8086);
+	REQUIRE(estimate.blocks.size() == 3);
+	REQUIRE(estimate.blocks[0].first == 0);
+	REQUIRE(estimate.blocks[0].last == 6);
+	REQUIRE(estimate.blocks[0].clocks.best == 8);
+	REQUIRE(estimate.blocks[0].clocks.worst == 8);
+	// The word at bx may be at an odd address, loop may be taken or not
+	const sim86::Estimate_block& body = estimate.blocks[1];
+	REQUIRE(body.first == 6);
+	REQUIRE(body.last == 13);
+	REQUIRE(body.clocks.best == 14 + 4 + 5);
+	REQUIRE(body.clocks.worst == 18 + 4 + 17);
+	REQUIRE(body.successors.size() == 2);
+	REQUIRE(body.successors[0].block == 2);
+	REQUIRE(body.successors[0].clocks.best == 14 + 4 + 5);
+	REQUIRE(body.successors[1].block == 1);
+	REQUIRE(body.successors[1].clocks.worst == 18 + 4 + 17);
+	REQUIRE(estimate.blocks[2].successors.empty());
+	REQUIRE(estimate.loops.size() == 1);
+	REQUIRE(estimate.loops[0].header == 1);
+	REQUIRE(estimate.loops[0].iteration.best == 14 + 4 + 17);
+	REQUIRE(estimate.loops[0].iteration.worst == 18 + 4 + 17);
+
+	// Every word the 8088 transfers pays the penalty
+	estimate = sim86::estimate_clocks(code, sim86::Cpu_8088);
+	REQUIRE(estimate.loops[0].iteration.best == 18 + 4 + 17);
+
+	// A direct address is known to be odd, the count of a rep is not known at all
+	const std::uint8_t mov[] = { 0xa3, 0x01, 0x01 }; // mov [0x101],ax
+	sim86::Clock_range clocks = sim86::get_clock_range(sim86::decode(std::begin(mov), std::end(mov)), sim86::Cpu_8086);
+	REQUIRE(clocks.best == 14);
+	REQUIRE(clocks.worst == 14);
+	const std::uint8_t stosw[] = { 0xf3, 0xab }; // rep stosw
+	clocks = sim86::get_clock_range(sim86::decode(std::begin(stosw), std::end(stosw)), sim86::Cpu_8086);
+	REQUIRE(clocks.best == 9);
+	REQUIRE(clocks.worst == 9 + 0xffff * (10 + 4));
+
+	// The estimate bounds what the simulator charges
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 });
+	REQUIRE(ctx->total_clocks >= 8 + 2 * 35 + 23 + 2);
+	REQUIRE(ctx->total_clocks <= 8 + 2 * 39 + 39 + 2);
+}
+
+TEST_CASE("trace replay", "[trace]")
+{
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xf4 };
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+
+	std::ostringstream os;
+	std::vector<std::uint16_t> bx;
+	{
+		sim86::Trace_recorder recorder(os, *ctx);
+		sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 },
+			[&](const sim86::Context& ctx, std::ptrdiff_t, const sim86::Instruction& inst)
+			{
+				recorder.record(ctx, inst);
+				bx.push_back(ctx.registers[3]);
+			});
+	}
+
+	std::istringstream is(os.str());
+	sim86::Trace_reader reader(is);
+	const std::unique_ptr<sim86::Trace_state> state = std::make_unique<sim86::Trace_state>();
+	REQUIRE(reader.start(*state));
+	while (reader.next(*state))
+	{
+		REQUIRE(state->registers[3] == bx[state->steps - 1]);
+	}
+	REQUIRE(state->steps == bx.size());
+	REQUIRE(state->ip == ctx->ip);
+	REQUIRE(state->total_clocks == ctx->total_clocks);
+	REQUIRE(state->flags == sim86::get_flags(*ctx));
+	REQUIRE(state->opcode == 0xf4);
+	REQUIRE(std::equal(std::begin(state->memory), std::end(state->memory), std::begin(ctx->memory)));
+}
+
+TEST_CASE("profile", "[profile]")
+{
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xf4 };
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	const std::unique_ptr<sim86::Profile> profile = std::make_unique<sim86::Profile>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	ctx->profile = profile.get();
+	sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 });
+
+	REQUIRE(profile->counters[0].count == 1);
+	REQUIRE(profile->counters[6].count == 3);
+	REQUIRE(profile->counters[6].clocks == 3 * 14);
+	REQUIRE(profile->counters[6].ea_clocks == 3 * 5);
+	REQUIRE(profile->counters[11].clocks == 2 * 17 + 5);
+
+	const std::vector<sim86::Profile_block> blocks = sim86::get_hot_blocks(*ctx, *profile);
+	REQUIRE(blocks.size() == 3);
+	REQUIRE(blocks[0].first == 6);
+	REQUIRE(blocks[0].last == 13);
+	REQUIRE(blocks[0].count == 3);
+	REQUIRE(blocks[0].clocks == 3 * 14 + 3 * 4 + 2 * 17 + 5);
+	REQUIRE(blocks[0].ea_clocks == 3 * 5);
+	REQUIRE(blocks[1].first == 0);
+	REQUIRE(blocks[1].last == 6);
+	REQUIRE(blocks[2].first == 13);
+}
+
+TEST_CASE("cache", "[profile]")
+{
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	{
+		// Two sets of two ways of 4 byte lines, lines 0, 2 and 4 share a set
+		sim86::Cache cache(16, 4, 2);
+		cache.access(0, 1);
+		cache.access(0, 2);
+		cache.access(8, 1);
+		cache.access(16, 1); // drops line 0, the least recently used
+		cache.access(8, 1);
+		cache.access(0, 1); // drops line 4
+		cache.access(3, 2); // line 0 hits but line 1 misses
+		cache.step(*ctx, 0, {});
+		REQUIRE(cache.total().hits == 2);
+		REQUIRE(cache.total().misses == 5);
+		REQUIRE(cache.counters(0).misses == 5);
+		REQUIRE(!sim86::Cache::is_valid(16, 4, 8));
+		REQUIRE(!sim86::Cache::is_valid(24, 4, 2));
+	}
+
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; mov cx,0x8; mov di,0x200; rep stosb; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xb9, 0x08, 0x00,
+		0xbf, 0x00, 0x02, 0xf3, 0xaa, 0xf4 };
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	sim86::Cache cache(16, 4, 2);
+	ctx->cache = &cache;
+	sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 },
+		[&cache](const sim86::Context& ctx, std::ptrdiff_t ip, const sim86::Instruction& inst)
+		{
+			cache.step(ctx, ip, inst);
+		});
+	REQUIRE(cache.counters(6).hits == 1);
+	REQUIRE(cache.counters(6).misses == 2);
+	// Each byte the rep stosb stores is an access
+	REQUIRE(cache.counters(19).hits == 6);
+	REQUIRE(cache.counters(19).misses == 2);
+	REQUIRE(cache.total().hits + cache.total().misses == 11);
+
+	std::ostringstream os;
+	sim86::print_cache(os, *ctx, cache);
+	REQUIRE(os.str().find("0006            1            2    66.7  mov [bx],cx\n") != std::string::npos);
+}
+
+TEST_CASE("counters", "[profile]")
+{
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xf4 };
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	const std::unique_ptr<sim86::Counters> counters = std::make_unique<sim86::Counters>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	ctx->counters = counters.get();
+	sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 });
+
+	std::ostringstream csv;
+	sim86::write_counters_csv(csv, *counters);
+#if SIM86_COUNTERS
+	REQUIRE(counters->opcodes[0x89] == 3);
+	REQUIRE(counters->operations[sim86::Operation_mov] == 5);
+	REQUIRE(counters->ea_modes[0][7] == 3);
+	REQUIRE(counters->taken[sim86::Operation_loop] == 2);
+	REQUIRE(counters->not_taken[sim86::Operation_loop] == 1);
+	REQUIRE(counters->read_bytes == 0);
+	REQUIRE(counters->written_bytes == 6);
+	REQUIRE(csv.str().find("\nopcode,0x89,3\n") != std::string::npos);
+	REQUIRE(csv.str().find("\nea,[bx],3\n") != std::string::npos);
+	REQUIRE(csv.str().find("\ntaken,loop,2\nnot taken,loop,1\n") != std::string::npos);
+#else
+	// Nothing is counted in a build without them
+	REQUIRE(counters->operations[sim86::Operation_mov] == 0);
+	REQUIRE(csv.str() == "counter,key,count\nmemory,read bytes,0\nmemory,written bytes,0\n");
+#endif
+}
+
+TEST_CASE("segments", "[simulate]")
+{
+	const std::uint8_t code[] =
+	{
+		0xb8, 0x00, 0x20, // mov ax,0x2000
+		0x8e, 0xd8, // mov ds,ax
+		0xc7, 0x06, 0x10, 0x00, 0x34, 0x12, // mov word [0x10],0x1234
+		0xb8, 0x00, 0x30, // mov ax,0x3000
+		0x8e, 0xc0, // mov es,ax
+		0xbf, 0x00, 0x00, // mov di,0x0
+		0xbe, 0x10, 0x00, // mov si,0x10
+		0xb9, 0x02, 0x00, // mov cx,0x2
+		0xf3, 0xa4, // rep movsb
+		0xbd, 0x00, 0x01, // mov bp,0x100
+		0x89, 0x46, 0x00, // mov [bp+0x0],ax
+		0x26, 0x8c, 0x1e, 0x04, 0x00, // mov [es:0x4],ds
+		0xf4, // hlt
+	};
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	const sim86::Run_result result = sim86::run(*ctx, { static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 });
+	REQUIRE(result.reason == sim86::Stop_reason::halt);
+	REQUIRE(ctx->segments[sim86::Segment_ds] == 0x2000);
+	REQUIRE(ctx->segments[sim86::Segment_es] == 0x3000);
+
+	// ds:0x10, copied to es:0x0 and ss:bp with ss still zero
+	REQUIRE(ctx->memory[0x20010] == 0x34);
+	REQUIRE(ctx->memory[0x20011] == 0x12);
+	REQUIRE(ctx->memory[0x30000] == 0x34);
+	REQUIRE(ctx->memory[0x30001] == 0x12);
+	REQUIRE(ctx->memory[0x100] == 0x00);
+	REQUIRE(ctx->memory[0x101] == 0x30);
+	REQUIRE(ctx->memory[0x30004] == 0x00);
+	REQUIRE(ctx->memory[0x30005] == 0x20);
+	REQUIRE(ctx->dirty_pages.contains(0x20010 / sim86::snapshot_page_size));
+	REQUIRE(ctx->dirty_pages.contains(0x30000 / sim86::snapshot_page_size));
+	REQUIRE(!ctx->dirty_pages.contains(0x10000 / sim86::snapshot_page_size));
+
+	REQUIRE(sim86::get_physical_address(0xffff, 0x10) == 0);
+	REQUIRE(sim86::get_physical_address(0x1234, 0x5678) == 0x179b8);
+}
+
+TEST_CASE("self modifying prefixed instructions", "[simulate]")
+{
+	// The patched byte is as far into the instruction as any write can be, it still drops the cached instruction
+	const std::uint8_t code[] =
+	{
+		0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0xc7, 0x06, 0x00, 0x02, 0x11, 0x11, // mov word [cs:0x200],0x1111
+		0xc6, 0x06, 0x0e, 0x00, 0x22, // mov byte [0xe],0x22
+		0xe2, 0xea, // loop $-0x14
+	};
+	for (const bool traced : { false, true })
+	{
+		const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		ctx->registers[1] = 2;
+		const sim86::Limits limits{ static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 };
+		const sim86::Trace_fn trace = [](const sim86::Context&, std::ptrdiff_t, const sim86::Instruction&) {};
+		const sim86::Run_result result = sim86::run(*ctx, limits, traced ? trace : sim86::Trace_fn{});
+		REQUIRE(result.reason == sim86::Stop_reason::end_of_program);
+		REQUIRE(result.instructions == 6);
+		REQUIRE(ctx->memory[0x200] == 0x11);
+		REQUIRE(ctx->memory[0x201] == 0x22);
+	}
+
+	// With more prefixes the instruction is too long to be cached at all
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	std::fill(ctx->memory.begin(), ctx->memory.begin() + 5, 0x2e);
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin() + 5);
+	const sim86::Run_result result = sim86::run(*ctx, { static_cast<std::ptrdiff_t>(5 + std::size(code)), 0, 0 });
+	REQUIRE(result.reason == sim86::Stop_reason::invalid_instruction);
+	REQUIRE(result.instructions == 0);
+}
+
+TEST_CASE("words that wrap around", "[simulate]")
+{
+	const std::uint8_t code[] =
+	{
+		0xb8, 0x00, 0x20, // mov ax,0x2000
+		0x8e, 0xd8, // mov ds,ax
+		0xc7, 0x06, 0xff, 0xff, 0x34, 0x12, // mov word [0xffff],0x1234
+		0xbb, 0xff, 0xff, // mov bx,0xffff
+		0x8b, 0x0f, // mov cx,[bx]
+		0xb8, 0xff, 0xff, // mov ax,0xffff
+		0x8e, 0xd8, // mov ds,ax
+		0xbb, 0x0f, 0x00, // mov bx,0xf
+		0x8b, 0x17, // mov dx,[bx]
+		0x89, 0x0f, // mov [bx],cx
+		0xf4, // hlt
+	};
+	sim86::Jit jit;
+	for (const bool compiled : { false, true })
+	{
+		const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		ctx->memory[0xfffff] = 0x78;
+		const sim86::Limits limits{ static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 };
+		const sim86::Run_result result = compiled ? jit.run(*ctx, limits) : sim86::run(*ctx, limits);
+		REQUIRE(result.reason == sim86::Stop_reason::halt);
+
+		// The second byte at offset 0xffff is at the start of the segment, and at the end of memory at its start
+		REQUIRE(ctx->memory[0x2ffff] == 0x34);
+		REQUIRE(ctx->memory[0x20000] == 0x12);
+		REQUIRE(ctx->memory[0x30000] == 0x00);
+		REQUIRE(ctx->registers[1] == 0x1234);
+		REQUIRE(ctx->registers[2] == 0xb878);
+		REQUIRE(ctx->memory[0xfffff] == 0x34);
+		REQUIRE(ctx->memory[0] == 0x12);
+	}
+}
+
+TEST_CASE("compiled and interpreted runs agree", "[jit]")
+{
+	sim86::Jit jit;
+	const auto compare = [&jit](const std::vector<std::uint8_t>& code, const sim86::Limits& limits)
+	{
+		std::unique_ptr<sim86::Context> ctx[2];
+		sim86::Run_result result[2];
+		for (const bool compiled : { false, true })
+		{
+			std::unique_ptr<sim86::Context>& run = ctx[compiled];
+			run = std::make_unique<sim86::Context>();
+			std::copy(code.begin(), code.end(), run->memory.begin());
+			result[compiled] = compiled ? jit.run(*run, limits) : sim86::run(*run, limits);
+		}
+		REQUIRE(result[1].reason == result[0].reason);
+		REQUIRE(result[1].instructions == result[0].instructions);
+		REQUIRE(std::equal(std::begin(ctx[1]->registers), std::end(ctx[1]->registers), ctx[0]->registers));
+		REQUIRE(std::equal(std::begin(ctx[1]->segments), std::end(ctx[1]->segments), ctx[0]->segments));
+		REQUIRE(ctx[1]->ip == ctx[0]->ip);
+		REQUIRE(sim86::get_flags(*ctx[1]) == sim86::get_flags(*ctx[0]));
+		REQUIRE(ctx[1]->total_clocks == ctx[0]->total_clocks);
+		REQUIRE(std::equal(ctx[1]->memory.begin(), ctx[1]->memory.end(), ctx[0]->memory.begin()));
+		return result[0];
+	};
+
+	for (const char* const listing :
+	{
+		"listing_0043_immediate_movs",
+		"listing_0044_register_movs",
+		"listing_0046_add_sub_cmp",
+		"listing_0048_ip_register",
+		"listing_0049_conditional_jumps",
+		"listing_0051_memory_mov",
+		"listing_0052_memory_add_loop",
+		"listing_0054_draw_rectangle",
+		"listing_0056_estimating_cycles",
+	})
+	{
+		std::ifstream file(std::string(SIM86_TEST_DATA_DIR "/") + listing, std::ios::binary);
+		REQUIRE(file);
+		const std::vector<std::uint8_t> code{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+		INFO(listing);
+		compare(code, { static_cast<std::ptrdiff_t>(code.size()), 0, 0 });
+	}
+
+	// NOTE(rksouthee): Every form the translator compiles, in loops whose blocks jump into one another, with words
+	// at odd addresses and a conditional jump on flags both still in the host and already stored
+	const std::vector<std::uint8_t> code =
+	{
+		0xb8, 0x34, 0x12, // mov ax,0x1234
+		0xb9, 0x10, 0x00, // mov cx,0x10
+		0xba, 0x78, 0x56, // mov dx,0x5678
+		0xbb, 0x00, 0x03, // mov bx,0x300
+		0xbc, 0x00, 0x04, // mov sp,0x400
+		0xbd, 0x00, 0x02, // mov bp,0x200
+		0xbe, 0x05, 0x00, // mov si,0x5
+		0xbf, 0x07, 0x00, // mov di,0x7
+		0x01, 0xd0, // add ax,dx
+		0x01, 0x00, // add [bx+si],ax
+		0x29, 0xc2, // sub dx,ax
+		0x29, 0x53, 0x10, // sub [bp+di+0x10],dx
+		0x39, 0xd0, // cmp ax,dx
+		0x39, 0x87, 0x00, 0x01, // cmp [bx+0x100],ax
+		0x89, 0x01, // mov [bx+di],ax
+		0x89, 0x16, 0x01, 0x05, // mov [0x501],dx
+		0x8b, 0x10, // mov dx,[bx+si]
+		0x8b, 0xec, // mov bp,sp
+		0xc6, 0xc0, 0x12, // mov al,0x12
+		0xc6, 0xc3, 0x34, // mov bl,0x34
+		0xc6, 0xc2, 0x56, // mov dl,0x56
+		0xc6, 0x01, 0x78, // mov byte [bx+di],0x78
+		0xc7, 0x42, 0x21, 0xbc, 0x9a, // mov word [bp+si+0x21],0x9abc
+		0xc7, 0xc7, 0x09, 0x00, // mov di,0x9
+		0x81, 0xc0, 0x34, 0x12, // add ax,0x1234
+		0x81, 0x47, 0x41, 0x02, 0x01, // add word [bx+0x41],0x102
+		0x83, 0xea, 0x11, // sub dx,byte +0x11
+		0x83, 0x6a, 0x30, 0x05, // sub word [bp+si+0x30],byte +0x5
+		0x81, 0xf8, 0x21, 0x43, // cmp ax,0x4321
+		0x83, 0x3d, 0x07, // cmp word [di],byte +0x7
+		0xba, 0x03, 0x00, // mov dx,0x3
+		0x83, 0xea, 0x01, // sub dx,byte +0x1
+		0x75, 0xfb, // jnz $-0x3
+		0x83, 0xe9, 0x01, // sub cx,byte +0x1
+		0x89, 0x07, // mov [bx],ax
+		0x75, 0xac, // jnz $-0x52
+		0xf4, // hlt
+	};
+	const sim86::Run_result result = compare(code, { static_cast<std::ptrdiff_t>(code.size()), 0, 0 });
+	REQUIRE(result.reason == sim86::Stop_reason::halt);
+	// The limits stop both at the same instruction, wherever that falls in a block
+	for (std::uint64_t limit = 1; limit < result.instructions; limit += 7)
+	{
+		INFO(limit);
+		REQUIRE(compare(code, { static_cast<std::ptrdiff_t>(code.size()), limit, 0 }).reason == sim86::Stop_reason::instruction_limit);
+		compare(code, { static_cast<std::ptrdiff_t>(code.size()), 0, limit * 5 });
+	}
+}
+
+TEST_CASE("breakpoints and watchpoints", "[debug]")
+{
+	// mov cx,0x3; mov bx,0x100; mov [bx],cx; add bx,byte +0x2; loop $-0x5; hlt
+	const std::uint8_t code[] = { 0xb9, 0x03, 0x00, 0xbb, 0x00, 0x01, 0x89, 0x0f, 0x83, 0xc3, 0x02, 0xe2, 0xf9, 0xf4 };
+	const sim86::Limits limits{ static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 };
+	const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+	const std::unique_ptr<sim86::Debug> debug = std::make_unique<sim86::Debug>();
+	std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+	ctx->debug = debug.get();
+
+	debug->breakpoints[6] = 1;
+	sim86::Run_result result = sim86::run(*ctx, limits);
+	REQUIRE(result.reason == sim86::Stop_reason::breakpoint);
+	REQUIRE(result.instructions == 2);
+	REQUIRE(ctx->ip == 6);
+
+	// Resuming runs the instruction at the breakpoint
+	result = sim86::run(*ctx, limits);
+	REQUIRE(result.reason == sim86::Stop_reason::breakpoint);
+	REQUIRE(result.instructions == 3);
+	REQUIRE(ctx->registers[1] == 2);
+
+	debug->breakpoints[6] = 0;
+	debug->watchpoints.push_back({ 0x105, 0x106, false });
+	result = sim86::run(*ctx, limits);
+	REQUIRE(result.reason == sim86::Stop_reason::watchpoint);
+	REQUIRE(result.instructions == 4);
+	REQUIRE(ctx->ip == 8);
+	REQUIRE(debug->hit_address == 0x105);
+	REQUIRE(debug->hit_ip == 6);
+	REQUIRE(ctx->memory[0x104] == 1);
+
+	result = sim86::run(*ctx, limits);
+	REQUIRE(result.reason == sim86::Stop_reason::halt);
+}
+
+TEST_CASE("parallel disassembly", "[print]")
+{
+	// NOTE(rksouthee): Random bytes are mostly instructions of a few bytes with the odd prefix, so the chunks start
+	// off the true boundaries often enough to have to find their way back to them. Two threads take more than one
+	// round of chunks to get through it.
+	std::vector<std::uint8_t> code((3 << 20) + 12345);
+	std::uint32_t seed = 1;
+	for (std::uint8_t& b : code)
+	{
+		seed = seed * 1664525 + 1013904223;
+		b = static_cast<std::uint8_t>(seed >> 24);
+	}
+
+	std::ostringstream sequential;
+	{
+		sim86::Writer writer(sequential);
+		sim86::disassemble(code, writer, 1);
+	}
+	for (const unsigned thread_count : { 2u, 7u, 64u })
+	{
+		std::ostringstream parallel;
+		{
+			sim86::Writer writer(parallel);
+			sim86::disassemble(code, writer, thread_count);
+		}
+		REQUIRE(parallel.str() == sequential.str());
+	}
+}
+
+TEST_CASE("history", "[debug]")
+{
+	const std::uint8_t code[] =
+	{
+		0xb9, 0x03, 0x00, // mov cx,0x3
+		0xbb, 0x00, 0x01, // mov bx,0x100
+		0x89, 0x0f, // mov [bx],cx
+		0x83, 0xc3, 0x02, // add bx,byte +0x2
+		0xe2, 0xf9, // loop $-0x5
+		0xbf, 0x00, 0x01, // mov di,0x100
+		0xb8, 0xff, 0xff, // mov ax,0xffff
+		0xb9, 0x03, 0x00, // mov cx,0x3
+		0xf3, 0xab, // rep stosw
+		0xf4, // hlt
+	};
+	const sim86::Limits limits{ static_cast<std::ptrdiff_t>(std::size(code)), 0, 0 };
+
+	// The state after each step, as a plain run leaves it
+	struct State
+	{
+		std::uint16_t registers[8];
+		std::ptrdiff_t ip;
+		std::uint16_t flags;
+		std::uint8_t memory[6];
+	};
+	std::vector<State> states;
+	const auto save = [&states](const sim86::Context& ctx)
+	{
+		State& state = states.emplace_back();
+		std::copy(std::begin(ctx.registers), std::end(ctx.registers), state.registers);
+		state.ip = ctx.ip;
+		state.flags = sim86::get_flags(ctx);
+		std::copy_n(ctx.memory.begin() + 0x100, std::size(state.memory), state.memory);
+	};
+	const auto matches = [&states](const sim86::Context& ctx, const std::uint64_t step)
+	{
+		const State& state = states[step];
+		return std::equal(std::begin(state.registers), std::end(state.registers), ctx.registers) && state.ip == ctx.ip &&
+			state.flags == sim86::get_flags(ctx) && std::equal(std::begin(state.memory), std::end(state.memory), ctx.memory.begin() + 0x100);
+	};
+
+	// NOTE(rksouthee): A log that holds a few records has the older steps reached from the checkpoints instead
+	for (const std::size_t log_size : { std::size_t(1) << 16, std::size_t(160) })
+	{
+		const std::unique_ptr<sim86::Context> ctx = std::make_unique<sim86::Context>();
+		std::copy(std::begin(code), std::end(code), ctx->memory.begin());
+		states.clear();
+		save(*ctx);
+		sim86::History history(*ctx, limits.end, log_size, 4);
+		ctx->history = &history;
+		sim86::Cache cache(64, 4, 2);
+		ctx->cache = &cache;
+		const sim86::Run_result result = sim86::run(*ctx, limits, [&](const sim86::Context& ctx, std::ptrdiff_t ip, const sim86::Instruction& inst)
+		{
+			history.record();
+			cache.step(ctx, ip, inst);
+			save(ctx);
+		});
+		REQUIRE(result.reason == sim86::Stop_reason::halt);
+		REQUIRE(history.steps() == 16);
+		REQUIRE(history.first_step() == 0);
+
+		REQUIRE(history.step_back() == 1);
+		REQUIRE(matches(*ctx, 15));
+		REQUIRE(history.step_back(2) == 2);
+		REQUIRE(matches(*ctx, 13));
+		if (log_size > 160)
+		{
+			REQUIRE(history.run_back_to(6));
+		}
+		else
+		{
+			// Only the log is searched
+			REQUIRE(!history.run_back_to(6));
+			REQUIRE(history.go_to(8));
+		}
+		REQUIRE(history.steps() == 8);
+		REQUIRE(matches(*ctx, 8));
+		REQUIRE(history.go_to(3));
+		REQUIRE(matches(*ctx, 3));
+		REQUIRE(!history.go_to(4));
+		// Executing again from a checkpoint feeds nothing to the cache
+		cache.step(*ctx, 0, {});
+		REQUIRE(cache.total().hits + cache.total().misses == 6);
+		ctx->cache = nullptr;
+
+		// The run carries on from the step it went back to
+		sim86::run(*ctx, limits, [&](const sim86::Context&, std::ptrdiff_t, const sim86::Instruction&) { history.record(); });
+		REQUIRE(history.steps() == 16);
+		REQUIRE(matches(*ctx, 16));
+		REQUIRE(history.step_back(100) == 16);
+		REQUIRE(matches(*ctx, 0));
+	}
+}
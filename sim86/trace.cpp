@@ -0,0 +1,424 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+
+namespace
+{
+	constexpr char s_magic[4] = { 'S', '8', '6', 'T' };
+	constexpr std::uint8_t s_version = 3;
+	constexpr std::size_t s_max_record_size = 64;
+
+	char* put_u8(char* out, const std::uint8_t value)
+	{
+		*out++ = static_cast<char>(value);
+		return out;
+	}
+
+	char* put_u16(char* out, const std::uint16_t value)
+	{
+		out = put_u8(out, value & 0xff);
+		return put_u8(out, value >> 8);
+	}
+
+	char* put_varint(char* out, std::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out = put_u8(out, static_cast<std::uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		return put_u8(out, static_cast<std::uint8_t>(value));
+	}
+
+	char* put_signed(char* out, const std::int64_t value)
+	{
+		return put_varint(out, (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+	}
+
+	constexpr std::size_t s_prediction_count = 0x10000;
+	constexpr std::uint16_t s_unknown_opcode = 0x100;
+	constexpr std::uint8_t s_write_count_mask = 0x3;
+	constexpr std::uint8_t s_write_word = 0x4; // shifted left by the index of the write
+	constexpr std::uint8_t s_write_block = s_write_count_mask; // a single write of any length, by a string instruction
+	constexpr std::uint8_t s_register_count = 12; // the general registers then the segment registers
+
+	std::unique_ptr<sim86::Trace_prediction[]> make_predictions()
+	{
+		std::unique_ptr<sim86::Trace_prediction[]> predictions = std::make_unique<sim86::Trace_prediction[]>(s_prediction_count);
+		std::fill_n(predictions.get(), s_prediction_count, sim86::Trace_prediction{ s_unknown_opcode, 0, 0, 0 });
+		return predictions;
+	}
+
+	std::int16_t get_register_delta(const std::uint16_t from, const std::uint16_t to)
+	{
+		return static_cast<std::int16_t>(to - from);
+	}
+
+	// The change from one physical address to another, the shorter way around memory
+	std::int32_t get_address_delta(const std::uint32_t from, const std::uint32_t to)
+	{
+		return static_cast<std::int32_t>((to - from) << 12) >> 12;
+	}
+
+	template <typename T>
+	T& get_register(T* registers, T* segments, const std::uint8_t index)
+	{
+		return index < 8 ? registers[index] : segments[index - 8];
+	}
+
+	struct Input
+	{
+		std::istream& is;
+
+		bool u8(std::uint8_t& value)
+		{
+			const std::istream::int_type c = is.get();
+			if (c == std::istream::traits_type::eof()) return false;
+			value = static_cast<std::uint8_t>(c);
+			return true;
+		}
+
+		bool u16(std::uint16_t& value)
+		{
+			std::uint8_t lo, hi;
+			if (!u8(lo) || !u8(hi)) return false;
+			value = static_cast<std::uint16_t>(lo | (hi << 8));
+			return true;
+		}
+
+		bool varint(std::uint64_t& value)
+		{
+			value = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7)
+			{
+				std::uint8_t b;
+				if (!u8(b)) return false;
+				value |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+				if (!(b & 0x80)) return true;
+			}
+			return false;
+		}
+
+		bool signed_varint(std::int64_t& value)
+		{
+			std::uint64_t raw;
+			if (!varint(raw)) return false;
+			value = static_cast<std::int64_t>(raw >> 1) ^ -static_cast<std::int64_t>(raw & 1);
+			return true;
+		}
+	};
+}
+
+namespace sim86
+{
+	Trace_recorder::Trace_recorder(std::ostream& os, const Context& ctx) :
+		m_writer(os),
+		m_memory(std::make_unique<std::uint8_t[]>(memory_size)),
+		m_ip(ctx.ip),
+		m_flags(get_flags(ctx)),
+		m_predictions(make_predictions())
+	{
+		std::copy(ctx.memory.begin(), ctx.memory.end(), m_memory.get());
+		std::copy(std::begin(ctx.registers), std::end(ctx.registers), m_registers);
+		std::copy(std::begin(ctx.segments), std::end(ctx.segments), m_segments);
+
+		// NOTE(rksouthee): Only memory up to the last non-zero byte is stored, a replay starts from zeroes
+		const std::uint8_t* const last = std::find_if(std::make_reverse_iterator(ctx.memory.end()), std::make_reverse_iterator(ctx.memory.begin()),
+			[](std::uint8_t b) { return b != 0; }).base();
+		const std::size_t stored_size = last - ctx.memory.begin();
+
+		m_writer.write(std::string_view(s_magic, sizeof(s_magic)));
+		char* out = m_writer.reserve(s_max_record_size);
+		out = put_u8(out, s_version);
+		for (const std::uint16_t reg : m_registers) out = put_u16(out, reg);
+		for (const std::uint16_t segment : m_segments) out = put_u16(out, segment);
+		out = put_signed(out, m_ip);
+		out = put_u16(out, m_flags);
+		out = put_varint(out, ctx.total_clocks);
+		out = put_varint(out, stored_size);
+		m_writer.commit(out);
+		m_writer.write(std::string_view(reinterpret_cast<const char*>(ctx.memory.data()), stored_size));
+	}
+
+	void Trace_recorder::record(const Context& ctx, const Instruction& inst)
+	{
+		char* const start = m_writer.reserve(s_max_record_size);
+		char* out = start + 1;
+		std::uint8_t header = 0;
+
+		Trace_prediction& prediction = m_predictions[m_ip & 0xffff];
+		if (prediction.opcode != inst.opcode)
+		{
+			header |= Trace_record_opcode;
+			out = put_u8(out, inst.opcode);
+			prediction.opcode = inst.opcode;
+		}
+		const std::int32_t ip_delta = static_cast<std::int32_t>(ctx.ip - m_ip);
+		if (prediction.ip_delta != ip_delta || prediction.clocks != ctx.clocks)
+		{
+			header |= Trace_record_branch;
+			out = put_signed(out, ip_delta);
+			out = put_varint(out, ctx.clocks);
+			prediction.ip_delta = ip_delta;
+			prediction.clocks = ctx.clocks;
+		}
+		m_ip = ctx.ip;
+
+		// NOTE(rksouthee): A memory destination is addressed with the registers from before the instruction, which
+		// are still those the recorder last wrote. A word at the end of its segment wraps around to the start of
+		// it and is recorded as two bytes.
+		struct Write
+		{
+			std::uint32_t addr;
+			std::uint8_t size;
+		} writes[2];
+		std::uint8_t write_count = 0;
+		for (const Operand& operand : inst.operands)
+		{
+			if (operand.type != Operand_memory && operand.type != Operand_direct) continue;
+			const std::uint16_t segment = m_segments[get_segment(inst, operand)];
+			const std::uint16_t offset = get_memory_address(operand, m_registers);
+			const std::uint8_t size = inst.w ? 2 : 1;
+			bool changed = false;
+			for (std::uint8_t i = 0; i < size; ++i)
+			{
+				const std::uint32_t a = get_physical_address(segment, static_cast<std::uint16_t>(offset + i));
+				changed |= m_memory[a] != ctx.memory[a];
+				m_memory[a] = ctx.memory[a];
+			}
+			if (!changed) continue;
+			if (size == 2 && offset == 0xffff)
+			{
+				writes[write_count++] = { get_physical_address(segment, offset), 1 };
+				writes[write_count++] = { get_physical_address(segment, 0), 1 };
+			}
+			else
+			{
+				writes[write_count++] = { get_physical_address(segment, offset), size };
+			}
+		}
+
+		// NOTE(rksouthee): A string instruction writes an element for each repetition, the span of them that
+		// changed is recorded as a block at an offset in es.
+		const std::uint16_t es = m_segments[Segment_es];
+		std::uint16_t block_addr = 0;
+		std::uint32_t block_size = 0;
+		if (inst.operation == Operation_movs || inst.operation == Operation_stos)
+		{
+			const std::uint32_t size = inst.w ? 2 : 1;
+			const bool repeat = (inst.flags & (Instruction_rep | Instruction_repne)) != 0;
+			const std::uint32_t count = repeat ? static_cast<std::uint16_t>(m_registers[1] - ctx.registers[1]) : 1;
+			const std::uint16_t di = m_registers[7];
+			const std::uint16_t first = get_flag(ctx, Context::Flags_direction) ? static_cast<std::uint16_t>(di - (count - 1) * size) : di;
+			std::uint32_t changed_first = 0;
+			for (std::uint32_t i = 0; count != 0 && i < count * size; ++i)
+			{
+				const std::uint32_t a = get_physical_address(es, static_cast<std::uint16_t>(first + i));
+				if (m_memory[a] == ctx.memory[a]) continue;
+				if (block_size == 0) changed_first = i;
+				block_size = i + 1 - changed_first;
+				m_memory[a] = ctx.memory[a];
+			}
+			block_addr = static_cast<std::uint16_t>(first + changed_first);
+		}
+
+		std::uint16_t register_mask = 0;
+		for (std::uint8_t i = 0; i < s_register_count; ++i)
+		{
+			if (get_register(ctx.registers, ctx.segments, i) != get_register(m_registers, m_segments, i)) register_mask |= 1 << i;
+		}
+		if (register_mask != 0)
+		{
+			if (std::has_single_bit(register_mask))
+			{
+				header |= static_cast<std::uint8_t>(std::countr_zero(register_mask) + 1);
+			}
+			else
+			{
+				header |= Trace_record_many;
+				out = put_varint(out, register_mask);
+			}
+			for (std::uint8_t i = 0; i < s_register_count; ++i)
+			{
+				if (!(register_mask & (1 << i))) continue;
+				const std::uint16_t value = get_register(ctx.registers, ctx.segments, i);
+				std::uint16_t& recorded = get_register(m_registers, m_segments, i);
+				out = put_signed(out, get_register_delta(recorded, value));
+				recorded = value;
+			}
+		}
+
+		const std::uint16_t flags = get_flags(ctx);
+		if (flags != m_flags) header |= Trace_record_flags;
+		if (block_size != 0)
+		{
+			header |= Trace_record_memory;
+			put_u8(start, header);
+			out = put_u8(out, s_write_block);
+			out = put_signed(out, static_cast<std::int16_t>(block_addr - prediction.write_address));
+			out = put_varint(out, block_size);
+			m_writer.commit(out);
+			prediction.write_address = block_addr;
+			// The block may wrap around the end of its segment, and the segment around the end of memory
+			for (std::uint32_t done = 0; done != block_size;)
+			{
+				const std::uint16_t offset = static_cast<std::uint16_t>(block_addr + done);
+				const std::uint32_t addr = get_physical_address(es, offset);
+				const std::uint32_t size = std::min({ block_size - done, static_cast<std::uint32_t>(segment_size - offset), static_cast<std::uint32_t>(memory_size - addr) });
+				m_writer.write(std::string_view(reinterpret_cast<const char*>(ctx.memory.data() + addr), size));
+				done += size;
+			}
+			out = m_writer.reserve(s_max_record_size);
+		}
+		else if (write_count != 0)
+		{
+			header |= Trace_record_memory;
+			std::uint8_t description = write_count;
+			for (std::uint8_t i = 0; i < write_count; ++i)
+			{
+				if (writes[i].size == 2) description |= s_write_word << i;
+			}
+			out = put_u8(out, description);
+			for (std::uint8_t i = 0; i < write_count; ++i)
+			{
+				out = put_signed(out, get_address_delta(prediction.write_address, writes[i].addr));
+				prediction.write_address = writes[i].addr;
+				for (std::uint8_t j = 0; j < writes[i].size; ++j)
+				{
+					out = put_u8(out, ctx.memory[(writes[i].addr + j) & (memory_size - 1)]);
+				}
+			}
+		}
+
+		if (flags != m_flags)
+		{
+			out = put_varint(out, flags ^ m_flags);
+			m_flags = flags;
+		}
+
+		if (block_size == 0) put_u8(start, header);
+		m_writer.commit(out);
+	}
+
+	Trace_reader::Trace_reader(std::istream& is) :
+		m_is(is),
+		m_predictions(make_predictions())
+	{
+	}
+
+	bool Trace_reader::start(Trace_state& state)
+	{
+		Input in{ m_is };
+		char magic[sizeof(s_magic)];
+		if (!m_is.read(magic, sizeof(magic)) || !std::equal(std::begin(magic), std::end(magic), s_magic)) return false;
+		std::uint8_t version;
+		if (!in.u8(version) || version != s_version) return false;
+		for (std::uint16_t& reg : state.registers)
+		{
+			if (!in.u16(reg)) return false;
+		}
+		for (std::uint16_t& segment : state.segments)
+		{
+			if (!in.u16(segment)) return false;
+		}
+		std::int64_t ip;
+		std::uint64_t total_clocks, stored_size;
+		if (!in.signed_varint(ip) || !in.u16(state.flags) || !in.varint(total_clocks) || !in.varint(stored_size)) return false;
+		if (stored_size > sizeof(state.memory)) return false;
+		std::fill(std::begin(state.memory), std::end(state.memory), 0);
+		if (!m_is.read(reinterpret_cast<char*>(state.memory), static_cast<std::streamsize>(stored_size))) return false;
+		state.ip = static_cast<std::ptrdiff_t>(ip);
+		state.total_clocks = total_clocks;
+		state.steps = 0;
+		state.opcode = 0;
+		return true;
+	}
+
+	bool Trace_reader::next(Trace_state& state)
+	{
+		Input in{ m_is };
+		std::uint8_t header;
+		if (!in.u8(header)) return false;
+
+		Trace_prediction& prediction = m_predictions[state.ip & 0xffff];
+		if (header & Trace_record_opcode)
+		{
+			std::uint8_t opcode;
+			if (!in.u8(opcode)) return false;
+			prediction.opcode = opcode;
+		}
+		if (header & Trace_record_branch)
+		{
+			std::int64_t delta;
+			std::uint64_t clocks;
+			if (!in.signed_varint(delta) || !in.varint(clocks)) return false;
+			prediction.ip_delta = static_cast<std::int32_t>(delta);
+			prediction.clocks = static_cast<std::uint32_t>(clocks);
+		}
+		state.opcode = static_cast<std::uint8_t>(prediction.opcode);
+		state.ip += prediction.ip_delta;
+		state.total_clocks += prediction.clocks;
+
+		const std::uint8_t reg = header & Trace_record_register;
+		std::uint64_t register_mask = 0;
+		if (reg == Trace_record_many)
+		{
+			if (!in.varint(register_mask)) return false;
+		}
+		else if (reg != 0)
+		{
+			register_mask = 1u << (reg - 1);
+		}
+		for (std::uint8_t i = 0; i < s_register_count; ++i)
+		{
+			if (!(register_mask & (1u << i))) continue;
+			std::int64_t delta;
+			if (!in.signed_varint(delta)) return false;
+			std::uint16_t& value = get_register(state.registers, state.segments, i);
+			value = static_cast<std::uint16_t>(value + delta);
+		}
+
+		if (header & Trace_record_memory)
+		{
+			std::uint8_t description;
+			if (!in.u8(description)) return false;
+			if (description == s_write_block)
+			{
+				std::int64_t delta;
+				std::uint64_t size;
+				if (!in.signed_varint(delta) || !in.varint(size) || size > 2 * segment_size) return false;
+				const std::uint16_t offset = static_cast<std::uint16_t>(prediction.write_address + delta);
+				prediction.write_address = offset;
+				for (std::uint64_t i = 0; i < size; ++i)
+				{
+					const std::uint32_t addr = get_physical_address(state.segments[Segment_es], static_cast<std::uint16_t>(offset + i));
+					if (!in.u8(state.memory[addr])) return false;
+				}
+			}
+			for (std::uint8_t i = 0; description != s_write_block && i < (description & s_write_count_mask); ++i)
+			{
+				std::int64_t delta;
+				if (!in.signed_varint(delta)) return false;
+				const std::uint32_t addr = (prediction.write_address + delta) & (memory_size - 1);
+				prediction.write_address = addr;
+				const std::uint8_t size = (description & (s_write_word << i)) ? 2 : 1;
+				for (std::uint8_t j = 0; j < size; ++j)
+				{
+					if (!in.u8(state.memory[(addr + j) & (memory_size - 1)])) return false;
+				}
+			}
+		}
+
+		if (header & Trace_record_flags)
+		{
+			std::uint64_t changed;
+			if (!in.varint(changed)) return false;
+			state.flags ^= static_cast<std::uint16_t>(changed);
+		}
+
+		++state.steps;
+		return true;
+	}
+}
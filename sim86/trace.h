@@ -0,0 +1,96 @@
+#pragma once
+
+#include "simulator.h"
+#include "writer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+namespace sim86
+{
+	// NOTE(rksouthee): A trace starts with the initial state of the context and then holds one record per executed
+	// instruction with only what it changed. The opcode, the change of ip and the clocks are predicted to be those
+	// of the last instruction executed at the same address, which they are for everything but branches and
+	// modified code:
+	//   u8      header, Trace_record flags with the written register in the low bits
+	//   u8      opcode, when it wasn't predicted
+	//   varint  change of ip and clocks, when they weren't predicted
+	//   varint  change of each written register, after a varint mask of them when more than one was written
+	//   u8      count of memory writes in the low bits and which are words above them, then for each the change
+	//           of physical address from the last write at the same address and the bytes written. A count of 3
+	//           is a block written by a string instruction, its change of offset in es is followed by its length.
+	//   varint  the flags that changed
+	// Varints are LEB128, the changes of ip, registers and addresses are zigzag encoded. The registers are ax to di
+	// followed by the segment registers es to ds.
+	enum Trace_record : std::uint8_t
+	{
+		Trace_record_register = 0x0f, // 0 for none, 1-12 for the one register written plus one or Trace_record_many
+		Trace_record_many = 0x0f,
+		Trace_record_memory = 0x10,
+		Trace_record_flags = 0x20,
+		Trace_record_opcode = 0x40,
+		Trace_record_branch = 0x80, // the change of ip and the clocks
+	};
+
+	// What the last instruction executed at an address did
+	struct Trace_prediction
+	{
+		std::uint16_t opcode; // more than a byte until the address has been executed
+		std::int32_t ip_delta;
+		std::uint32_t clocks;
+		std::uint32_t write_address;
+	};
+
+	// The state of the guest after some number of steps of a trace
+	struct Trace_state
+	{
+		std::uint8_t memory[memory_size];
+		std::uint16_t registers[8];
+		std::uint16_t segments[4];
+		std::ptrdiff_t ip;
+		std::uint16_t flags;
+		std::uint64_t total_clocks;
+		std::uint64_t steps;
+		std::uint8_t opcode; // of the last instruction executed
+	};
+
+	class Trace_recorder
+	{
+	private:
+		Writer m_writer;
+		std::unique_ptr<std::uint8_t[]> m_memory; // as the trace has described it so far
+		std::uint16_t m_registers[8];
+		std::uint16_t m_segments[4];
+		std::ptrdiff_t m_ip;
+		std::uint16_t m_flags;
+		std::unique_ptr<Trace_prediction[]> m_predictions; // by address
+
+	public:
+		// Writes the header with the state of ctx before anything executes
+		Trace_recorder(std::ostream& os, const Context& ctx);
+		Trace_recorder(const Trace_recorder&) = delete;
+		Trace_recorder& operator=(const Trace_recorder&) = delete;
+
+		// Call after each instruction, as a Trace_fn
+		void record(const Context& ctx, const Instruction& inst);
+		void flush() { m_writer.flush(); }
+	};
+
+	class Trace_reader
+	{
+	private:
+		std::istream& m_is;
+		std::unique_ptr<Trace_prediction[]> m_predictions; // by address
+
+	public:
+		explicit Trace_reader(std::istream& is);
+
+		// Reads the initial state, false if this is not a trace
+		bool start(Trace_state& state);
+		// Applies the next record, false at the end of the trace
+		bool next(Trace_state& state);
+	};
+}
@@ -0,0 +1,30 @@
+#include "writer.h"
+
+namespace sim86
+{
+	char* Writer::reserve(const std::size_t size)
+	{
+		if (s_buffer_size - m_used < size) flush();
+		return m_buffer + m_used;
+	}
+
+	void Writer::write(const std::string_view text)
+	{
+		if (text.size() > s_buffer_size)
+		{
+			flush();
+			m_os.write(text.data(), text.size());
+			return;
+		}
+		char* out = reserve(text.size());
+		text.copy(out, text.size());
+		m_used += text.size();
+	}
+
+	void Writer::flush()
+	{
+		if (m_used == 0) return;
+		m_os.write(m_buffer, m_used);
+		m_used = 0;
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+
+namespace sim86
+{
+	// Gathers output in a fixed buffer and hands it to the stream in large writes, nothing is allocated or flushed
+	// per line.
+	class Writer
+	{
+	private:
+		static constexpr std::size_t s_buffer_size = 1 << 16;
+
+		std::ostream& m_os;
+		std::size_t m_used = 0;
+		char m_buffer[s_buffer_size];
+
+	public:
+		explicit Writer(std::ostream& os) : m_os(os) {}
+		~Writer() { flush(); }
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		// Returns room for at least size characters, pass the end of what was written to commit
+		char* reserve(std::size_t size);
+		void commit(const char* end) { m_used = end - m_buffer; }
+
+		void write(std::string_view text);
+		void put(char c) { *reserve(1) = c; ++m_used; }
+		void flush();
+	};
+}